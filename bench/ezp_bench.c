@@ -0,0 +1,382 @@
+#include "ezp_prog.h"
+#include "ezp_emulator.h"
+#include "ezp_errors.h"
+#include "ezp_chips_data_file.h"
+#include "ezp_digest.h"
+#include "ezp_kernels.h"
+#include "ezp_clock.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define KERNEL_BUFFER_SIZE (16 * 1024 * 1024)
+#define KERNEL_MIN_SECONDS 0.25
+#define DB_ENTRIES 20000
+#define DB_LOOKUPS 200000
+
+typedef enum {
+    FORMAT_JSON,
+    FORMAT_CSV
+} output_format;
+
+/**
+ * format - output format
+ * chips - chips data file to benchmark, NULL to generate one
+ * flash_size - bytes moved by every transfer benchmark
+ * emulate - use the emulator even when a programmer is attached
+ * write - run write benchmarks on a real programmer, destroying the chip contents
+ * latency, bandwidth - emulator timing, see ezp_emulator_config
+ */
+typedef struct {
+    output_format format;
+    const char *chips;
+    uint32_t flash_size;
+    int emulate;
+    int write;
+    double latency;
+    double bandwidth;
+} bench_options;
+
+static output_format format;
+static int results_count = 0;
+
+//one line per measurement. rate is unit per second, or seconds per operation for "ns/op"
+static void report(const char *benchmark, const char *variant, uint64_t bytes, uint64_t iterations, double seconds,
+                   double rate, const char *unit) {
+    if (format == FORMAT_CSV) {
+        if (results_count == 0) printf("benchmark,variant,bytes,iterations,seconds,rate,unit\n");
+        printf("%s,%s,%llu,%llu,%.6f,%.3f,%s\n", benchmark, variant, (unsigned long long) bytes,
+               (unsigned long long) iterations, seconds, rate, unit);
+    } else {
+        printf("%s    {\"benchmark\": \"%s\", \"variant\": \"%s\", \"bytes\": %llu, \"iterations\": %llu, "
+               "\"seconds\": %.6f, \"rate\": %.3f, \"unit\": \"%s\"}",
+               results_count == 0 ? "" : ",\n", benchmark, variant, (unsigned long long) bytes,
+               (unsigned long long) iterations, seconds, rate, unit);
+    }
+    fflush(stdout);
+    results_count++;
+}
+
+static void report_throughput(const char *benchmark, const char *variant, uint64_t bytes, uint64_t iterations,
+                              double seconds) {
+    report(benchmark, variant, bytes, iterations, seconds, seconds > 0 ? (double) bytes / seconds : 0, "B/s");
+}
+
+static void report_latency(const char *benchmark, const char *variant, uint64_t iterations, double seconds) {
+    report(benchmark, variant, 0, iterations, seconds, iterations ? seconds * 1e9 / (double) iterations : 0, "ns/op");
+}
+
+static const char *const speed_names[] = {"12MHz", "6MHz", "3MHz", "1.5MHz", "750kHz", "375kHz"};
+
+//the emulator does not model the SPI clock, so it is only measured at one speed
+static void bench_transfers(ezp_programmer *programmer, ezp_chip_data *chip_data, int write, ezp_speed slowest) {
+    uint8_t *image = malloc(chip_data->flash);
+    uint8_t *buffer = malloc(chip_data->flash);
+    if (!image || !buffer) {
+        fprintf(stderr, "Out of memory\n");
+        free(image);
+        free(buffer);
+        return;
+    }
+    for (uint32_t i = 0; i < chip_data->flash; ++i) image[i] = (uint8_t) (i * 31 + (i >> 8));
+
+    static const uint16_t pages[] = {64, 128, 256};
+    static const unsigned int depths[] = {1, EZP_DEFAULT_QUEUE_DEPTH, 32};
+    char variant[64];
+    for (ezp_speed speed = SPEED_12MHZ; speed <= slowest; ++speed) {
+        for (size_t p = 0; p < sizeof(pages) / sizeof(pages[0]); ++p) {
+            for (size_t d = 0; d < sizeof(depths) / sizeof(depths[0]); ++d) {
+                ezp_chip_data chip = *chip_data;
+                chip.flash_page = pages[p];
+                ezp_set_queue_depth(programmer, depths[d]);
+                snprintf(variant, sizeof(variant), "speed=%s block=%u depth=%u", speed_names[speed], pages[p],
+                         depths[d]);
+
+                double started;
+                int ret;
+                if (write) {
+                    started = ezp_monotonic_seconds();
+                    ret = ezp_write_flash(programmer, image, &chip, speed, NULL, NULL);
+                    if (ret == EZP_OK) report_throughput("write", variant, chip.flash, 1, ezp_monotonic_seconds() - started);
+                    else fprintf(stderr, "write %s failed: %d\n", variant, ret);
+                }
+
+                started = ezp_monotonic_seconds();
+                ret = ezp_read_flash_into(programmer, buffer, &chip, speed, NULL, NULL);
+                if (ret == EZP_OK) report_throughput("read", variant, chip.flash, 1, ezp_monotonic_seconds() - started);
+                else fprintf(stderr, "read %s failed: %d\n", variant, ret);
+
+                if (!write) continue;
+                started = ezp_monotonic_seconds();
+                ret = ezp_verify_flash(programmer, image, &chip, speed, NULL, NULL, 0, NULL, NULL);
+                if (ret == EZP_OK) report_throughput("verify", variant, chip.flash, 1, ezp_monotonic_seconds() - started);
+                else fprintf(stderr, "verify %s failed: %d\n", variant, ret);
+            }
+        }
+    }
+    ezp_set_queue_depth(programmer, EZP_DEFAULT_QUEUE_DEPTH);
+    free(image);
+    free(buffer);
+}
+
+//run a kernel over buffer until KERNEL_MIN_SECONDS have passed
+#define BENCH_KERNEL(benchmark, variant, call) do { \
+        uint64_t iterations = 0; \
+        double started = ezp_monotonic_seconds(), elapsed; \
+        do { \
+            call; \
+            iterations++; \
+            elapsed = ezp_monotonic_seconds() - started; \
+        } while (elapsed < KERNEL_MIN_SECONDS); \
+        report_throughput(benchmark, variant, (uint64_t) KERNEL_BUFFER_SIZE * iterations, iterations, elapsed); \
+    } while (0)
+
+static volatile size_t sink_size;
+static volatile uint32_t sink_crc;
+
+static void bench_kernels() {
+    uint8_t *a = malloc(KERNEL_BUFFER_SIZE);
+    uint8_t *b = malloc(KERNEL_BUFFER_SIZE);
+    if (!a || !b) {
+        fprintf(stderr, "Out of memory\n");
+        free(a);
+        free(b);
+        return;
+    }
+    memset(a, 0xff, KERNEL_BUFFER_SIZE);
+    memset(b, 0xff, KERNEL_BUFFER_SIZE);
+
+    BENCH_KERNEL("compare", ezp_kernels_isa(), sink_size = ezp_mismatch(a, b, KERNEL_BUFFER_SIZE));
+    BENCH_KERNEL("blank_check", ezp_kernels_isa(), sink_size = ezp_fill_span(a, KERNEL_BUFFER_SIZE, 0xff));
+    BENCH_KERNEL("crc32", ezp_crc32_isa(), sink_crc = ezp_crc32_update(0xffffffff, a, KERNEL_BUFFER_SIZE));
+    ezp_digest_state state;
+    ezp_digest digest;
+    BENCH_KERNEL("digest", "crc32+xxh64", {
+        ezp_digest_init(&state);
+        ezp_digest_update(&state, a, KERNEL_BUFFER_SIZE);
+        ezp_digest_final(&state, &digest);
+        sink_crc = digest.crc32;
+    });
+    free(a);
+    free(b);
+}
+
+//synthetic database with shared chip ids, like the real one
+static int generate_chips(const char *file) {
+    ezp_chip_data *data = calloc(DB_ENTRIES, sizeof(ezp_chip_data));
+    if (!data) return EZP_OUT_OF_MEMORY;
+    static const char *const types[] = {"SPI_FLASH", "EEPROM_24", "EEPROM_93", "EEPROM_25", "EEPROM_95"};
+    for (uint32_t i = 0; i < DB_ENTRIES; ++i) {
+        data[i].clazz = i % 5;
+        snprintf(data[i].name, sizeof(data[i].name), "%s,VENDOR%u,CHIP%05u", types[data[i].clazz], i % 97, i);
+        data[i].chip_id = 0xef4000 + i % (DB_ENTRIES / 4);
+        data[i].flash = 1u << (10 + i % 14);
+        data[i].flash_page = 256;
+    }
+    int ret = ezp_chips_data_write(data, DB_ENTRIES, file);
+    free(data);
+    return ret;
+}
+
+static void bench_chips_file(const char *file, const char *variant) {
+    double started = ezp_monotonic_seconds();
+    ezp_chips_db *db;
+    int ret = ezp_chips_db_open(&db, file);
+    double elapsed = ezp_monotonic_seconds() - started;
+    if (ret != EZP_OK) {
+        fprintf(stderr, "Can't open %s: %d\n", file, ret);
+        return;
+    }
+    report_latency("db_open", variant, 1, elapsed);
+
+    size_t count = ezp_chips_db_count(db);
+    if (count == 0) {
+        ezp_chips_db_close(db);
+        return;
+    }
+    ezp_chip_data *entries = malloc(count * sizeof(ezp_chip_data));
+    if (!entries) {
+        ezp_chips_db_close(db);
+        return;
+    }
+    for (uint32_t i = 0; i < count; ++i) ezp_chips_db_get(db, i, &entries[i]);
+
+    uint32_t matches[16];
+    started = ezp_monotonic_seconds();
+    for (uint32_t i = 0; i < DB_LOOKUPS; ++i) {
+        sink_size = ezp_chips_db_find_by_id(db, entries[(i * 7919u) % count].chip_id, matches, 16);
+    }
+    report_latency("db_find_by_id", variant, DB_LOOKUPS, ezp_monotonic_seconds() - started);
+
+    //chip names are the last field of name
+    char (*names)[sizeof(entries->name) + 1] = malloc(count * sizeof(*names));
+    if (names) {
+        for (uint32_t i = 0; i < count; ++i) {
+            const char *comma = memchr(entries[i].name, ',', sizeof(entries->name));
+            const char *last = entries[i].name;
+            while (comma) {
+                last = comma + 1;
+                comma = memchr(last, ',', sizeof(entries->name) - (last - entries[i].name));
+            }
+            size_t length = strnlen(last, sizeof(entries->name) - (last - entries[i].name));
+            memcpy(names[i], last, length);
+            names[i][length] = 0;
+        }
+        started = ezp_monotonic_seconds();
+        for (uint32_t i = 0; i < DB_LOOKUPS; ++i) {
+            sink_size = ezp_chips_db_find_by_name(db, names[(i * 7919u) % count], matches, 16);
+        }
+        report_latency("db_find_by_name", variant, DB_LOOKUPS, ezp_monotonic_seconds() - started);
+
+        started = ezp_monotonic_seconds();
+        for (uint32_t i = 0; i < DB_LOOKUPS / 100; ++i) {
+            char prefix[8];
+            snprintf(prefix, sizeof(prefix), "%s", names[(i * 7919u) % count]); //all but the last characters
+            sink_size = ezp_chips_db_find_prefix(db, prefix, matches, 16);
+        }
+        report_latency("db_find_prefix", variant, DB_LOOKUPS / 100, ezp_monotonic_seconds() - started);
+        free(names);
+    }
+
+    started = ezp_monotonic_seconds();
+    sink_size = ezp_chips_db_search(db, "vendor1", NULL, 0);
+    report_latency("db_search", variant, 1, ezp_monotonic_seconds() - started);
+
+    free(entries);
+    ezp_chips_db_close(db);
+}
+
+static void bench_chips(const char *chips) {
+    char legacy[] = "/tmp/ezp_bench_XXXXXX";
+    char indexed[] = "/tmp/ezp_bench_XXXXXX";
+    int generated = !chips;
+    if (generated) {
+        int fd = mkstemp(legacy);
+        if (fd < 0 || generate_chips(legacy) != EZP_OK) {
+            fprintf(stderr, "Can't generate chips data\n");
+            if (fd >= 0) {
+                close(fd);
+                unlink(legacy);
+            }
+            return;
+        }
+        close(fd);
+        chips = legacy;
+    }
+
+    bench_chips_file(chips, "source");
+    int fd = mkstemp(indexed);
+    if (fd < 0) {
+        fprintf(stderr, "Can't create indexed chips data\n");
+        if (generated) unlink(legacy);
+        return;
+    }
+    close(fd);
+    double started = ezp_monotonic_seconds();
+    int ret = ezp_chips_data_convert(chips, indexed);
+    if (ret == EZP_OK) {
+        report_latency("db_convert", "indexed", 1, ezp_monotonic_seconds() - started);
+        bench_chips_file(indexed, "indexed");
+    } else {
+        fprintf(stderr, "Can't convert %s: %d\n", chips, ret);
+    }
+    unlink(indexed);
+    if (generated) unlink(legacy);
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [--csv] [--chips FILE] [--size BYTES] [--emulate] [--write]\n"
+                    "          [--latency SECONDS] [--bandwidth BYTES_PER_SECOND]\n"
+                    "Runs against the attached programmer, or the emulator when there is none.\n"
+                    "Writes to a real programmer only with --write, which destroys the chip contents.\n", name);
+}
+
+int main(int argc, char **argv) {
+    bench_options options = {
+            .format = FORMAT_JSON,
+            .flash_size = 256 * 1024,
+            .latency = 125e-6, //full speed USB frame
+            .bandwidth = 1e6
+    };
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--csv") == 0) options.format = FORMAT_CSV;
+        else if (strcmp(argv[i], "--json") == 0) options.format = FORMAT_JSON;
+        else if (strcmp(argv[i], "--emulate") == 0) options.emulate = 1;
+        else if (strcmp(argv[i], "--write") == 0) options.write = 1;
+        else if (strcmp(argv[i], "--chips") == 0 && i + 1 < argc) options.chips = argv[++i];
+        else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc) options.flash_size = strtoul(argv[++i], NULL, 0);
+        else if (strcmp(argv[i], "--latency") == 0 && i + 1 < argc) options.latency = strtod(argv[++i], NULL);
+        else if (strcmp(argv[i], "--bandwidth") == 0 && i + 1 < argc) options.bandwidth = strtod(argv[++i], NULL);
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (options.flash_size == 0 || options.flash_size % 256 != 0) {
+        fprintf(stderr, "--size must be a non-zero multiple of 256\n");
+        return 1;
+    }
+    format = options.format;
+
+    ezp_programmer *programmer = NULL;
+    int usb = !options.emulate && ezp_init() == 0;
+    if (usb) programmer = ezp_find_programmer();
+
+    ezp_chip_data chip_data = {
+            .name = "SPI_FLASH,EMULATED,BENCH",
+            .chip_id = 0xef4018,
+            .flash = options.flash_size,
+            .flash_page = 256,
+            .clazz = SPI_FLASH
+    };
+    const char *device = "usb";
+    int write = options.write;
+    ezp_speed slowest = SPEED_375KHZ;
+    if (programmer) {
+        ezp_flash type;
+        uint32_t chip_id;
+        if (ezp_test_flash(programmer, &type, &chip_id) != EZP_OK) {
+            fprintf(stderr, "No chip detected\n");
+            ezp_free_programmer(programmer);
+            programmer = NULL;
+        } else {
+            //the chip is only identified, the benchmark moves options.flash_size bytes
+            chip_data.chip_id = chip_id;
+            chip_data.clazz = type;
+        }
+    }
+    if (!programmer) {
+        ezp_emulator_config config = {
+                .flash_size = options.flash_size,
+                .chip_id = chip_data.chip_id,
+                .type = SPI_FLASH,
+                .latency = options.latency,
+                .bandwidth = options.bandwidth
+        };
+        programmer = ezp_emulator_new(&config);
+        if (!programmer) {
+            fprintf(stderr, "Can't create emulator\n");
+            return 1;
+        }
+        device = "emulator";
+        write = 1;
+        slowest = SPEED_12MHZ;
+    }
+
+    if (format == FORMAT_JSON) {
+        printf("{\n  \"device\": \"%s\",\n  \"flash_size\": %u,\n  \"kernels_isa\": \"%s\",\n"
+               "  \"crc32_isa\": \"%s\",\n  \"results\": [\n", device, options.flash_size, ezp_kernels_isa(),
+               ezp_crc32_isa());
+    }
+
+    bench_transfers(programmer, &chip_data, write, slowest);
+    bench_kernels();
+    bench_chips(options.chips);
+
+    if (format == FORMAT_JSON) printf("\n  ]\n}\n");
+
+    ezp_free_programmer(programmer);
+    if (usb) ezp_free();
+    return 0;
+}
@@ -0,0 +1,101 @@
+#ifndef LIBEZP2023PLUS_EZP_CAPTURE_H
+#define LIBEZP2023PLUS_EZP_CAPTURE_H
+
+#include "ezp_prog.h"
+#include <stdio.h>
+
+#define EZP_TRACE_MAGIC 0x54505a45 //"EZPT"
+#define EZP_TRACE_VERSION 1
+
+/**
+ * Trace file header, followed by records up to the end of the file. All fields are in host byte order
+ * magic - EZP_TRACE_MAGIC
+ * version - EZP_TRACE_VERSION
+ * record_size - sizeof(ezp_trace_record) of the writer
+ */
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t record_size;
+} ezp_trace_header;
+
+/**
+ * One transfer of a trace, followed by size bytes of payload
+ * timestamp - nanoseconds from the creation of the capture to the completion of the transfer
+ * duration - microseconds from the submission to the completion of the transfer
+ * status - libusb error code the transfer completed with
+ * length - bytes requested
+ * actual_length - bytes transferred
+ * size - payload bytes. OUT transfers carry the requested data, IN transfers the received data
+ * endpoint - endpoint address, LIBUSB_ENDPOINT_IN bit set for device to host transfers
+ */
+typedef struct {
+    uint64_t timestamp;
+    uint32_t duration;
+    int32_t status;
+    uint32_t length;
+    uint32_t actual_length;
+    uint32_t size;
+    uint8_t endpoint;
+    uint8_t reserved[3];
+} ezp_trace_record;
+
+/**
+ * Create a capture. Records are appended to an in-memory ring by the thread driving the programmer
+ * without taking locks, and written to file by ezp_capture_flush, which may run on another thread.
+ * Records that do not fit into the ring are dropped and counted
+ * @param capacity ring size in bytes, rounded up to a power of two
+ * @param file trace destination, the trace header is written immediately. Must stay open until ezp_capture_free
+ * @return new capture, or NULL when out of memory or the header could not be written
+ */
+ezp_capture *ezp_capture_new(size_t capacity, FILE *file);
+
+/**
+ * Flush the remaining records and free the capture. It must be detached from its programmer first
+ * @param capture
+ */
+void ezp_capture_free(ezp_capture *capture);
+
+/**
+ * Write the records collected so far to the trace file
+ * @param capture
+ * @return EZP_OK, or EZP_ERROR_IO if the file could not be written
+ */
+int ezp_capture_flush(ezp_capture *capture);
+
+/**
+ * Count records dropped because the ring was full
+ * @param capture
+ * @return dropped records count
+ */
+uint64_t ezp_capture_dropped(ezp_capture *capture);
+
+/**
+ * Start or stop recording every transfer of the programmer. Call it from the thread driving the programmer,
+ * and only while no operation is in progress
+ * @param programmer
+ * @param capture capture to record into, NULL to stop recording
+ */
+void ezp_set_capture(ezp_programmer *programmer, ezp_capture *capture);
+
+/**
+ * Create a programmer that replays a trace. Every transfer is answered with the next record of the trace:
+ * IN transfers receive its payload, and all transfers complete with its status and length. A transfer on
+ * another endpoint than the record fails with LIBUSB_ERROR_IO without consuming it, and transfers past the end
+ * of the trace fail with LIBUSB_ERROR_NO_DEVICE. Both, and OUT payloads differing from the trace, are counted
+ * as divergences. Asynchronous operations are driven by ezp_programmer_handle_events
+ * @param file trace to replay, read completely
+ * @param timed 1 - transfers take their recorded duration, 0 - transfers complete immediately
+ * @param programmer new ezp_programmer instance, free with ezp_free_programmer
+ * @return EZP_OK, EZP_ERROR_IO, EZP_ERROR_INVALID_FILE or EZP_OUT_OF_MEMORY
+ */
+int ezp_replay_new(FILE *file, int timed, ezp_programmer **programmer);
+
+/**
+ * Count transfers that did not follow the replayed trace
+ * @param programmer
+ * @return divergences count, or -1 when programmer does not replay a trace
+ */
+int64_t ezp_replay_divergences(ezp_programmer *programmer);
+
+#endif //LIBEZP2023PLUS_EZP_CAPTURE_H
@@ -49,7 +49,7 @@ typedef enum {
 } ezp_voltage;
 
 /**
- * Read chips data from file
+ * Read chips data from file, legacy or indexed format
  * @param data Buffer for data
  * @param file File path
  * @return Entries count if success, or EZP_ERROR_IO or EZP_ERROR_INVALID_FILE when an error occurred
@@ -65,4 +65,109 @@ int ezp_chips_data_read(ezp_chip_data **data, const char *file);
  */
 int ezp_chips_data_write(ezp_chip_data *data, size_t count, const char *file);
 
+/**
+ * Write chips data in the indexed format. Entries are grouped by clazz, keeping their order inside a class,
+ * so entry indices of the written file can differ from the ones of data
+ * @param data Buffer with data
+ * @param count Entries count
+ * @param file File path
+ * @return EZP_OK if success or EZP_ERROR_IO, EZP_ERROR_INVALID_FILE or EZP_OUT_OF_MEMORY when an error occurred
+ */
+int ezp_chips_data_write_indexed(const ezp_chip_data *data, size_t count, const char *file);
+
+/**
+ * Convert a chips data file of any format into the indexed format
+ * @param legacy_file Source file path
+ * @param file Destination file path
+ * @return EZP_OK if success, or EZP_ERROR_IO, EZP_ERROR_INVALID_FILE or EZP_OUT_OF_MEMORY when an error occurred
+ */
+int ezp_chips_data_convert(const char *legacy_file, const char *file);
+
+/**
+ * Read-only chips database mapped from a chips data file of either format. Entries are addressed by index,
+ * from 0 to ezp_chips_db_count - 1
+ */
+typedef struct ezp_chips_db ezp_chips_db;
+
+/**
+ * Map chips data file. Indexed files are used as mapped, legacy files are indexed by chip id and by
+ * normalized chip name on open
+ * @param db receives the database
+ * @param file File path
+ * @return EZP_OK if success, or EZP_ERROR_IO, EZP_ERROR_INVALID_FILE or EZP_OUT_OF_MEMORY when an error occurred
+ */
+int ezp_chips_db_open(ezp_chips_db **db, const char *file);
+
+/**
+ * Unmap database and free its indices
+ * @param db
+ */
+void ezp_chips_db_close(ezp_chips_db *db);
+
+/**
+ * @param db
+ * @return Entries count
+ */
+size_t ezp_chips_db_count(const ezp_chips_db *db);
+
+/**
+ * Copy an entry
+ * @param db
+ * @param index entry index
+ * @param chip_data receives the entry
+ * @return EZP_OK if success or EZP_INVALID_RANGE when index is out of range
+ */
+int ezp_chips_db_get(const ezp_chips_db *db, uint32_t index, ezp_chip_data *chip_data);
+
+/**
+ * Find every entry with a chip id. Ids are shared by several parts, so all of them are reported
+ * @param db
+ * @param chip_id chip id, as returned by ezp_test_flash
+ * @param matches receives up to max_matches entry indices, may be NULL
+ * @param max_matches
+ * @return Count of matching entries, may exceed max_matches
+ */
+size_t ezp_chips_db_find_by_id(const ezp_chips_db *db, uint32_t chip_id, uint32_t *matches, size_t max_matches);
+
+/**
+ * Find every entry with a chip name, the last field of name. Comparison ignores case and everything
+ * but letters and digits, so "W25Q64FV" matches "w25q64-fv"
+ * @param db
+ * @param name chip name
+ * @param matches receives up to max_matches entry indices, may be NULL
+ * @param max_matches
+ * @return Count of matching entries, may exceed max_matches
+ */
+size_t ezp_chips_db_find_by_name(const ezp_chips_db *db, const char *name, uint32_t *matches, size_t max_matches);
+
+/**
+ * Find entries whose normalized chip name starts with prefix
+ * @param db
+ * @param prefix normalized like in ezp_chips_db_find_by_name
+ * @param matches receives up to max_matches entry indices sorted by chip name, may be NULL
+ * @param max_matches
+ * @return Count of matching entries, may exceed max_matches
+ */
+size_t ezp_chips_db_find_prefix(const ezp_chips_db *db, const char *prefix, uint32_t *matches, size_t max_matches);
+
+/**
+ * Find entries of a chip class
+ * @param db
+ * @param clazz
+ * @param matches receives up to max_matches entry indices, may be NULL
+ * @param max_matches
+ * @return Count of matching entries, may exceed max_matches
+ */
+size_t ezp_chips_db_find_by_class(const ezp_chips_db *db, ezp_flash clazz, uint32_t *matches, size_t max_matches);
+
+/**
+ * Find entries containing a substring anywhere in name, i.e. in type, manufacturer or chip name. Ignores case
+ * @param db
+ * @param pattern
+ * @param matches receives up to max_matches entry indices, may be NULL
+ * @param max_matches
+ * @return Count of matching entries, may exceed max_matches
+ */
+size_t ezp_chips_db_search(const ezp_chips_db *db, const char *pattern, uint32_t *matches, size_t max_matches);
+
 #endif //LIBEZP2023PLUS_EZP_CHIPS_DATA_FILE_H
@@ -0,0 +1,59 @@
+#ifndef LIBEZP2023PLUS_EZP_DIGEST_H
+#define LIBEZP2023PLUS_EZP_DIGEST_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * crc32 - CRC-32 (IEEE 802.3, same as zlib)
+ * xxh64 - XXH64 with seed 0
+ */
+typedef struct {
+    uint32_t crc32;
+    uint64_t xxh64;
+} ezp_digest;
+
+/**
+ * Incremental digest state. Fields are private
+ */
+typedef struct {
+    uint32_t crc;
+    uint64_t total;
+    uint64_t lanes[4];
+    uint8_t buffer[32];
+    uint32_t buffered;
+} ezp_digest_state;
+
+/**
+ * Start a new digest
+ * @param state
+ */
+void ezp_digest_init(ezp_digest_state *state);
+
+/**
+ * Add data to a digest
+ * @param state
+ * @param data
+ * @param size
+ */
+void ezp_digest_update(ezp_digest_state *state, const uint8_t *data, size_t size);
+
+/**
+ * Get the digest of all data added so far. The state can still be updated afterwards
+ * @param state
+ * @param digest
+ */
+void ezp_digest_final(const ezp_digest_state *state, ezp_digest *digest);
+
+/**
+ * Digest a whole image, e.g. a golden image to compare with digests computed while reading
+ * @param data
+ * @param size
+ * @param digest receives the digest of the whole image, may be NULL
+ * @param sector_size size of the sectors digested separately, 0 - no sector digests
+ * @param sector_digests receives size / sector_size digests, may be NULL
+ */
+void ezp_digest_image(const uint8_t *data, size_t size, ezp_digest *digest,
+                      uint32_t sector_size, ezp_digest *sector_digests);
+
+#endif //LIBEZP2023PLUS_EZP_DIGEST_H
@@ -0,0 +1,43 @@
+#ifndef LIBEZP2023PLUS_EZP_EMULATOR_H
+#define LIBEZP2023PLUS_EZP_EMULATOR_H
+
+#include "ezp_prog.h"
+
+/**
+ * flash_size - bytes of emulated flash, erased on creation
+ * chip_id - chip id reported to ezp_test_flash, 24 bits
+ * type - chip type reported to ezp_test_flash
+ * latency - seconds between the end of a transfer on the bus and its completion
+ * bandwidth - bus bytes/sec shared by all transfers. 0 - unlimited
+ * fail_transfer - data phase transfer, counted from 1 since creation, that fails first. 0 - none fails
+ * fail_count - data phase transfers failing from fail_transfer on. 0 - one
+ * fail_error - libusb error code of failing transfers, 0 - LIBUSB_ERROR_IO. Failing transfers move no data
+ */
+typedef struct {
+    uint32_t flash_size;
+    uint32_t chip_id;
+    ezp_flash type;
+    double latency;
+    double bandwidth;
+    uint32_t fail_transfer;
+    uint32_t fail_count;
+    int fail_error;
+} ezp_emulator_config;
+
+/**
+ * Create a programmer backed by an in-process emulator of the EZP2023+ protocol over RAM flash.
+ * Pipelined transfers overlap their latency the way they do on USB, so queue depth effects are measurable.
+ * Asynchronous operations are driven by ezp_programmer_handle_events
+ * @param config
+ * @return new ezp_programmer instance, free with ezp_free_programmer. NULL when out of memory
+ */
+ezp_programmer *ezp_emulator_new(const ezp_emulator_config *config);
+
+/**
+ * Emulated flash contents, config.flash_size bytes
+ * @param programmer
+ * @return flash contents, or NULL when programmer is not an emulator
+ */
+uint8_t *ezp_emulator_flash(ezp_programmer *programmer);
+
+#endif //LIBEZP2023PLUS_EZP_EMULATOR_H
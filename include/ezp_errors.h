@@ -9,5 +9,12 @@
 #define EZP_INVALID_DATA_FROM_PROGRAMMER (-5)
 #define EZP_FLASH_NOT_DETECTED (-6)
 #define EZP_HOTPLUG_UNSUPPORTED (-7)
+#define EZP_ABORTED (-8)
+#define EZP_INVALID_RANGE (-9)
+#define EZP_OUT_OF_MEMORY (-10)
+#define EZP_VERIFY_FAILED (-11)
+#define EZP_NOT_BLANK (-12)
+#define EZP_UNSUPPORTED (-13)
+#define EZP_CHIP_AMBIGUOUS (-14)
 
 #endif //LIBEZP2023PLUS_EZP_ERRORS_H
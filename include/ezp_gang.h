@@ -0,0 +1,35 @@
+#ifndef LIBEZP2023PLUS_EZP_GANG_H
+#define LIBEZP2023PLUS_EZP_GANG_H
+
+#include "ezp_prog.h"
+
+/**
+ * status - EZP_OK or the error of the step that failed
+ * seconds - wall time for this programmer
+ * write_throughput - bytes/sec of the write data phase
+ * verify_throughput - bytes/sec of the verify read, 0 if not verified
+ */
+typedef struct {
+    int status;
+    double seconds;
+    double write_throughput;
+    double verify_throughput;
+} ezp_gang_result;
+
+/**
+ * Write one image with several programmers at once. The asynchronous operations of all programmers are
+ * driven from the calling thread, which waits for events only when no programmer has any to handle.
+ * All programmers write from the same image buffer, it is never copied
+ * @param programmers programmers, e.g. from ezp_find_programmers
+ * @param count programmers count
+ * @param data buffer with data, shared read-only by all programmers
+ * @param chip_data information about chip, the same on every programmer
+ * @param speed writing speed
+ * @param verify non-zero to read back and compare after writing, into a chip sized buffer per programmer
+ * @param results receives count results, one per programmer
+ * @return EZP_OK when every programmer succeeded, otherwise the status of the first one that failed
+ */
+int ezp_gang_write(ezp_programmer **programmers, int count, const uint8_t *data, ezp_chip_data *chip_data,
+                   ezp_speed speed, int verify, ezp_gang_result *results);
+
+#endif //LIBEZP2023PLUS_EZP_GANG_H
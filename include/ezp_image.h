@@ -0,0 +1,55 @@
+#ifndef LIBEZP2023PLUS_EZP_IMAGE_H
+#define LIBEZP2023PLUS_EZP_IMAGE_H
+
+#include "ezp_prog.h"
+
+/**
+ * EZP_IMAGE_AUTO - Intel HEX when the file starts with ':', Motorola S-record when it starts with 'S' and a digit,
+ *                  raw binary otherwise
+ * EZP_IMAGE_BINARY - raw binary, loaded at offset 0
+ * EZP_IMAGE_IHEX - Intel HEX
+ * EZP_IMAGE_SREC - Motorola S-record
+ */
+typedef enum {
+    EZP_IMAGE_AUTO,
+    EZP_IMAGE_BINARY,
+    EZP_IMAGE_IHEX,
+    EZP_IMAGE_SREC
+} ezp_image_format;
+
+typedef struct ezp_image ezp_image;
+
+/**
+ * Open an image file as a list of segments. Raw binaries are mapped into memory without being copied. HEX and
+ * S-record files are decoded in a single pass; records continuing the previous one extend its segment, and
+ * addresses not covered by any record are left out of the list instead of being padded
+ * @param image output image, close with ezp_image_close
+ * @param file path to image file
+ * @param format file format
+ * @return EZP_OK when success. EZP_ERROR_IO, EZP_ERROR_INVALID_FILE (bad record, checksum or overlapping
+ * records) or EZP_OUT_OF_MEMORY when an error occurred
+ */
+int ezp_image_open(ezp_image **image, const char *file, ezp_image_format format);
+
+/**
+ * Free an image and its segments
+ * @param image
+ */
+void ezp_image_close(ezp_image *image);
+
+/**
+ * Get the segments of an image, sorted by offset and not overlapping. They stay valid until ezp_image_close
+ * @param image
+ * @param count receives segments count
+ * @return segments, pass to ezp_write_flash_segments
+ */
+const ezp_segment *ezp_image_segments(const ezp_image *image, size_t *count);
+
+/**
+ * Get the end of the last segment, the smallest chip size the image fits in
+ * @param image
+ * @return image end
+ */
+uint32_t ezp_image_end(const ezp_image *image);
+
+#endif //LIBEZP2023PLUS_EZP_IMAGE_H
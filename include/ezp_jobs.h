@@ -0,0 +1,91 @@
+#ifndef LIBEZP2023PLUS_EZP_JOBS_H
+#define LIBEZP2023PLUS_EZP_JOBS_H
+
+#include "ezp_prog.h"
+#include "ezp_chips_data_file.h"
+#include "ezp_digest.h"
+
+typedef enum {
+    EZP_JOB_READ,
+    EZP_JOB_WRITE,
+    EZP_JOB_VERIFY,
+    EZP_JOB_ERASE
+} ezp_job_type;
+
+/**
+ * EZP_JOB_STAGE_PREPARE - image load, digest and blank scan, on the worker thread
+ * EZP_JOB_STAGE_WAIT - time the programmer sat idle waiting for the prepare stage
+ * EZP_JOB_STAGE_DETECT - ezp_test_flash and chips database lookup
+ * EZP_JOB_STAGE_TRANSFER - read, write, verify or erase
+ * EZP_JOB_STAGE_VERIFY - read back after a write
+ * EZP_JOB_STAGE_FINISH - saving the image of a read and releasing the image, on the worker thread
+ */
+typedef enum {
+    EZP_JOB_STAGE_PREPARE,
+    EZP_JOB_STAGE_WAIT,
+    EZP_JOB_STAGE_DETECT,
+    EZP_JOB_STAGE_TRANSFER,
+    EZP_JOB_STAGE_VERIFY,
+    EZP_JOB_STAGE_FINISH,
+    EZP_JOB_STAGE_COUNT
+} ezp_job_stage;
+
+/**
+ * One operation of a job queue. The fields up to image are filled by the caller, the rest by ezp_run_jobs
+ * type - what to do with the chip
+ * chip_data - information about chip, replaced by the database entry of the detected chip when detect is set
+ *             and chip_data is not one of the entries with the detected id
+ * speed - reading and writing speed
+ * detect - check the chip with ezp_test_flash first. With a database the detected id must have an entry: chip_data
+ *          is kept when its name is one of the entries with that id, otherwise the id must have a single entry.
+ *          Without a database the detected id must equal chip_data.chip_id
+ * verify - read a written chip back and compare it with the image
+ * file - image to write or verify, or where the image of a read is saved. NULL - data is used
+ * data - image to write or verify when file is NULL, chip_data.flash bytes
+ * image - image of a read when file is NULL, free after use
+ * status - EZP_OK or the error of the stage that failed
+ * digest - digest of the image written, verified or read
+ * blank_tail - blank (0xFF) bytes at the end of the image. A write of a blank image only erases the chip
+ * stage_seconds - time spent in every stage
+ */
+typedef struct {
+    ezp_job_type type;
+    ezp_chip_data chip_data;
+    ezp_speed speed;
+    int detect;
+    int verify;
+    const char *file;
+    const uint8_t *data;
+    uint8_t *image;
+    int status;
+    ezp_digest digest;
+    uint32_t blank_tail;
+    double stage_seconds[EZP_JOB_STAGE_COUNT];
+} ezp_job;
+
+/**
+ * Called on the worker thread once a job is finished, in job order
+ */
+typedef void (*ezp_job_callback)(ezp_job *job, void *user_data);
+
+/**
+ * Run jobs one after another on a programmer. A worker thread prepares the image of the next job and finishes
+ * the previous one while the transfers of the current job run, so host work is hidden behind the device.
+ * A failed job does not stop the following ones
+ * @param programmer
+ * @param jobs jobs to run
+ * @param count jobs count
+ * @param db chips database for detected chips, may be NULL
+ * @param callback progress callback of the transfers
+ * @param done called when a job is finished, may be NULL
+ * @param user_data passed to callback and done
+ * @return EZP_OK when every job succeeded, otherwise the status of the first one that failed. A job fails with
+ * EZP_ERROR_INVALID_FILE when its image file does not match the chip size, EZP_FLASH_NOT_DETECTED when the
+ * detected id is not in the database, and EZP_CHIP_AMBIGUOUS when several entries have the detected id and
+ * chip_data is none of them. EZP_OUT_OF_MEMORY is returned without running any job when the worker could not
+ * be started
+ */
+int ezp_run_jobs(ezp_programmer *programmer, ezp_job *jobs, size_t count, const ezp_chips_db *db,
+                 ezp_callback callback, ezp_job_callback done, void *user_data);
+
+#endif //LIBEZP2023PLUS_EZP_JOBS_H
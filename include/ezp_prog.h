@@ -2,13 +2,44 @@
 #define LIBEZP2023PLUS_EZP_PROG_H
 
 #include "ezp_chips_data_file.h"
+#include "ezp_digest.h"
+#include "ezp_transport.h"
 #include <libusb-1.0/libusb.h>
 
-typedef struct {
-    libusb_device_handle *handle;
-} ezp_programmer;
+#define EZP_DEFAULT_QUEUE_DEPTH 8
+#define EZP_STREAM_CHUNK_SIZE 4096
+#define EZP_DEFAULT_TIMEOUT 1000
+#define EZP_DEFAULT_RETRIES 2
+#define EZP_SPEED_CACHE_SIZE 16
+#define EZP_SPEED_SAMPLE_SIZE 4096
+#define EZP_SECTOR_SIZE 4096
+#define EZP_BLOCK_SIZE 65536
+
+/**
+ * Owns a libusb context and the state of its status listener. Every context is independent, so
+ * programmers of different contexts can be driven from different threads without sharing anything.
+ * A programmer must only be used by one thread at a time
+ */
+typedef struct ezp_context ezp_context;
+
+/**
+ * Read or write in progress, driven by event handling on the context of its programmer
+ */
+typedef struct ezp_async ezp_async;
 
+/**
+ * Recording of the transfers of a programmer, see ezp_capture.h
+ */
+typedef struct ezp_capture ezp_capture;
+
+/**
+ * SPEED_AUTO - fastest speed that reads the chip reliably, see ezp_find_speed. The speed is looked up once per
+ * chip id and programmer; asynchronous operations probe synchronously when it is not known yet. Only SPI_FLASH
+ * chips are probed: for EEPROM_24 the speed byte carries the voltage, so chip_data->voltage is sent,
+ * and other classes use SPEED_12MHZ
+ */
 typedef enum {
+    SPEED_AUTO = -1,
     SPEED_12MHZ = 0,
     SPEED_6MHZ = 1,
     SPEED_3MHZ = 2,
@@ -17,6 +48,106 @@ typedef enum {
     SPEED_375KHZ = 5,
 } ezp_speed;
 
+/**
+ * Speed found for a chip
+ */
+typedef struct {
+    uint32_t chip_id;
+    ezp_speed speed;
+} ezp_speed_entry;
+
+#define EZP_LATENCY_BUCKETS 32
+
+/**
+ * Phases of one transaction with the programmer
+ * EZP_PHASE_SETUP - chip data packet and its response
+ * EZP_PHASE_START - begin data transaction packet
+ * EZP_PHASE_DATA - data blocks
+ * EZP_PHASE_RESET - reset packet
+ */
+typedef enum {
+    EZP_PHASE_SETUP,
+    EZP_PHASE_START,
+    EZP_PHASE_DATA,
+    EZP_PHASE_RESET,
+    EZP_PHASE_COUNT
+} ezp_phase;
+
+typedef enum {
+    EZP_STATS_READ,
+    EZP_STATS_WRITE,
+    EZP_STATS_TEST,
+    EZP_STATS_OP_COUNT
+} ezp_stats_op;
+
+/**
+ * Transfer statistics collected since the programmer was opened or ezp_reset_stats was called
+ * transfers_in, transfers_out - transfers completed in each direction, failed ones included
+ * bytes_in, bytes_out - bytes actually transferred
+ * short_transfers - successful transfers that moved fewer bytes than requested
+ * timeouts - transfers that timed out
+ * errors - transfers that failed with any other error
+ * retries - transfers submitted again after a failure
+ * latency_histogram - bucket b counts transfers that took [2^(b-1), 2^b) microseconds, the last one everything longer
+ * operations - started reads, writes and tests
+ * phase_seconds - time spent in each phase summed over all operations
+ * last_phase_seconds - time spent in each phase by the last operation, 0 for phases it did not reach
+ */
+typedef struct {
+    uint64_t transfers_in;
+    uint64_t transfers_out;
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    uint64_t short_transfers;
+    uint64_t timeouts;
+    uint64_t errors;
+    uint64_t retries;
+    uint64_t latency_histogram[EZP_LATENCY_BUCKETS];
+    uint64_t operations[EZP_STATS_OP_COUNT];
+    double phase_seconds[EZP_STATS_OP_COUNT][EZP_PHASE_COUNT];
+    double last_phase_seconds[EZP_STATS_OP_COUNT][EZP_PHASE_COUNT];
+} ezp_stats;
+
+/**
+ * handle - libusb handle of the opened programmer, NULL when it is not attached over USB. Stays the first field,
+ *          so users compiled against earlier versions still find it
+ * queue_depth - bulk transfers kept in flight during the data phase. 1 - synchronous transfers
+ * timeout - milliseconds a single transfer may take
+ * retries - times a transfer that timed out without moving any data is repeated
+ * read_restarts - times a failed read starts a new transaction from its checkpoint, see ezp_set_read_restarts
+ * throughput - bytes/sec measured over the data phase of the last successful read or write
+ * stats - transfer statistics, see ezp_get_stats
+ * capture - capture every transfer is recorded into, NULL when not capturing. See ezp_set_capture
+ * speed_cache - speeds found for SPEED_AUTO, oldest first
+ * context - context the programmer was opened with, NULL when it has none
+ * transport - moves packets to and from the programmer
+ */
+typedef struct {
+    libusb_device_handle *handle;
+    unsigned int queue_depth;
+    unsigned int timeout;
+    unsigned int retries;
+    unsigned int read_restarts;
+    double throughput;
+    ezp_stats stats;
+    ezp_capture *capture;
+    ezp_speed_entry speed_cache[EZP_SPEED_CACHE_SIZE];
+    unsigned int speed_cache_count;
+    ezp_context *context;
+    ezp_transport *transport;
+} ezp_programmer;
+
+/**
+ * EZP_ERASE_CHIP - whole chip
+ * EZP_ERASE_SECTOR - EZP_SECTOR_SIZE granular range, not supported by the EZP2023+
+ * EZP_ERASE_BLOCK - EZP_BLOCK_SIZE granular range, not supported by the EZP2023+
+ */
+typedef enum {
+    EZP_ERASE_CHIP,
+    EZP_ERASE_SECTOR,
+    EZP_ERASE_BLOCK
+} ezp_erase_mode;
+
 /**
  * EZP_READY - Programmer connected and user has access to it
  * EZP_CONNECTED - Programmer connected but user has no access in
@@ -28,32 +159,325 @@ typedef enum {
     EZP_DISCONNECTED
 } ezp_status;
 
+/**
+ * offset - range start
+ * length - range size
+ */
+typedef struct {
+    uint32_t offset;
+    uint32_t length;
+} ezp_range;
+
+/**
+ * Part of an image held in memory, the rest of the chip is blank
+ * offset - segment start in flash
+ * length - segment size
+ * data - segment contents
+ */
+typedef struct {
+    uint32_t offset;
+    uint32_t length;
+    const uint8_t *data;
+} ezp_segment;
+
+/**
+ * Outcome of a differential write
+ * sectors_count - sectors in the chip
+ * sectors_changed - sectors whose contents differed from the image
+ * sectors_written - sectors programmed
+ * sectors_skipped - sectors not programmed
+ * bytes_saved - bytes not programmed
+ * seconds - wall time of the whole operation
+ */
+typedef struct {
+    uint32_t sectors_count;
+    uint32_t sectors_changed;
+    uint32_t sectors_written;
+    uint32_t sectors_skipped;
+    uint32_t bytes_saved;
+    double seconds;
+} ezp_diff_report;
+
 typedef void (*ezp_callback)(uint32_t current, uint32_t max, void *user_data);
 typedef void (*ezp_status_callback)(ezp_status status, void *user_data);
+/**
+ * Receives flash contents chunk by chunk, in order. data is only valid until the sink returns.
+ * size is EZP_STREAM_CHUNK_SIZE except for the last chunk. Return 0 to continue or anything else to abort
+ */
+typedef int (*ezp_sink)(const uint8_t *data, uint32_t offset, uint32_t size, void *user_data);
+/**
+ * Called from event handling once an asynchronous operation has completed. op may be freed inside.
+ * result - EZP_OK, EZP_ABORTED, EZP_LIBUSB_ERROR or EZP_OUT_OF_MEMORY
+ */
+typedef void (*ezp_async_callback)(ezp_async *op, int result, void *user_data);
 
 /**
- * Init USB communication
+ * Init USB communication on the default context, used by all functions without a context parameter
  * @return 0 if success, or some libusb error code
  */
 int ezp_init();
 
+/**
+ * Default context, to mix functions with and without a context parameter. Valid after ezp_init
+ * @return default context
+ */
+ezp_context *ezp_default_context();
+
+/**
+ * Create a new independent context with its own libusb context
+ * @param context receives the new context
+ * @return 0 if success, or some libusb error code
+ */
+int ezp_context_new(ezp_context **context);
+
+/**
+ * Create new ezp_programmer instance on a context
+ * @param context
+ * @return new ezp_programmer instance or NULL if programmer is not connected
+ */
+ezp_programmer *ezp_context_find_programmer(ezp_context *context);
+
+/**
+ * Open every connected programmer on a context
+ * @param context
+ * @param programmers receives a malloc'ed array of new ezp_programmer instances, NULL if none was found.
+ * Free with ezp_free_programmers
+ * @return programmers count, or EZP_LIBUSB_ERROR or EZP_OUT_OF_MEMORY when an error occurred
+ */
+int ezp_context_find_programmers(ezp_context *context, ezp_programmer ***programmers);
+
+/**
+ * Create new ezp_programmer instance on top of a custom transport, e.g. ezp_emulator_new
+ * @param context context driving the transport, may be NULL
+ * @param transport owned by the programmer from now on, closed by ezp_free_programmer
+ * @return new ezp_programmer instance or NULL when out of memory. The transport is not closed then
+ */
+ezp_programmer *ezp_programmer_new(ezp_context *context, ezp_transport *transport);
+
 /**
  * Create new ezp_programmer instance
  * @return new ezp_programmer instance or NULL if programmer is not connected
  */
 ezp_programmer *ezp_find_programmer();
 
+/**
+ * Open every connected programmer
+ * @param programmers receives a malloc'ed array of new ezp_programmer instances, NULL if none was found.
+ * Free with ezp_free_programmers
+ * @return programmers count, or EZP_LIBUSB_ERROR or EZP_OUT_OF_MEMORY when an error occurred
+ */
+int ezp_find_programmers(ezp_programmer ***programmers);
+
+/**
+ * Set how many bulk transfers are kept in flight during the data phase of reads and writes
+ * @param programmer
+ * @param depth transfers count. 0 and 1 disable pipelining
+ */
+void ezp_set_queue_depth(ezp_programmer *programmer, unsigned int depth);
+
+/**
+ * Set how long a single transfer may take before it times out
+ * @param programmer
+ * @param timeout milliseconds, EZP_DEFAULT_TIMEOUT by default. 0 - no timeout
+ */
+void ezp_set_timeout(ezp_programmer *programmer, unsigned int timeout);
+
+/**
+ * Set how many times a transfer that timed out before moving any data is repeated. Nothing was lost then, so
+ * the transfer continues the stream where it stopped. A transfer that moved part of its data is never repeated
+ * @param programmer
+ * @param retries repeats per transfer, EZP_DEFAULT_RETRIES by default. 0 - fail on the first timeout
+ */
+void ezp_set_retries(ezp_programmer *programmer, unsigned int retries);
+
+/**
+ * Set how many times a read that failed with a transfer error starts a new transaction, see ezp_read_flash_resume.
+ * The programmer always streams from address 0, so every restart transfers the whole chip again. Applies to
+ * ezp_read_flash, ezp_read_flash_into, ezp_read_flash_to_file and ezp_read_flash_resume
+ * @param programmer
+ * @param restarts new transactions per read, 0 by default - a failed read returns its error
+ */
+void ezp_set_read_restarts(ezp_programmer *programmer, unsigned int restarts);
+
+/**
+ * Get data phase throughput of the last successful read or write
+ * @param programmer
+ * @return bytes per second, or 0 if nothing was transferred yet
+ */
+double ezp_get_throughput(const ezp_programmer *programmer);
+
+/**
+ * Copy transfer statistics of the programmer
+ * @param programmer
+ * @param stats copy destination
+ */
+void ezp_get_stats(const ezp_programmer *programmer, ezp_stats *stats);
+
+/**
+ * Clear transfer statistics of the programmer
+ * @param programmer
+ */
+void ezp_reset_stats(ezp_programmer *programmer);
+
+/**
+ * Find the fastest speed that reads the chip reliably. Starting at SPEED_12MHZ, the first EZP_SPEED_SAMPLE_SIZE bytes
+ * are read twice at every speed, and the first speed where both reads succeed and match is kept for the chip id.
+ * Only for SPI_FLASH, other classes do not use the speed byte as a speed
+ * @param programmer
+ * @param chip_data information about chip
+ * @param speed found speed
+ * @return EZP_OK when success. EZP_UNSUPPORTED for chips other than SPI_FLASH, EZP_FLASH_SIZE_OR_PAGE_INVALID,
+ * EZP_OUT_OF_MEMORY, or EZP_VERIFY_FAILED or EZP_LIBUSB_ERROR when no speed reads reliably
+ */
+int ezp_find_speed(ezp_programmer *programmer, ezp_chip_data *chip_data, ezp_speed *speed);
+
+/**
+ * Forget the speed found for a chip, so SPEED_AUTO probes again
+ * @param programmer
+ * @param chip_id
+ */
+void ezp_forget_speed(ezp_programmer *programmer, uint32_t chip_id);
+
+/**
+ * Load speeds found earlier with the same programmer. Every line of the file holds a hex chip id and a speed
+ * @param programmer
+ * @param file path to cache file
+ * @return EZP_OK when success. EZP_ERROR_IO or EZP_ERROR_INVALID_FILE when an error occurred
+ */
+int ezp_load_speed_cache(ezp_programmer *programmer, const char *file);
+
+/**
+ * Save the speeds found so far, to be loaded again with ezp_load_speed_cache
+ * @param programmer
+ * @param file path to cache file
+ * @return EZP_OK when success. EZP_ERROR_IO when an error occurred
+ */
+int ezp_save_speed_cache(const ezp_programmer *programmer, const char *file);
+
 /**
  * Read data from flash
  * @param programmer
- * @param data buffer for data
+ * @param data receives a malloc'ed buffer with the data, free after use
  * @param chip_data information about chip
  * @param speed reading speed
  * @param callback progress callback
- * @return EZP_OK when success. EZP_FLASH_SIZE_OR_PAGE_INVALID or EZP_LIBUSB_ERROR when an error occurred
+ * @return EZP_OK when success. EZP_FLASH_SIZE_OR_PAGE_INVALID, EZP_OUT_OF_MEMORY or EZP_LIBUSB_ERROR when an error
+ * occurred
  */
 int ezp_read_flash(ezp_programmer *programmer, uint8_t **data, ezp_chip_data *chip_data, ezp_speed speed, ezp_callback callback, void *user_data);
 
+/**
+ * Read data from flash into a caller-owned buffer, without allocating
+ * @param programmer
+ * @param data buffer of at least chip_data->flash bytes
+ * @param chip_data information about chip
+ * @param speed reading speed
+ * @param callback progress callback
+ * @return EZP_OK when success. EZP_FLASH_SIZE_OR_PAGE_INVALID or EZP_LIBUSB_ERROR when an error occurred
+ */
+int ezp_read_flash_into(ezp_programmer *programmer, uint8_t *data, ezp_chip_data *chip_data, ezp_speed speed,
+                        ezp_callback callback, void *user_data);
+
+/**
+ * Progress of a resumable read. Zero it before the first attempt, and keep it with the destination buffer
+ * offset - bytes from the start of the chip already stored in the destination buffer
+ * flash - chip size the offset belongs to
+ */
+typedef struct {
+    uint32_t offset;
+    uint32_t flash;
+} ezp_checkpoint;
+
+/**
+ * Read data from flash into a caller-owned buffer that may hold the confirmed part of an earlier attempt.
+ * The programmer always streams from address 0, so the whole chip is transferred again: blocks below the
+ * checkpoint are received and dropped without touching the buffer, only the rest is stored. On a transfer error
+ * a new transaction starts up to programmer->read_restarts times, see ezp_set_read_restarts, and the checkpoint
+ * left behind lets a later call keep the blocks confirmed so far
+ * @param programmer
+ * @param data buffer of at least chip_data->flash bytes, holding the confirmed part of an earlier attempt
+ * @param chip_data information about chip
+ * @param speed reading speed
+ * @param checkpoint progress, updated after every block. A checkpoint of another chip size starts from 0
+ * @param callback progress callback
+ * @return EZP_OK when success. EZP_FLASH_SIZE_OR_PAGE_INVALID, EZP_OUT_OF_MEMORY, EZP_ABORTED or EZP_LIBUSB_ERROR
+ * when an error occurred
+ */
+int ezp_read_flash_resume(ezp_programmer *programmer, uint8_t *data, ezp_chip_data *chip_data, ezp_speed speed,
+                          ezp_checkpoint *checkpoint, ezp_callback callback, void *user_data);
+
+/**
+ * Read data from flash into a dump file. The file is sized to chip_data->flash and memory-mapped,
+ * so transfers land directly in the mapping
+ * @param programmer
+ * @param file dump file path. Created or truncated
+ * @param chip_data information about chip
+ * @param speed reading speed
+ * @param callback progress callback
+ * @return EZP_OK when success. EZP_FLASH_SIZE_OR_PAGE_INVALID, EZP_LIBUSB_ERROR or EZP_ERROR_IO when an error occurred
+ */
+int ezp_read_flash_to_file(ezp_programmer *programmer, const char *file, ezp_chip_data *chip_data, ezp_speed speed,
+                           ezp_callback callback, void *user_data);
+
+/**
+ * Read an address range of flash. offset and length must be multiples of the transfer block size
+ * (flash_page, but at least 64 bytes). The programmer can't seek, so for SPI_FLASH the transaction is
+ * cut short after the range and for other chips the whole chip is transferred
+ * @param programmer
+ * @param data buffer of at least length bytes
+ * @param offset range start
+ * @param length range size
+ * @param chip_data information about chip
+ * @param speed reading speed
+ * @param callback progress callback
+ * @return EZP_OK when success. EZP_FLASH_SIZE_OR_PAGE_INVALID, EZP_INVALID_RANGE, EZP_OUT_OF_MEMORY or
+ * EZP_LIBUSB_ERROR when an error occurred
+ */
+int ezp_read_flash_range(ezp_programmer *programmer, uint8_t *data, uint32_t offset, uint32_t length,
+                         ezp_chip_data *chip_data, ezp_speed speed, ezp_callback callback, void *user_data);
+
+/**
+ * Read data from flash and digest it on the fly, block by block as it arrives
+ * @param programmer
+ * @param data buffer of at least chip_data->flash bytes, or NULL to only compute digests without buffering the chip
+ * @param chip_data information about chip
+ * @param speed reading speed
+ * @param digest receives the digest of the whole chip, may be NULL
+ * @param sector_size size of the sectors digested separately. Multiple of the transfer block size
+ * @param sector_digests receives chip_data->flash / sector_size digests, may be NULL
+ * @param callback progress callback
+ * @return EZP_OK when success. EZP_FLASH_SIZE_OR_PAGE_INVALID, EZP_INVALID_RANGE or EZP_LIBUSB_ERROR when an error occurred
+ */
+int ezp_read_flash_digest(ezp_programmer *programmer, uint8_t *data, ezp_chip_data *chip_data, ezp_speed speed,
+                          ezp_digest *digest, uint32_t sector_size, ezp_digest *sector_digests,
+                          ezp_callback callback, void *user_data);
+
+/**
+ * Read data from flash without buffering the whole chip. Memory use is bounded by a small pool of
+ * EZP_STREAM_CHUNK_SIZE chunks, and the next transfers stay in flight while the sink runs
+ * @param programmer
+ * @param chip_data information about chip
+ * @param speed reading speed
+ * @param sink receives the data
+ * @param sink_data passed to the sink
+ * @param callback progress callback
+ * @return EZP_OK when success. EZP_FLASH_SIZE_OR_PAGE_INVALID, EZP_LIBUSB_ERROR or EZP_ABORTED when an error occurred
+ */
+int ezp_read_flash_stream(ezp_programmer *programmer, ezp_chip_data *chip_data, ezp_speed speed,
+                          ezp_sink sink, void *sink_data, ezp_callback callback, void *user_data);
+
+/**
+ * Read data from flash and write it to a file descriptor as it arrives
+ * @param programmer
+ * @param fd file descriptor to write to
+ * @param chip_data information about chip
+ * @param speed reading speed
+ * @param callback progress callback
+ * @return EZP_OK when success. EZP_FLASH_SIZE_OR_PAGE_INVALID, EZP_LIBUSB_ERROR or EZP_ERROR_IO when an error occurred
+ */
+int ezp_read_flash_to_fd(ezp_programmer *programmer, int fd, ezp_chip_data *chip_data, ezp_speed speed,
+                         ezp_callback callback, void *user_data);
+
 /**
  * Write data into flash
  * @param programmer
@@ -65,6 +489,168 @@ int ezp_read_flash(ezp_programmer *programmer, uint8_t **data, ezp_chip_data *ch
  */
 int ezp_write_flash(ezp_programmer *programmer, const uint8_t *data, ezp_chip_data *chip_data, ezp_speed speed, ezp_callback callback, void *user_data);
 
+/**
+ * Write a sparse image into flash. Blocks are sent straight from the segments and gaps are sent as blank (0xFF)
+ * blocks, so no padded image is built. Only blocks straddling a segment edge are composed in a staging buffer
+ * @param programmer
+ * @param segments segments sorted by offset, not overlapping and inside the chip, e.g. from ezp_image_segments
+ * @param count segments count
+ * @param chip_data information about chip
+ * @param speed writing speed
+ * @param callback progress callback
+ * @return EZP_OK when success. EZP_FLASH_SIZE_OR_PAGE_INVALID, EZP_INVALID_RANGE, EZP_OUT_OF_MEMORY or
+ * EZP_LIBUSB_ERROR when an error occurred
+ */
+int ezp_write_flash_segments(ezp_programmer *programmer, const ezp_segment *segments, size_t count,
+                             ezp_chip_data *chip_data, ezp_speed speed, ezp_callback callback, void *user_data);
+
+/**
+ * Start reading flash without blocking. The read progresses while events of the programmer's context
+ * are handled, e.g. by ezp_context_handle_events
+ * @param programmer
+ * @param data buffer of chip_data->flash bytes, must stay valid until done is called
+ * @param chip_data information about chip
+ * @param speed reading speed
+ * @param callback progress callback, may be NULL
+ * @param done completion callback, may be NULL
+ * @param op receives the operation. Free with ezp_async_free once completed
+ * @return EZP_OK when started. EZP_FLASH_SIZE_OR_PAGE_INVALID, EZP_OUT_OF_MEMORY or EZP_LIBUSB_ERROR when an error occurred
+ */
+int ezp_read_flash_async(ezp_programmer *programmer, uint8_t *data, ezp_chip_data *chip_data, ezp_speed speed,
+                         ezp_callback callback, ezp_async_callback done, void *user_data, ezp_async **op);
+
+/**
+ * Start writing flash without blocking, see ezp_read_flash_async
+ * @param programmer
+ * @param data buffer with data, must stay valid until done is called
+ * @param chip_data information about chip
+ * @param speed writing speed
+ * @param callback progress callback, may be NULL
+ * @param done completion callback, may be NULL
+ * @param op receives the operation. Free with ezp_async_free once completed
+ * @return EZP_OK when started. EZP_FLASH_SIZE_OR_PAGE_INVALID, EZP_OUT_OF_MEMORY or EZP_LIBUSB_ERROR when an error occurred
+ */
+int ezp_write_flash_async(ezp_programmer *programmer, const uint8_t *data, ezp_chip_data *chip_data,
+                          ezp_speed speed, ezp_callback callback, ezp_async_callback done, void *user_data,
+                          ezp_async **op);
+
+/**
+ * Request cancellation. The operation still completes through its done callback, with EZP_ABORTED
+ * @param op
+ */
+void ezp_async_cancel(ezp_async *op);
+
+/**
+ * @param op
+ * @return 1 when the operation has completed, 0 otherwise
+ */
+int ezp_async_finished(const ezp_async *op);
+
+/**
+ * Free a completed operation
+ * @param op
+ */
+void ezp_async_free(ezp_async *op);
+
+/**
+ * Write an address range of flash. offset and length must be multiples of the transfer block size.
+ * Writing always erases and programs the whole chip, so this is a read-modify-write: the chip is read,
+ * nothing is written if the range already holds data, otherwise the patched image is written back
+ * @param programmer
+ * @param data buffer with length bytes
+ * @param offset range start
+ * @param length range size
+ * @param chip_data information about chip
+ * @param speed writing speed
+ * @param callback progress callback, called for the read and then for the write
+ * @return EZP_OK when success. EZP_FLASH_SIZE_OR_PAGE_INVALID, EZP_INVALID_RANGE, EZP_OUT_OF_MEMORY or
+ * EZP_LIBUSB_ERROR when an error occurred
+ */
+int ezp_write_flash_range(ezp_programmer *programmer, const uint8_t *data, uint32_t offset, uint32_t length,
+                          ezp_chip_data *chip_data, ezp_speed speed, ezp_callback callback, void *user_data);
+
+/**
+ * Write data into flash only if it differs from the current contents. The chip is read and compared
+ * with the image sector by sector as data arrives. The programmer can only erase and program the whole
+ * chip, so if any sector changed the whole image is written, otherwise the write is skipped
+ * @param programmer
+ * @param data buffer with data
+ * @param chip_data information about chip
+ * @param speed reading and writing speed
+ * @param sector_size erase sector size, 0 for EZP_SECTOR_SIZE
+ * @param report filled with the outcome, may be NULL
+ * @param callback progress callback, called for the read and then for the write
+ * @return EZP_OK when success. EZP_FLASH_SIZE_OR_PAGE_INVALID, EZP_INVALID_RANGE, EZP_OUT_OF_MEMORY or
+ * EZP_LIBUSB_ERROR when an error occurred
+ */
+int ezp_write_flash_diff(ezp_programmer *programmer, const uint8_t *data, ezp_chip_data *chip_data, ezp_speed speed,
+                         uint32_t sector_size, ezp_diff_report *report, ezp_callback callback, void *user_data);
+
+/**
+ * Write data into flash, leaving out blank (0xFF) pages at the end of the image. The programmer streams
+ * pages from address 0 on, so blank pages in the middle of the image are still sent. Only for SPI_FLASH,
+ * other chips are written whole. The chip must be blank past the last programmed page, as it is after
+ * an erase
+ * @param programmer
+ * @param data buffer with data
+ * @param chip_data information about chip
+ * @param speed writing speed
+ * @param bytes_skipped receives the size of the blank tail that was not sent, may be NULL
+ * @param callback progress callback
+ * @return EZP_OK when success. EZP_FLASH_SIZE_OR_PAGE_INVALID or EZP_LIBUSB_ERROR when an error occurred
+ */
+int ezp_write_flash_blank_aware(ezp_programmer *programmer, const uint8_t *data, ezp_chip_data *chip_data,
+                                ezp_speed speed, uint32_t *bytes_skipped, ezp_callback callback, void *user_data);
+
+/**
+ * Check that the chip is erased (all bytes 0xFF). Stops reading at the first programmed byte
+ * @param programmer
+ * @param chip_data information about chip
+ * @param speed reading speed
+ * @param first_non_blank receives the offset of the first programmed byte, or chip_data->flash if blank.
+ * May be NULL
+ * @param callback progress callback
+ * @return EZP_OK when blank, EZP_NOT_BLANK when not. EZP_FLASH_SIZE_OR_PAGE_INVALID or EZP_LIBUSB_ERROR
+ * when an error occurred
+ */
+int ezp_blank_check_flash(ezp_programmer *programmer, ezp_chip_data *chip_data, ezp_speed speed,
+                          uint32_t *first_non_blank, ezp_callback callback, void *user_data);
+
+/**
+ * Erase flash. The programmer can only erase the whole chip, so only EZP_ERASE_CHIP is supported
+ * @param programmer
+ * @param chip_data information about chip
+ * @param speed speed
+ * @param mode erase granularity
+ * @param offset range start, multiple of the mode granularity. Ignored for EZP_ERASE_CHIP
+ * @param length range size, multiple of the mode granularity. Ignored for EZP_ERASE_CHIP
+ * @param skip_if_blank check the chip first and do nothing if it is blank
+ * @param callback progress callback
+ * @return EZP_OK when success. EZP_UNSUPPORTED for sector and block modes. EZP_FLASH_SIZE_OR_PAGE_INVALID or
+ * EZP_LIBUSB_ERROR when an error occurred
+ */
+int ezp_erase_flash(ezp_programmer *programmer, ezp_chip_data *chip_data, ezp_speed speed, ezp_erase_mode mode,
+                    uint32_t offset, uint32_t length, int skip_if_blank, ezp_callback callback, void *user_data);
+
+/**
+ * Compare flash contents with an image while reading it back, chunk by chunk, without buffering the chip
+ * @param programmer
+ * @param data expected contents, chip_data->flash bytes
+ * @param chip_data information about chip
+ * @param speed reading speed
+ * @param mismatches receives a malloc'ed list of differing ranges, adjacent bytes merged. NULL to only
+ * check for equality. Must be freed by the caller
+ * @param mismatches_count receives the ranges count, may be NULL
+ * @param max_mismatches stop reading once this many ranges were found, the last one may be incomplete.
+ * 0 - no limit
+ * @param callback progress callback
+ * @return EZP_OK when contents are equal, EZP_VERIFY_FAILED when they differ. EZP_FLASH_SIZE_OR_PAGE_INVALID,
+ * EZP_OUT_OF_MEMORY or EZP_LIBUSB_ERROR when an error occurred
+ */
+int ezp_verify_flash(ezp_programmer *programmer, const uint8_t *data, ezp_chip_data *chip_data, ezp_speed speed,
+                     ezp_range **mismatches, size_t *mismatches_count, size_t max_mismatches,
+                     ezp_callback callback, void *user_data);
+
 /**
  * Test chip model
  * @param programmer
@@ -81,6 +667,76 @@ int ezp_test_flash(ezp_programmer *programmer, ezp_flash *type, uint32_t *chip_i
  */
 int ezp_listen_programmer_status(ezp_status_callback callback, void *user_data);
 
+/**
+ * Blocking function that listens status of programmers on a context and notifies about changes via callback.
+ * Only one listener can run per context
+ * @param context
+ * @param callback
+ * @return EZP_HOTPLUG_UNSUPPORTED, EZP_LIBUSB_ERROR, or 0 once stopped by ezp_context_stop_listening
+ */
+int ezp_context_listen_programmer_status(ezp_context *context, ezp_status_callback callback, void *user_data);
+
+/**
+ * Stop the status listener of a context. Blocks until the listener has returned
+ * @param context
+ */
+void ezp_context_stop_listening(ezp_context *context);
+
+/**
+ * Non-blocking alternative to ezp_context_listen_programmer_status. The callback is called while
+ * events of the context are handled. Only one status callback can be registered per context
+ * @param context
+ * @param callback
+ * @return EZP_OK when success. EZP_HOTPLUG_UNSUPPORTED or EZP_LIBUSB_ERROR when an error occurred
+ */
+int ezp_context_register_status_callback(ezp_context *context, ezp_status_callback callback, void *user_data);
+
+/**
+ * Remove the status callback registered with ezp_context_register_status_callback
+ * @param context
+ */
+void ezp_context_deregister_status_callback(ezp_context *context);
+
+/**
+ * File descriptors to poll for events of a context. Unavailable on Windows
+ * @param context
+ * @return NULL terminated list, free with libusb_free_pollfds. NULL when an error occurred
+ */
+const struct libusb_pollfd **ezp_context_get_pollfds(ezp_context *context);
+
+/**
+ * Be notified when file descriptors are added to or removed from the context, e.g. to keep an epoll set in sync
+ * @param context
+ * @param added_cb
+ * @param removed_cb
+ */
+void ezp_context_set_pollfd_notifiers(ezp_context *context, libusb_pollfd_added_cb added_cb,
+                                      libusb_pollfd_removed_cb removed_cb, void *user_data);
+
+/**
+ * Time left until the next transfer timeout of a context must be handled
+ * @param context
+ * @param tv receives the time left when a timeout is pending
+ * @return 1 when tv was set, 0 when no timeout is pending, EZP_LIBUSB_ERROR when an error occurred
+ */
+int ezp_context_get_next_timeout(ezp_context *context, struct timeval *tv);
+
+/**
+ * Process pending events of a programmer's transport without blocking. Drives asynchronous operations of
+ * programmers without context, such as emulators; for USB programmers it equals ezp_context_handle_events
+ * @param programmer
+ * @return EZP_OK when success. EZP_LIBUSB_ERROR when an error occurred
+ */
+int ezp_programmer_handle_events(ezp_programmer *programmer);
+
+/**
+ * Process pending events of a context without blocking: hotplug notifications, transfer completions
+ * and expired timeouts. Call when a polled file descriptor is ready or the next timeout has passed
+ * @param context
+ * @return EZP_OK when success. EZP_LIBUSB_ERROR when an error occurred
+ */
+int ezp_context_handle_events(ezp_context *context);
+
 /**
  * Stop connection with programmer and free resources
  * @param programmer
@@ -88,7 +744,20 @@ int ezp_listen_programmer_status(ezp_status_callback callback, void *user_data);
 void ezp_free_programmer(ezp_programmer *programmer);
 
 /**
- * Stop USB communication
+ * Free programmers returned by ezp_find_programmers
+ * @param programmers
+ * @param count programmers count
+ */
+void ezp_free_programmers(ezp_programmer **programmers, int count);
+
+/**
+ * Stop USB communication of a context and free it. Its programmers must be freed before
+ * @param context
+ */
+void ezp_context_free(ezp_context *context);
+
+/**
+ * Stop USB communication on the default context
  */
 void ezp_free();
 
@@ -0,0 +1,421 @@
+#ifndef LIBEZP2023PLUS_EZP_PROG_HPP
+#define LIBEZP2023PLUS_EZP_PROG_HPP
+
+extern "C" {
+#include "ezp_prog.h"
+#include "ezp_errors.h"
+}
+
+#include <coroutine>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <span>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/**
+ * C++20 binding of ezp_prog.h. Handles are move-only and free what they own, buffers are passed as spans without
+ * being copied, and EZP_* codes are reported as std::error_code values of ezp::category(). Nothing throws
+ */
+namespace ezp {
+
+/**
+ * EZP_* error codes of ezp_errors.h
+ */
+enum class errc {
+    io = EZP_ERROR_IO,
+    invalid_file = EZP_ERROR_INVALID_FILE,
+    flash_size_or_page_invalid = EZP_FLASH_SIZE_OR_PAGE_INVALID,
+    libusb = EZP_LIBUSB_ERROR,
+    invalid_data_from_programmer = EZP_INVALID_DATA_FROM_PROGRAMMER,
+    flash_not_detected = EZP_FLASH_NOT_DETECTED,
+    hotplug_unsupported = EZP_HOTPLUG_UNSUPPORTED,
+    aborted = EZP_ABORTED,
+    invalid_range = EZP_INVALID_RANGE,
+    out_of_memory = EZP_OUT_OF_MEMORY,
+    verify_failed = EZP_VERIFY_FAILED,
+    not_blank = EZP_NOT_BLANK,
+    unsupported = EZP_UNSUPPORTED,
+    chip_ambiguous = EZP_CHIP_AMBIGUOUS
+};
+
+class error_category : public std::error_category {
+public:
+    const char *name() const noexcept override { return "ezp"; }
+
+    std::string message(int code) const override {
+        switch (code) {
+            case EZP_OK: return "success";
+            case EZP_ERROR_IO: return "I/O error";
+            case EZP_ERROR_INVALID_FILE: return "invalid file";
+            case EZP_FLASH_SIZE_OR_PAGE_INVALID: return "flash size or page size invalid";
+            case EZP_LIBUSB_ERROR: return "libusb error";
+            case EZP_INVALID_DATA_FROM_PROGRAMMER: return "invalid data from programmer";
+            case EZP_FLASH_NOT_DETECTED: return "flash not detected";
+            case EZP_HOTPLUG_UNSUPPORTED: return "hotplug unsupported";
+            case EZP_ABORTED: return "aborted";
+            case EZP_INVALID_RANGE: return "invalid range";
+            case EZP_OUT_OF_MEMORY: return "out of memory";
+            case EZP_VERIFY_FAILED: return "verify failed";
+            case EZP_NOT_BLANK: return "not blank";
+            case EZP_UNSUPPORTED: return "unsupported";
+            case EZP_CHIP_AMBIGUOUS: return "chip ambiguous";
+            default: return "unknown error";
+        }
+    }
+};
+
+inline const std::error_category &category() noexcept {
+    static const error_category instance;
+    return instance;
+}
+
+inline std::error_code make_error_code(errc code) noexcept {
+    return {static_cast<int>(code), category()};
+}
+
+/**
+ * Map an EZP_* return value, EZP_OK maps to an empty error code
+ */
+inline std::error_code to_error(int ret) noexcept {
+    return ret == EZP_OK ? std::error_code() : std::error_code(ret, category());
+}
+
+}
+
+template<>
+struct std::is_error_code_enum<ezp::errc> : std::true_type {};
+
+namespace ezp {
+
+namespace detail {
+
+//progress callables are passed as user_data and called through this function, without being wrapped.
+//F keeps the constness of the callable, so const ones are called as const
+template<class F>
+void progress(uint32_t current, uint32_t max, void *user_data) {
+    (*static_cast<F *>(user_data))(current, max);
+}
+
+template<class F>
+void *user_data(F &callable) noexcept {
+    return const_cast<void *>(static_cast<const void *>(std::addressof(callable)));
+}
+
+}
+
+/**
+ * Default libusb context, initialized by ezp_init and stopped by ezp_free
+ */
+class library {
+public:
+    explicit library(std::error_code &ec) noexcept {
+        ec = ezp_init() == 0 ? std::error_code() : make_error_code(errc::libusb);
+        initialized_ = !ec;
+    }
+
+    ~library() {
+        if (initialized_) ezp_free();
+    }
+
+    library(const library &) = delete;
+    library &operator=(const library &) = delete;
+
+private:
+    bool initialized_ = false;
+};
+
+class programmer;
+
+/**
+ * Owns an ezp_context. Its programmers must be destroyed before it
+ */
+class context {
+public:
+    context() noexcept = default;
+
+    explicit context(ezp_context *handle) noexcept : handle_(handle) {}
+
+    context(context &&other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {}
+
+    context &operator=(context &&other) noexcept {
+        if (this != &other) reset(std::exchange(other.handle_, nullptr));
+        return *this;
+    }
+
+    context(const context &) = delete;
+    context &operator=(const context &) = delete;
+
+    ~context() { reset(); }
+
+    static context create(std::error_code &ec) noexcept {
+        ezp_context *handle = nullptr;
+        ec = ezp_context_new(&handle) == 0 ? std::error_code() : make_error_code(errc::libusb);
+        return context(handle);
+    }
+
+    ezp_context *get() const noexcept { return handle_; }
+
+    ezp_context *release() noexcept { return std::exchange(handle_, nullptr); }
+
+    void reset(ezp_context *handle = nullptr) noexcept {
+        if (handle_) ezp_context_free(handle_);
+        handle_ = handle;
+    }
+
+    explicit operator bool() const noexcept { return handle_ != nullptr; }
+
+    inline programmer find_programmer() const noexcept;
+
+    inline std::vector<programmer> find_programmers(std::error_code &ec) const;
+
+    std::error_code handle_events() const noexcept { return to_error(ezp_context_handle_events(handle_)); }
+
+private:
+    ezp_context *handle_ = nullptr;
+};
+
+class async_transfer;
+
+/**
+ * Owns an ezp_programmer. Spans passed to read, write and verify must hold exactly chip_data.flash bytes
+ */
+class programmer {
+public:
+    programmer() noexcept = default;
+
+    explicit programmer(ezp_programmer *handle) noexcept : handle_(handle) {}
+
+    programmer(programmer &&other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {}
+
+    programmer &operator=(programmer &&other) noexcept {
+        if (this != &other) reset(std::exchange(other.handle_, nullptr));
+        return *this;
+    }
+
+    programmer(const programmer &) = delete;
+    programmer &operator=(const programmer &) = delete;
+
+    ~programmer() { reset(); }
+
+    /**
+     * First programmer connected to the default context, empty if none is
+     */
+    static programmer find() noexcept { return programmer(ezp_find_programmer()); }
+
+    ezp_programmer *get() const noexcept { return handle_; }
+
+    ezp_programmer *release() noexcept { return std::exchange(handle_, nullptr); }
+
+    void reset(ezp_programmer *handle = nullptr) noexcept {
+        if (handle_) ezp_free_programmer(handle_);
+        handle_ = handle;
+    }
+
+    explicit operator bool() const noexcept { return handle_ != nullptr; }
+
+    void set_queue_depth(unsigned int depth) noexcept { ezp_set_queue_depth(handle_, depth); }
+
+    void set_timeout(unsigned int timeout) noexcept { ezp_set_timeout(handle_, timeout); }
+
+    void set_retries(unsigned int retries) noexcept { ezp_set_retries(handle_, retries); }
+
+    void set_read_restarts(unsigned int restarts) noexcept { ezp_set_read_restarts(handle_, restarts); }
+
+    double throughput() const noexcept { return ezp_get_throughput(handle_); }
+
+    std::error_code test(ezp_flash &type, uint32_t &chip_id) noexcept {
+        return to_error(ezp_test_flash(handle_, &type, &chip_id));
+    }
+
+    std::error_code read(std::span<uint8_t> data, ezp_chip_data &chip_data, ezp_speed speed) noexcept {
+        if (data.size() != chip_data.flash) return errc::invalid_range;
+        return to_error(ezp_read_flash_into(handle_, data.data(), &chip_data, speed, nullptr, nullptr));
+    }
+
+    /**
+     * @param progress called as progress(current, max) while the read runs
+     */
+    template<class F>
+    std::error_code read(std::span<uint8_t> data, ezp_chip_data &chip_data, ezp_speed speed, F &&progress) {
+        if (data.size() != chip_data.flash) return errc::invalid_range;
+        return to_error(ezp_read_flash_into(handle_, data.data(), &chip_data, speed,
+                                            detail::progress<std::remove_reference_t<F>>, detail::user_data(progress)));
+    }
+
+    std::error_code write(std::span<const uint8_t> data, ezp_chip_data &chip_data, ezp_speed speed) noexcept {
+        if (data.size() != chip_data.flash) return errc::invalid_range;
+        return to_error(ezp_write_flash(handle_, data.data(), &chip_data, speed, nullptr, nullptr));
+    }
+
+    template<class F>
+    std::error_code write(std::span<const uint8_t> data, ezp_chip_data &chip_data, ezp_speed speed, F &&progress) {
+        if (data.size() != chip_data.flash) return errc::invalid_range;
+        return to_error(ezp_write_flash(handle_, data.data(), &chip_data, speed,
+                                        detail::progress<std::remove_reference_t<F>>, detail::user_data(progress)));
+    }
+
+    std::error_code write(std::span<const ezp_segment> segments, ezp_chip_data &chip_data, ezp_speed speed) noexcept {
+        return to_error(ezp_write_flash_segments(handle_, segments.data(), segments.size(), &chip_data, speed,
+                                                 nullptr, nullptr));
+    }
+
+    std::error_code verify(std::span<const uint8_t> data, ezp_chip_data &chip_data, ezp_speed speed) noexcept {
+        if (data.size() != chip_data.flash) return errc::invalid_range;
+        return to_error(ezp_verify_flash(handle_, data.data(), &chip_data, speed, nullptr, nullptr, 0,
+                                         nullptr, nullptr));
+    }
+
+    std::error_code erase(ezp_chip_data &chip_data, ezp_speed speed) noexcept {
+        return to_error(ezp_erase_flash(handle_, &chip_data, speed, EZP_ERASE_CHIP, 0, 0, 0, nullptr, nullptr));
+    }
+
+    /**
+     * co_await read_async(...) reads without blocking and yields the error code. The buffer must stay valid until
+     * the read completes. See async_transfer
+     */
+    inline async_transfer read_async(std::span<uint8_t> data, const ezp_chip_data &chip_data,
+                                     ezp_speed speed) noexcept;
+
+    inline async_transfer write_async(std::span<const uint8_t> data, const ezp_chip_data &chip_data,
+                                      ezp_speed speed) noexcept;
+
+    /**
+     * Read the chip back into a buffer of the awaitable and compare it with data, errc::verify_failed when they differ
+     * and errc::out_of_memory when the buffer cannot be allocated
+     */
+    inline async_transfer verify_async(std::span<const uint8_t> data, const ezp_chip_data &chip_data,
+                                       ezp_speed speed) noexcept;
+
+    /**
+     * Drive asynchronous operations, see ezp_programmer_handle_events
+     */
+    std::error_code handle_events() const noexcept { return to_error(ezp_programmer_handle_events(handle_)); }
+
+private:
+    ezp_programmer *handle_ = nullptr;
+};
+
+/**
+ * Awaitable asynchronous read, write or verify. The operation starts when it is awaited, and the coroutine is
+ * resumed from the done callback, on the thread handling events of the programmer. One thread can await
+ * operations of many programmers this way, handling their events in a loop. Destroy a programmer only after its
+ * operations have completed
+ */
+class async_transfer {
+public:
+    enum class kind {
+        read,
+        write,
+        verify
+    };
+
+    async_transfer(ezp_programmer *programmer, kind kind, uint8_t *data, std::size_t size,
+                   const ezp_chip_data &chip_data, ezp_speed speed) noexcept
+            : programmer_(programmer), kind_(kind), data_(data), size_(size), chip_data_(chip_data), speed_(speed) {}
+
+    async_transfer(const async_transfer &) = delete;
+    async_transfer &operator=(const async_transfer &) = delete;
+
+    bool await_ready() const noexcept { return false; }
+
+    bool await_suspend(std::coroutine_handle<> handle) noexcept {
+        handle_ = handle;
+        if (size_ != chip_data_.flash) {
+            result_ = EZP_INVALID_RANGE;
+            return false;
+        }
+        ezp_async *op;
+        int ret;
+        if (kind_ == kind::write) {
+            ret = ezp_write_flash_async(programmer_, data_, &chip_data_, speed_, nullptr, done, this, &op);
+        } else {
+            uint8_t *destination = data_;
+            if (kind_ == kind::verify) {
+                readback_.reset(new(std::nothrow) uint8_t[size_]);
+                if (!readback_) {
+                    result_ = EZP_OUT_OF_MEMORY;
+                    return false;
+                }
+                destination = readback_.get();
+            }
+            ret = ezp_read_flash_async(programmer_, destination, &chip_data_, speed_, nullptr, done, this, &op);
+        }
+        if (ret != EZP_OK) {
+            result_ = ret;
+            return false;
+        }
+        //stay running if the operation already completed while it was started
+        suspended_ = !completed_;
+        return suspended_;
+    }
+
+    std::error_code await_resume() const noexcept {
+        if (result_ == EZP_OK && kind_ == kind::verify && std::memcmp(readback_.get(), data_, size_) != 0)
+            return errc::verify_failed;
+        return to_error(result_);
+    }
+
+private:
+    static void done(ezp_async *op, int result, void *user_data) {
+        auto *self = static_cast<async_transfer *>(user_data);
+        ezp_async_free(op);
+        self->result_ = result;
+        self->completed_ = true;
+        if (self->suspended_) self->handle_.resume();
+    }
+
+    ezp_programmer *programmer_;
+    kind kind_;
+    uint8_t *data_;
+    std::size_t size_;
+    ezp_chip_data chip_data_;
+    ezp_speed speed_;
+    std::unique_ptr<uint8_t[]> readback_;
+    std::coroutine_handle<> handle_;
+    int result_ = EZP_OK;
+    bool completed_ = false;
+    bool suspended_ = false;
+};
+
+programmer context::find_programmer() const noexcept {
+    return programmer(ezp_context_find_programmer(handle_));
+}
+
+std::vector<programmer> context::find_programmers(std::error_code &ec) const {
+    ezp_programmer **found = nullptr;
+    int count = ezp_context_find_programmers(handle_, &found);
+    std::vector<programmer> programmers;
+    ec = count < 0 ? to_error(count) : std::error_code();
+    if (count <= 0) return programmers;
+    programmers.reserve(count);
+    for (int i = 0; i < count; ++i) programmers.emplace_back(found[i]);
+    std::free(found); //the programmers are owned by the vector now, only the array is released
+    return programmers;
+}
+
+async_transfer programmer::read_async(std::span<uint8_t> data, const ezp_chip_data &chip_data,
+                                      ezp_speed speed) noexcept {
+    return {handle_, async_transfer::kind::read, data.data(), data.size(), chip_data, speed};
+}
+
+async_transfer programmer::write_async(std::span<const uint8_t> data, const ezp_chip_data &chip_data,
+                                       ezp_speed speed) noexcept {
+    //OUT transfers only read from the buffer
+    return {handle_, async_transfer::kind::write, const_cast<uint8_t *>(data.data()), data.size(), chip_data, speed};
+}
+
+async_transfer programmer::verify_async(std::span<const uint8_t> data, const ezp_chip_data &chip_data,
+                                        ezp_speed speed) noexcept {
+    return {handle_, async_transfer::kind::verify, const_cast<uint8_t *>(data.data()), data.size(), chip_data,
+            speed};
+}
+
+}
+
+#endif //LIBEZP2023PLUS_EZP_PROG_HPP
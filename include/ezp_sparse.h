@@ -0,0 +1,61 @@
+#ifndef LIBEZP2023PLUS_EZP_SPARSE_H
+#define LIBEZP2023PLUS_EZP_SPARSE_H
+
+#include "ezp_prog.h"
+
+#define EZP_RUNS_MAGIC 0x4c525a45 //"EZRL"
+#define EZP_RUNS_VERSION 1
+
+/**
+ * Run-length sidecar header, followed by count runs sorted by offset. All fields are in host byte order
+ * magic - EZP_RUNS_MAGIC
+ * version - EZP_RUNS_VERSION
+ * size - image size, equal to the size of the data file
+ * count - runs count
+ */
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t reserved;
+    uint32_t size;
+    uint32_t count;
+} ezp_runs_header;
+
+/**
+ * Part of the image filled with a single byte value. It is a hole in the data file
+ */
+typedef struct {
+    uint32_t offset;
+    uint32_t length;
+    uint8_t value;
+    uint8_t reserved[3];
+} ezp_run;
+
+/**
+ * Read data from flash into a sparse dump. Every EZP_STREAM_CHUNK_SIZE chunk is scanned as it arrives: chunks
+ * filled with a single byte value are left as holes in the data file and recorded in the run-length sidecar,
+ * only the other chunks are written
+ * @param programmer
+ * @param file path to data file, created with the size of the chip
+ * @param runs_file path to run-length sidecar
+ * @param chip_data information about chip
+ * @param speed reading speed
+ * @param callback progress callback
+ * @return EZP_OK when success. EZP_FLASH_SIZE_OR_PAGE_INVALID, EZP_LIBUSB_ERROR, EZP_OUT_OF_MEMORY or EZP_ERROR_IO
+ * when an error occurred
+ */
+int ezp_read_flash_to_sparse_file(ezp_programmer *programmer, const char *file, const char *runs_file,
+                                  ezp_chip_data *chip_data, ezp_speed speed, ezp_callback callback, void *user_data);
+
+/**
+ * Load a sparse dump into memory, e.g. for ezp_write_flash. Holes are filled from the sidecar without being
+ * read from the data file
+ * @param file path to data file
+ * @param runs_file path to run-length sidecar
+ * @param data output data buffer, free after use
+ * @param size image size
+ * @return EZP_OK when success. EZP_ERROR_IO, EZP_ERROR_INVALID_FILE or EZP_OUT_OF_MEMORY when an error occurred
+ */
+int ezp_load_sparse_file(const char *file, const char *runs_file, uint8_t **data, uint32_t *size);
+
+#endif //LIBEZP2023PLUS_EZP_SPARSE_H
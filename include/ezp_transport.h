@@ -0,0 +1,28 @@
+#ifndef LIBEZP2023PLUS_EZP_TRANSPORT_H
+#define LIBEZP2023PLUS_EZP_TRANSPORT_H
+
+#include <stdint.h>
+#include <sys/time.h>
+#include <libusb-1.0/libusb.h>
+
+/**
+ * Moves packets between the library and a programmer. Implementations embed this struct as their first
+ * member. All functions return libusb error codes, and asynchronous transfers are described by
+ * libusb_transfer structs whose callback the transport calls from handle_events.
+ * transfer - synchronous bulk transfer on an endpoint
+ * submit - queue an asynchronous transfer
+ * cancel - cancel a submitted transfer, its callback still runs with LIBUSB_TRANSFER_CANCELLED
+ * handle_events - complete due transfers. Waits up to timeout, or until completed is set when timeout is NULL
+ * close - release the transport and the device behind it
+ */
+typedef struct ezp_transport ezp_transport;
+struct ezp_transport {
+    int (*transfer)(ezp_transport *transport, unsigned char endpoint, uint8_t *data, int size, int *actual_size,
+                    unsigned int timeout);
+    int (*submit)(ezp_transport *transport, struct libusb_transfer *transfer);
+    int (*cancel)(ezp_transport *transport, struct libusb_transfer *transfer);
+    int (*handle_events)(ezp_transport *transport, struct timeval *timeout, int *completed);
+    void (*close)(ezp_transport *transport);
+};
+
+#endif //LIBEZP2023PLUS_EZP_TRANSPORT_H
@@ -0,0 +1,279 @@
+#include "ezp_capture.h"
+#include "ezp_errors.h"
+#include "ezp_trace.h"
+#include "ezp_pending.h"
+#include "ezp_clock.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#define READ_CHUNK (64 * 1024)
+
+/**
+ * ring - capacity bytes holding records in trace file encoding, a power of two
+ * epoch - monotonic seconds the capture was created at
+ * head - ring offset of the next record, only advanced by the producer
+ * tail - ring offset of the first unflushed byte, only advanced by the flusher
+ */
+struct ezp_capture {
+    FILE *file;
+    uint8_t *ring;
+    size_t capacity;
+    double epoch;
+    _Atomic uint64_t head;
+    _Atomic uint64_t tail;
+    _Atomic uint64_t dropped;
+};
+
+/**
+ * trace - records of the replayed trace
+ * position - offset of the next record to replay
+ * timed - transfers take their recorded duration
+ * pending - ring of submitted transfers, in submission order
+ */
+typedef struct {
+    ezp_transport base;
+    uint8_t *trace;
+    size_t trace_size;
+    size_t position;
+    int timed;
+    int64_t divergences;
+    ezp_pending_queue pending;
+} replay;
+
+ezp_capture *ezp_capture_new(size_t capacity, FILE *file) {
+    size_t size = sizeof(ezp_trace_record);
+    while (size < capacity) size <<= 1;
+
+    ezp_capture *capture = calloc(1, sizeof(ezp_capture));
+    if (!capture) return NULL;
+    capture->ring = malloc(size);
+    if (!capture->ring) {
+        free(capture);
+        return NULL;
+    }
+    capture->file = file;
+    capture->capacity = size;
+    capture->epoch = ezp_monotonic_seconds();
+
+    ezp_trace_header header = {
+            .magic = EZP_TRACE_MAGIC,
+            .version = EZP_TRACE_VERSION,
+            .record_size = sizeof(ezp_trace_record)
+    };
+    if (fwrite(&header, sizeof(header), 1, file) != 1) {
+        free(capture->ring);
+        free(capture);
+        return NULL;
+    }
+    return capture;
+}
+
+void ezp_capture_free(ezp_capture *capture) {
+    if (!capture) return;
+    ezp_capture_flush(capture);
+    free(capture->ring);
+    free(capture);
+}
+
+static void ring_write(ezp_capture *capture, uint64_t position, const void *data, size_t size) {
+    size_t offset = position & (capture->capacity - 1);
+    size_t first = size < capture->capacity - offset ? size : capture->capacity - offset;
+    memcpy(capture->ring + offset, data, first);
+    if (first < size) memcpy(capture->ring, (const uint8_t *) data + first, size - first);
+}
+
+void ezp_capture_record(ezp_capture *capture, unsigned char endpoint, const uint8_t *data, int length,
+                        int actual_length, int status, double started, double finished) {
+    int size = endpoint & LIBUSB_ENDPOINT_IN ? actual_length : length;
+    if (size < 0 || !data) size = 0;
+    double duration = (finished - started) * 1e6;
+    ezp_trace_record record = {
+            .timestamp = (uint64_t) ((finished - capture->epoch) * 1e9),
+            .duration = duration < UINT32_MAX ? (uint32_t) duration : UINT32_MAX,
+            .status = status,
+            .length = length,
+            .actual_length = actual_length,
+            .size = size,
+            .endpoint = endpoint
+    };
+
+    //the flusher only moves tail forward, so the free space seen here can only grow behind our back
+    uint64_t head = atomic_load_explicit(&capture->head, memory_order_relaxed);
+    uint64_t tail = atomic_load_explicit(&capture->tail, memory_order_acquire);
+    if (capture->capacity - (head - tail) < sizeof(record) + size) {
+        atomic_fetch_add_explicit(&capture->dropped, 1, memory_order_relaxed);
+        return;
+    }
+    ring_write(capture, head, &record, sizeof(record));
+    if (size) ring_write(capture, head + sizeof(record), data, size);
+    atomic_store_explicit(&capture->head, head + sizeof(record) + size, memory_order_release);
+}
+
+int ezp_capture_flush(ezp_capture *capture) {
+    uint64_t tail = atomic_load_explicit(&capture->tail, memory_order_relaxed);
+    uint64_t head = atomic_load_explicit(&capture->head, memory_order_acquire);
+    while (tail != head) {
+        size_t offset = tail & (capture->capacity - 1);
+        size_t size = head - tail < capture->capacity - offset ? head - tail : capture->capacity - offset;
+        if (fwrite(capture->ring + offset, 1, size, capture->file) != size) return EZP_ERROR_IO;
+        tail += size;
+        atomic_store_explicit(&capture->tail, tail, memory_order_release);
+    }
+    return fflush(capture->file) ? EZP_ERROR_IO : EZP_OK;
+}
+
+uint64_t ezp_capture_dropped(ezp_capture *capture) {
+    return atomic_load_explicit(&capture->dropped, memory_order_relaxed);
+}
+
+void ezp_set_capture(ezp_programmer *programmer, ezp_capture *capture) {
+    programmer->capture = capture;
+}
+
+//answer a transfer with the next record. Returns its libusb status
+static int replay_answer(replay *rep, unsigned char endpoint, uint8_t *data, int size, int *actual_size,
+                         double *duration) {
+    *actual_size = 0;
+    *duration = 0;
+    if (rep->position == rep->trace_size) {
+        rep->divergences++;
+        return LIBUSB_ERROR_NO_DEVICE;
+    }
+    ezp_trace_record record;
+    memcpy(&record, rep->trace + rep->position, sizeof(record));
+    if (record.endpoint != endpoint) {
+        rep->divergences++;
+        return LIBUSB_ERROR_IO;
+    }
+    const uint8_t *payload = rep->trace + rep->position + sizeof(record);
+    rep->position += sizeof(record) + record.size;
+
+    uint32_t actual = record.actual_length < (uint32_t) size ? record.actual_length : (uint32_t) size;
+    if (endpoint & LIBUSB_ENDPOINT_IN) {
+        if (actual > record.size) actual = record.size;
+        memcpy(data, payload, actual);
+    } else if (record.length != (uint32_t) size ||
+               memcmp(data, payload, record.size < (uint32_t) size ? record.size : (uint32_t) size) != 0) {
+        rep->divergences++;
+    }
+    *actual_size = (int) actual;
+    *duration = record.duration / 1e6;
+    return record.status;
+}
+
+static int replay_transfer(ezp_transport *transport, unsigned char endpoint, uint8_t *data, int size,
+                           int *actual_size, unsigned int timeout) {
+    (void) timeout;
+    replay *rep = (replay *) transport;
+    double started = ezp_monotonic_seconds();
+    double duration;
+    int ret = replay_answer(rep, endpoint, data, size, actual_size, &duration);
+    if (rep->timed) ezp_sleep_until(started + duration);
+    return ret;
+}
+
+static int replay_submit(ezp_transport *transport, struct libusb_transfer *transfer) {
+    replay *rep = (replay *) transport;
+    ezp_pending_transfer *slot = ezp_pending_push(&rep->pending, transfer);
+    if (!slot) return LIBUSB_ERROR_NO_MEM;
+    double duration;
+    //records are consumed in submission order, which is the order the capture saw them complete in
+    slot->status = replay_answer(rep, transfer->endpoint, transfer->buffer, transfer->length, &slot->actual_length,
+                                 &duration);
+    slot->due = rep->timed ? ezp_monotonic_seconds() + duration : 0;
+    return LIBUSB_SUCCESS;
+}
+
+static int replay_cancel(ezp_transport *transport, struct libusb_transfer *transfer) {
+    replay *rep = (replay *) transport;
+    ezp_pending_transfer *slot = ezp_pending_find(&rep->pending, transfer);
+    //the trace has it moving data, so the cancellation came too late
+    if (!slot || slot->actual_length != 0) return LIBUSB_ERROR_NOT_FOUND;
+    slot->cancelled = 1;
+    return LIBUSB_SUCCESS;
+}
+
+//the answer was taken from the trace at submission
+static int replay_complete(ezp_transport *transport, ezp_pending_transfer *pending) {
+    (void) transport;
+    pending->transfer->actual_length = pending->actual_length;
+    return pending->status;
+}
+
+static int replay_handle_events(ezp_transport *transport, struct timeval *timeout, int *completed) {
+    replay *rep = (replay *) transport;
+    return ezp_pending_handle_events(&rep->pending, transport, replay_complete, timeout, completed);
+}
+
+static void replay_close(ezp_transport *transport) {
+    replay *rep = (replay *) transport;
+    ezp_pending_free(&rep->pending);
+    free(rep->trace);
+    free(rep);
+}
+
+//read the whole trace. A record cut short by a crashed capture ends the trace
+static int read_trace(FILE *file, replay *rep) {
+    ezp_trace_header header;
+    if (fread(&header, sizeof(header), 1, file) != 1) return ferror(file) ? EZP_ERROR_IO : EZP_ERROR_INVALID_FILE;
+    if (header.magic != EZP_TRACE_MAGIC || header.version != EZP_TRACE_VERSION ||
+        header.record_size != sizeof(ezp_trace_record)) {
+        return EZP_ERROR_INVALID_FILE;
+    }
+
+    size_t capacity = 0;
+    for (;;) {
+        if (rep->trace_size == capacity) {
+            capacity += READ_CHUNK;
+            uint8_t *trace = realloc(rep->trace, capacity);
+            if (!trace) return EZP_OUT_OF_MEMORY;
+            rep->trace = trace;
+        }
+        size_t size = fread(rep->trace + rep->trace_size, 1, capacity - rep->trace_size, file);
+        rep->trace_size += size;
+        if (size == 0) break;
+    }
+    if (ferror(file)) return EZP_ERROR_IO;
+
+    size_t position = 0;
+    while (rep->trace_size - position >= sizeof(ezp_trace_record)) {
+        ezp_trace_record record;
+        memcpy(&record, rep->trace + position, sizeof(record));
+        if (rep->trace_size - position - sizeof(record) < record.size) break;
+        position += sizeof(record) + record.size;
+    }
+    rep->trace_size = position;
+    return EZP_OK;
+}
+
+int ezp_replay_new(FILE *file, int timed, ezp_programmer **programmer) {
+    replay *rep = calloc(1, sizeof(replay));
+    if (!rep) return EZP_OUT_OF_MEMORY;
+    rep->base = (ezp_transport) {
+            .transfer = replay_transfer,
+            .submit = replay_submit,
+            .cancel = replay_cancel,
+            .handle_events = replay_handle_events,
+            .close = replay_close
+    };
+    rep->timed = timed;
+
+    int ret = read_trace(file, rep);
+    if (ret != EZP_OK) {
+        replay_close(&rep->base);
+        return ret;
+    }
+
+    *programmer = ezp_programmer_new(NULL, &rep->base);
+    if (!*programmer) {
+        replay_close(&rep->base);
+        return EZP_OUT_OF_MEMORY;
+    }
+    return EZP_OK;
+}
+
+int64_t ezp_replay_divergences(ezp_programmer *programmer) {
+    if (programmer->transport->transfer != replay_transfer) return -1;
+    return ((replay *) programmer->transport)->divergences;
+}
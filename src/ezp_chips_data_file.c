@@ -1,6 +1,13 @@
 #include "ezp_chips_data_file.h"
 #include <stdio.h>
 #include <malloc.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "ezp_errors.h"
 
 static size_t get_file_size(FILE *f) {
@@ -10,12 +17,23 @@ static size_t get_file_size(FILE *f) {
     return size;
 }
 
+static int read_indexed(ezp_chip_data **data, const char *file);
+static int is_indexed(FILE *f);
+
 int ezp_chips_data_read(ezp_chip_data **data, const char *file) {
     FILE *data_file = fopen(file, "r");
     if (!data_file) return EZP_ERROR_IO;
 
+    if (is_indexed(data_file)) {
+        fclose(data_file);
+        return read_indexed(data, file);
+    }
+
     size_t file_size = get_file_size(data_file);
-    if (file_size == 0 || file_size % sizeof(ezp_chip_data) != 0) return EZP_ERROR_INVALID_FILE;
+    if (file_size == 0 || file_size % sizeof(ezp_chip_data) != 0) {
+        fclose(data_file);
+        return EZP_ERROR_INVALID_FILE;
+    }
     size_t entries_count = file_size / sizeof(ezp_chip_data) - 1; // last entry is empty
 
     *data = malloc(entries_count * sizeof(ezp_chip_data));
@@ -45,4 +63,673 @@ int ezp_chips_data_write(ezp_chip_data *data, size_t count, const char *file) {
 
     if (fclose(data_file) != 0) return EZP_ERROR_IO;
     return EZP_OK;
-}
\ No newline at end of file
+}
+
+#define NAME_SIZE sizeof(((ezp_chip_data *) 0)->name)
+#define NO_ENTRY UINT32_MAX
+#define INDEXED_MAGIC 0x42445a45 //"EZDB"
+#define INDEXED_VERSION 1
+#define ALIGN4(x) (((x) + 3) & ~(size_t) 3)
+
+/**
+ * Indexed chips data file, little-endian:
+ *   header
+ *   sections - one per chip class present, ascending. Records are grouped by class
+ *   records - chip data with names replaced by string pool offsets
+ *   id index - record indices sorted by chip id
+ *   name index - normalized chip name and record index, sorted by name
+ *   strings - interned zero terminated strings. Offset 0 is the empty string
+ * Every table starts 4 bytes aligned
+ */
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_size;
+    uint32_t count;
+    uint32_t sections_count;
+    uint32_t sections_offset;
+    uint32_t records_offset;
+    uint32_t id_index_offset;
+    uint32_t name_index_offset;
+    uint32_t strings_offset;
+    uint32_t strings_size;
+} indexed_header;
+
+typedef struct {
+    uint8_t clazz;
+    uint8_t reserved[3];
+    uint32_t first;
+    uint32_t count;
+} indexed_section;
+
+/**
+ * prefix - type and manufacturer, everything before the last comma of name. NO_ENTRY when name has no comma
+ * name - chip name, everything after the last comma of name
+ */
+typedef struct {
+    uint32_t prefix;
+    uint32_t name;
+    uint32_t chip_id;
+    uint32_t flash;
+    uint16_t flash_page;
+    uint8_t clazz;
+    uint8_t algorithm;
+    uint16_t delay;
+    uint16_t extend;
+    uint16_t eeprom;
+    uint8_t eeprom_page;
+    uint8_t voltage;
+} indexed_record;
+
+typedef struct {
+    uint32_t name;
+    uint32_t record;
+} indexed_name;
+
+/**
+ * Legacy files are indexed on open, indexed files are used straight from the mapping.
+ * entries - legacy: mapped file, count entries without the empty terminator
+ * buckets - legacy: chip id hash table of bucket_mask + 1 chain heads
+ * id_next, name_next - legacy: per entry links of the chip id and chip name chains
+ * name_buckets - legacy: chip name hash table, same size as buckets
+ * names - legacy: normalized chip name of every entry
+ * name_order - legacy: entry indices sorted by normalized chip name
+ * header ... strings - indexed: tables inside the mapping
+ */
+struct ezp_chips_db {
+    const void *map;
+    size_t mapped_size;
+    uint32_t count;
+
+    const ezp_chip_data *entries;
+    uint32_t bucket_mask;
+    uint32_t *buckets;
+    uint32_t *id_next;
+    uint32_t *name_buckets;
+    uint32_t *name_next;
+    char (*names)[NAME_SIZE];
+    uint32_t *name_order;
+
+    const indexed_header *header;
+    const indexed_section *sections;
+    const indexed_record *records;
+    const uint32_t *id_index;
+    const indexed_name *name_index;
+    const char *strings;
+};
+
+static uint32_t hash_id(uint32_t chip_id) {
+    chip_id ^= chip_id >> 16;
+    chip_id *= 0x7feb352dU;
+    chip_id ^= chip_id >> 15;
+    chip_id *= 0x846ca68bU;
+    return chip_id ^ (chip_id >> 16);
+}
+
+static uint32_t hash_name(const char *name) {
+    uint32_t hash = 2166136261U; //FNV-1a
+    while (*name) {
+        hash ^= (uint8_t) *name++;
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+//lower case letters and digits only. out holds NAME_SIZE bytes
+static void normalize_name(const char *name, size_t size, char *out) {
+    size_t length = 0;
+    for (size_t i = 0; i < size && name[i] && length < NAME_SIZE - 1; ++i) {
+        if (isalnum((unsigned char) name[i])) out[length++] = (char) tolower((unsigned char) name[i]);
+    }
+    out[length] = 0;
+}
+
+//chip name is the last comma separated field of name. Returns its offset, NAME_SIZE when name has no comma
+static size_t split_name(const ezp_chip_data *entry, size_t *size) {
+    *size = strnlen(entry->name, NAME_SIZE);
+    size_t start = *size;
+    while (start > 0 && entry->name[start - 1] != ',') start--;
+    return start;
+}
+
+static void normalize_chip_name(const ezp_chip_data *entry, char *out) {
+    size_t size;
+    size_t start = split_name(entry, &size);
+    normalize_name(entry->name + start, size - start, out);
+}
+
+static const char *db_string(const ezp_chips_db *db, uint32_t offset) {
+    if (offset >= db->header->strings_size) return ""; //pool is terminated, so every valid offset is safe
+    return db->strings + offset;
+}
+
+static uint32_t db_chip_id(const ezp_chips_db *db, uint32_t index) {
+    return db->entries ? db->entries[index].chip_id : db->records[index].chip_id;
+}
+
+//normalized chip name and record of the k-th entry in name order
+static const char *db_sorted_name(const ezp_chips_db *db, uint32_t k, uint32_t *record) {
+    if (db->entries) {
+        *record = db->name_order[k];
+        return db->names[*record];
+    }
+    *record = db->name_index[k].record;
+    return db_string(db, db->name_index[k].name);
+}
+
+static void db_record(const ezp_chips_db *db, uint32_t index, ezp_chip_data *chip_data) {
+    if (db->entries) {
+        *chip_data = db->entries[index];
+        return;
+    }
+    const indexed_record *record = &db->records[index];
+    memset(chip_data, 0, sizeof(ezp_chip_data));
+    //a name of NAME_SIZE characters fills the field without terminator
+    char name[NAME_SIZE + 1];
+    if (record->prefix != NO_ENTRY) {
+        snprintf(name, sizeof(name), "%s,%s", db_string(db, record->prefix), db_string(db, record->name));
+    } else {
+        snprintf(name, sizeof(name), "%s", db_string(db, record->name));
+    }
+    memcpy(chip_data->name, name, strnlen(name, NAME_SIZE));
+    chip_data->chip_id = record->chip_id;
+    chip_data->flash = record->flash;
+    chip_data->flash_page = record->flash_page;
+    chip_data->clazz = record->clazz;
+    chip_data->algorithm = record->algorithm;
+    chip_data->delay = record->delay;
+    chip_data->extend = record->extend;
+    chip_data->eeprom = record->eeprom;
+    chip_data->eeprom_page = record->eeprom_page;
+    chip_data->voltage = record->voltage;
+}
+
+//qsort has no user data, so sorted items carry everything the comparison needs
+typedef struct {
+    const char *name;
+    uint32_t index;
+} name_key;
+
+static int compare_names(const void *a, const void *b) {
+    const name_key *left = a, *right = b;
+    int ret = strcmp(left->name, right->name);
+    if (ret != 0) return ret;
+    return left->index < right->index ? -1 : left->index > right->index; //keep file order between equal names
+}
+
+static int build_indices(ezp_chips_db *db) {
+    uint32_t buckets_count = 16;
+    while (buckets_count < db->count * 2) buckets_count <<= 1;
+    db->bucket_mask = buckets_count - 1;
+
+    db->buckets = malloc(buckets_count * sizeof(uint32_t));
+    db->name_buckets = malloc(buckets_count * sizeof(uint32_t));
+    db->id_next = malloc(db->count * sizeof(uint32_t));
+    db->name_next = malloc(db->count * sizeof(uint32_t));
+    db->names = malloc(db->count * NAME_SIZE);
+    db->name_order = malloc(db->count * sizeof(uint32_t));
+    if (!db->buckets || !db->name_buckets || (db->count && (!db->id_next || !db->name_next || !db->names ||
+                                                            !db->name_order))) {
+        return EZP_OUT_OF_MEMORY;
+    }
+    memset(db->buckets, 0xff, buckets_count * sizeof(uint32_t));
+    memset(db->name_buckets, 0xff, buckets_count * sizeof(uint32_t));
+
+    //insert backwards, so every chain lists its entries in file order
+    for (uint32_t i = db->count; i-- > 0;) {
+        uint32_t bucket = hash_id(db->entries[i].chip_id) & db->bucket_mask;
+        db->id_next[i] = db->buckets[bucket];
+        db->buckets[bucket] = i;
+
+        normalize_chip_name(&db->entries[i], db->names[i]);
+        bucket = hash_name(db->names[i]) & db->bucket_mask;
+        db->name_next[i] = db->name_buckets[bucket];
+        db->name_buckets[bucket] = i;
+    }
+
+    name_key *keys = malloc(db->count * sizeof(name_key));
+    if (db->count && !keys) return EZP_OUT_OF_MEMORY;
+    for (uint32_t i = 0; i < db->count; ++i) keys[i] = (name_key) {.name = db->names[i], .index = i};
+    qsort(keys, db->count, sizeof(name_key), compare_names);
+    for (uint32_t i = 0; i < db->count; ++i) db->name_order[i] = keys[i].index;
+    free(keys);
+    return EZP_OK;
+}
+
+static int table_valid(size_t file_size, uint32_t offset, size_t count, size_t item_size) {
+    if (offset % 4 != 0 || offset > file_size) return 0;
+    return count <= (file_size - offset) / item_size;
+}
+
+//header and table bounds only, so opening stays O(1). Offsets inside the tables are checked on access
+static int map_indexed(ezp_chips_db *db) {
+    const uint8_t *base = db->map;
+    size_t file_size = db->mapped_size;
+    if (file_size < sizeof(indexed_header)) return EZP_ERROR_INVALID_FILE;
+
+    const indexed_header *header = db->map;
+    if (header->magic != INDEXED_MAGIC || header->version != INDEXED_VERSION ||
+        header->header_size < sizeof(indexed_header)) {
+        return EZP_ERROR_INVALID_FILE;
+    }
+    if (!table_valid(file_size, header->sections_offset, header->sections_count, sizeof(indexed_section)) ||
+        !table_valid(file_size, header->records_offset, header->count, sizeof(indexed_record)) ||
+        !table_valid(file_size, header->id_index_offset, header->count, sizeof(uint32_t)) ||
+        !table_valid(file_size, header->name_index_offset, header->count, sizeof(indexed_name)) ||
+        header->strings_size == 0 || header->strings_offset > file_size ||
+        header->strings_size > file_size - header->strings_offset ||
+        base[header->strings_offset + header->strings_size - 1] != 0) {
+        return EZP_ERROR_INVALID_FILE;
+    }
+
+    db->header = header;
+    db->count = header->count;
+    db->sections = (const indexed_section *) (base + header->sections_offset);
+    db->records = (const indexed_record *) (base + header->records_offset);
+    db->id_index = (const uint32_t *) (base + header->id_index_offset);
+    db->name_index = (const indexed_name *) (base + header->name_index_offset);
+    db->strings = (const char *) (base + header->strings_offset);
+    return EZP_OK;
+}
+
+int ezp_chips_db_open(ezp_chips_db **db, const char *file) {
+    *db = NULL;
+    int fd = open(file, O_RDONLY);
+    if (fd < 0) return EZP_ERROR_IO;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return EZP_ERROR_IO;
+    }
+    size_t file_size = st.st_size;
+    if (file_size == 0) {
+        close(fd);
+        return EZP_ERROR_INVALID_FILE;
+    }
+
+    void *map = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); //the mapping keeps the file
+    if (map == MAP_FAILED) return EZP_ERROR_IO;
+
+    ezp_chips_db *new_db = calloc(1, sizeof(ezp_chips_db));
+    if (!new_db) {
+        munmap(map, file_size);
+        return EZP_OUT_OF_MEMORY;
+    }
+    new_db->map = map;
+    new_db->mapped_size = file_size;
+
+    int ret;
+    if (file_size >= sizeof(uint32_t) && *(const uint32_t *) map == INDEXED_MAGIC) {
+        ret = map_indexed(new_db);
+    } else if (file_size % sizeof(ezp_chip_data) != 0 || file_size / sizeof(ezp_chip_data) > NO_ENTRY) {
+        ret = EZP_ERROR_INVALID_FILE;
+    } else {
+        new_db->entries = map;
+        new_db->count = file_size / sizeof(ezp_chip_data) - 1; // last entry is empty
+        ret = build_indices(new_db);
+    }
+    if (ret != EZP_OK) {
+        ezp_chips_db_close(new_db);
+        return ret;
+    }
+    *db = new_db;
+    return EZP_OK;
+}
+
+void ezp_chips_db_close(ezp_chips_db *db) {
+    if (!db) return;
+    munmap((void *) db->map, db->mapped_size);
+    free(db->buckets);
+    free(db->id_next);
+    free(db->name_buckets);
+    free(db->name_next);
+    free(db->names);
+    free(db->name_order);
+    free(db);
+}
+
+size_t ezp_chips_db_count(const ezp_chips_db *db) {
+    return db->count;
+}
+
+int ezp_chips_db_get(const ezp_chips_db *db, uint32_t index, ezp_chip_data *chip_data) {
+    if (index >= db->count) return EZP_INVALID_RANGE;
+    db_record(db, index, chip_data);
+    return EZP_OK;
+}
+
+static size_t add_match(uint32_t index, size_t found, uint32_t *matches, size_t max_matches) {
+    if (matches && found < max_matches) matches[found] = index;
+    return found + 1;
+}
+
+size_t ezp_chips_db_find_by_id(const ezp_chips_db *db, uint32_t chip_id, uint32_t *matches, size_t max_matches) {
+    size_t found = 0;
+    if (db->entries) {
+        for (uint32_t i = db->buckets[hash_id(chip_id) & db->bucket_mask]; i != NO_ENTRY; i = db->id_next[i]) {
+            if (db->entries[i].chip_id == chip_id) found = add_match(i, found, matches, max_matches);
+        }
+        return found;
+    }
+
+    //lower bound of chip_id in the id index
+    size_t low = 0, high = db->count;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        uint32_t record = db->id_index[mid];
+        if (record < db->count && db_chip_id(db, record) < chip_id) low = mid + 1;
+        else high = mid;
+    }
+    for (size_t i = low; i < db->count; ++i) {
+        uint32_t record = db->id_index[i];
+        if (record >= db->count || db_chip_id(db, record) != chip_id) break;
+        found = add_match(record, found, matches, max_matches);
+    }
+    return found;
+}
+
+//first position in name order whose name starts with, or sorts after, the first length bytes of name
+static size_t name_lower_bound(const ezp_chips_db *db, const char *name, size_t length) {
+    size_t low = 0, high = db->count;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        uint32_t record;
+        if (strncmp(db_sorted_name(db, mid, &record), name, length) < 0) low = mid + 1;
+        else high = mid;
+    }
+    return low;
+}
+
+size_t ezp_chips_db_find_by_name(const ezp_chips_db *db, const char *name, uint32_t *matches, size_t max_matches) {
+    char normalized[NAME_SIZE];
+    normalize_name(name, strlen(name), normalized);
+
+    size_t found = 0;
+    if (db->entries) {
+        uint32_t bucket = hash_name(normalized) & db->bucket_mask;
+        for (uint32_t i = db->name_buckets[bucket]; i != NO_ENTRY; i = db->name_next[i]) {
+            if (strcmp(db->names[i], normalized) == 0) found = add_match(i, found, matches, max_matches);
+        }
+        return found;
+    }
+
+    uint32_t record;
+    for (size_t i = name_lower_bound(db, normalized, NAME_SIZE);
+         i < db->count && strcmp(db_sorted_name(db, i, &record), normalized) == 0; ++i) {
+        if (record < db->count) found = add_match(record, found, matches, max_matches);
+    }
+    return found;
+}
+
+size_t ezp_chips_db_find_prefix(const ezp_chips_db *db, const char *prefix, uint32_t *matches, size_t max_matches) {
+    char normalized[NAME_SIZE];
+    normalize_name(prefix, strlen(prefix), normalized);
+    size_t length = strlen(normalized);
+
+    size_t found = 0;
+    uint32_t record;
+    for (size_t i = name_lower_bound(db, normalized, length);
+         i < db->count && strncmp(db_sorted_name(db, i, &record), normalized, length) == 0; ++i) {
+        if (record < db->count) found = add_match(record, found, matches, max_matches);
+    }
+    return found;
+}
+
+size_t ezp_chips_db_find_by_class(const ezp_chips_db *db, ezp_flash clazz, uint32_t *matches, size_t max_matches) {
+    size_t found = 0;
+    if (db->entries) {
+        for (uint32_t i = 0; i < db->count; ++i) {
+            if (db->entries[i].clazz == clazz) found = add_match(i, found, matches, max_matches);
+        }
+        return found;
+    }
+
+    for (uint32_t s = 0; s < db->header->sections_count; ++s) {
+        const indexed_section *section = &db->sections[s];
+        if (section->clazz != clazz) continue;
+        for (uint32_t i = section->first; i - section->first < section->count && i < db->count; ++i) {
+            found = add_match(i, found, matches, max_matches);
+        }
+    }
+    return found;
+}
+
+size_t ezp_chips_db_search(const ezp_chips_db *db, const char *pattern, uint32_t *matches, size_t max_matches) {
+    size_t length = strlen(pattern);
+    if (length > NAME_SIZE) return 0;
+    char lower_pattern[NAME_SIZE + 1];
+    for (size_t i = 0; i <= length; ++i) lower_pattern[i] = (char) tolower((unsigned char) pattern[i]);
+
+    size_t found = 0;
+    char name[NAME_SIZE + 1];
+    ezp_chip_data chip_data;
+    for (uint32_t i = 0; i < db->count; ++i) {
+        const char *entry_name = db->entries ? db->entries[i].name : chip_data.name;
+        if (!db->entries) db_record(db, i, &chip_data);
+        //name is not terminated when it fills the field
+        size_t size = strnlen(entry_name, NAME_SIZE);
+        for (size_t j = 0; j < size; ++j) name[j] = (char) tolower((unsigned char) entry_name[j]);
+        name[size] = 0;
+        if (strstr(name, lower_pattern)) found = add_match(i, found, matches, max_matches);
+    }
+    return found;
+}
+
+static int is_indexed(FILE *f) {
+    uint32_t magic = 0;
+    size_t size = fread(&magic, sizeof(magic), 1, f);
+    fseek(f, 0, SEEK_SET);
+    return size == 1 && magic == INDEXED_MAGIC;
+}
+
+static int read_indexed(ezp_chip_data **data, const char *file) {
+    ezp_chips_db *db;
+    int ret = ezp_chips_db_open(&db, file);
+    if (ret != EZP_OK) return ret;
+
+    *data = malloc(db->count * sizeof(ezp_chip_data));
+    if (!*data && db->count) {
+        ezp_chips_db_close(db);
+        return EZP_OUT_OF_MEMORY;
+    }
+    for (uint32_t i = 0; i < db->count; ++i) db_record(db, i, &(*data)[i]);
+    int count = (int) db->count;
+    ezp_chips_db_close(db);
+    return count;
+}
+
+/**
+ * Growing pool of zero terminated strings, every distinct string stored once.
+ * slots - open addressing table of offsets + 1, 0 marks a free slot
+ */
+typedef struct {
+    char *data;
+    size_t size;
+    size_t capacity;
+    uint32_t *slots;
+    size_t slots_mask;
+} string_pool;
+
+static int pool_init(string_pool *pool, size_t strings) {
+    size_t slots = 16;
+    while (slots < strings * 2) slots <<= 1;
+    pool->slots = calloc(slots, sizeof(uint32_t));
+    pool->slots_mask = slots - 1;
+    pool->capacity = 4096;
+    pool->data = malloc(pool->capacity);
+    pool->size = 1;
+    if (!pool->slots || !pool->data) return EZP_OUT_OF_MEMORY;
+    pool->data[0] = 0;
+    return EZP_OK;
+}
+
+static void pool_free(string_pool *pool) {
+    free(pool->data);
+    free(pool->slots);
+}
+
+//returns the offset of the string, NO_ENTRY when out of memory
+static uint32_t pool_intern(string_pool *pool, const char *string, size_t length) {
+    if (length == 0) return 0;
+    uint32_t hash = 2166136261U;
+    for (size_t i = 0; i < length; ++i) {
+        hash ^= (uint8_t) string[i];
+        hash *= 16777619U;
+    }
+    size_t slot = hash & pool->slots_mask;
+    for (; pool->slots[slot]; slot = (slot + 1) & pool->slots_mask) {
+        const char *candidate = pool->data + pool->slots[slot] - 1;
+        if (strncmp(candidate, string, length) == 0 && candidate[length] == 0) return pool->slots[slot] - 1;
+    }
+
+    if (pool->size + length + 1 > pool->capacity) {
+        size_t capacity = pool->capacity;
+        while (pool->size + length + 1 > capacity) capacity *= 2;
+        char *data = realloc(pool->data, capacity);
+        if (!data) return NO_ENTRY;
+        pool->data = data;
+        pool->capacity = capacity;
+    }
+    uint32_t offset = pool->size;
+    memcpy(pool->data + offset, string, length);
+    pool->data[offset + length] = 0;
+    pool->size += length + 1;
+    pool->slots[slot] = offset + 1;
+    return offset;
+}
+
+typedef struct {
+    uint32_t chip_id;
+    uint32_t index;
+} id_key;
+
+static int compare_ids(const void *a, const void *b) {
+    const id_key *left = a, *right = b;
+    if (left->chip_id != right->chip_id) return left->chip_id < right->chip_id ? -1 : 1;
+    return left->index < right->index ? -1 : left->index > right->index;
+}
+
+static int write_table(FILE *f, const void *data, size_t size) {
+    static const uint8_t padding[4];
+    if (size && fwrite(data, size, 1, f) != 1) return 0;
+    return ALIGN4(size) == size || fwrite(padding, ALIGN4(size) - size, 1, f) == 1;
+}
+
+int ezp_chips_data_write_indexed(const ezp_chip_data *data, size_t count, const char *file) {
+    if (count >= NO_ENTRY) return EZP_ERROR_INVALID_FILE;
+
+    indexed_section sections[256];
+    uint32_t sections_count = 0;
+    uint32_t class_counts[256] = {0};
+    for (size_t i = 0; i < count; ++i) class_counts[data[i].clazz]++;
+    uint32_t class_first[256];
+    for (uint32_t clazz = 0, first = 0; clazz < 256; ++clazz) {
+        class_first[clazz] = first;
+        if (!class_counts[clazz]) continue;
+        sections[sections_count++] = (indexed_section) {
+                .clazz = clazz,
+                .first = first,
+                .count = class_counts[clazz]
+        };
+        first += class_counts[clazz];
+    }
+
+    int ret = EZP_OUT_OF_MEMORY;
+    string_pool pool = {0};
+    indexed_record *records = malloc(count * sizeof(indexed_record));
+    uint32_t *id_index = malloc(count * sizeof(uint32_t));
+    indexed_name *name_index = malloc(count * sizeof(indexed_name));
+    id_key *id_keys = malloc(count * sizeof(id_key));
+    name_key *name_keys = malloc(count * sizeof(name_key));
+    if ((count && (!records || !id_index || !name_index || !id_keys || !name_keys)) ||
+        pool_init(&pool, count * 3) != EZP_OK) goto out;
+
+    //records grouped by class, file order kept inside a class
+    for (size_t i = 0; i < count; ++i) {
+        const ezp_chip_data *entry = &data[i];
+        uint32_t index = class_first[entry->clazz]++;
+        size_t size;
+        size_t start = split_name(entry, &size);
+        char normalized[NAME_SIZE];
+        normalize_chip_name(entry, normalized);
+
+        indexed_record *record = &records[index];
+        record->prefix = start > 0 ? pool_intern(&pool, entry->name, start - 1) : NO_ENTRY;
+        record->name = pool_intern(&pool, entry->name + start, size - start);
+        name_index[index].name = pool_intern(&pool, normalized, strlen(normalized));
+        if ((start > 0 && record->prefix == NO_ENTRY) || record->name == NO_ENTRY ||
+            name_index[index].name == NO_ENTRY) {
+            goto out;
+        }
+        record->chip_id = entry->chip_id;
+        record->flash = entry->flash;
+        record->flash_page = entry->flash_page;
+        record->clazz = entry->clazz;
+        record->algorithm = entry->algorithm;
+        record->delay = entry->delay;
+        record->extend = entry->extend;
+        record->eeprom = entry->eeprom;
+        record->eeprom_page = entry->eeprom_page;
+        record->voltage = entry->voltage;
+    }
+
+    for (size_t i = 0; i < count; ++i) id_keys[i] = (id_key) {.chip_id = records[i].chip_id, .index = i};
+    qsort(id_keys, count, sizeof(id_key), compare_ids);
+    for (size_t i = 0; i < count; ++i) id_index[i] = id_keys[i].index;
+    //nothing is interned any more, so pointers into the pool stay valid
+    for (size_t i = 0; i < count; ++i) name_keys[i] = (name_key) {.name = pool.data + name_index[i].name, .index = i};
+    qsort(name_keys, count, sizeof(name_key), compare_names);
+    for (size_t i = 0; i < count; ++i) {
+        name_index[i] = (indexed_name) {.name = name_keys[i].name - pool.data, .record = name_keys[i].index};
+    }
+
+    indexed_header header = {
+            .magic = INDEXED_MAGIC,
+            .version = INDEXED_VERSION,
+            .header_size = sizeof(indexed_header),
+            .count = count,
+            .sections_count = sections_count
+    };
+    size_t offset = ALIGN4(sizeof(indexed_header));
+    header.sections_offset = offset;
+    offset += ALIGN4(sections_count * sizeof(indexed_section));
+    header.records_offset = offset;
+    offset += ALIGN4(count * sizeof(indexed_record));
+    header.id_index_offset = offset;
+    offset += ALIGN4(count * sizeof(uint32_t));
+    header.name_index_offset = offset;
+    offset += ALIGN4(count * sizeof(indexed_name));
+    header.strings_offset = offset;
+    header.strings_size = pool.size;
+
+    ret = EZP_ERROR_IO;
+    FILE *data_file = fopen(file, "w");
+    if (!data_file) goto out;
+    int written = write_table(data_file, &header, sizeof(indexed_header)) &&
+                  write_table(data_file, sections, sections_count * sizeof(indexed_section)) &&
+                  write_table(data_file, records, count * sizeof(indexed_record)) &&
+                  write_table(data_file, id_index, count * sizeof(uint32_t)) &&
+                  write_table(data_file, name_index, count * sizeof(indexed_name)) &&
+                  fwrite(pool.data, pool.size, 1, data_file) == 1;
+    if (fclose(data_file) == 0 && written) ret = EZP_OK;
+
+out:
+    pool_free(&pool);
+    free(records);
+    free(id_index);
+    free(name_index);
+    free(id_keys);
+    free(name_keys);
+    return ret;
+}
+
+int ezp_chips_data_convert(const char *legacy_file, const char *file) {
+    ezp_chip_data *data;
+    int count = ezp_chips_data_read(&data, legacy_file);
+    if (count < 0) return count;
+    int ret = ezp_chips_data_write_indexed(data, count, file);
+    free(data);
+    return ret;
+}
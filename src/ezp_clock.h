@@ -0,0 +1,15 @@
+#ifndef LIBEZP2023PLUS_EZP_CLOCK_H
+#define LIBEZP2023PLUS_EZP_CLOCK_H
+
+/**
+ * @return CLOCK_MONOTONIC time in seconds
+ */
+double ezp_monotonic_seconds();
+
+/**
+ * Sleep until a CLOCK_MONOTONIC time, resuming after signals
+ * @param deadline seconds, see ezp_monotonic_seconds
+ */
+void ezp_sleep_until(double deadline);
+
+#endif //LIBEZP2023PLUS_EZP_CLOCK_H
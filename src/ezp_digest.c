@@ -0,0 +1,140 @@
+#include "ezp_digest.h"
+#include "ezp_kernels.h"
+#include <string.h>
+
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+
+static inline uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t read64(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v; //xxh64 is defined on little-endian words, like every host this library runs on
+}
+
+static inline uint32_t read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t xxh64_round(uint64_t acc, uint64_t input) {
+    acc += input * PRIME64_2;
+    acc = rotl64(acc, 31);
+    return acc * PRIME64_1;
+}
+
+static inline uint64_t xxh64_merge_round(uint64_t acc, uint64_t lane) {
+    acc ^= xxh64_round(0, lane);
+    return acc * PRIME64_1 + PRIME64_4;
+}
+
+static void xxh64_stripes(uint64_t *lanes, const uint8_t *data, size_t stripes) {
+    uint64_t v1 = lanes[0], v2 = lanes[1], v3 = lanes[2], v4 = lanes[3];
+    for (size_t i = 0; i < stripes; ++i, data += 32) {
+        v1 = xxh64_round(v1, read64(data));
+        v2 = xxh64_round(v2, read64(data + 8));
+        v3 = xxh64_round(v3, read64(data + 16));
+        v4 = xxh64_round(v4, read64(data + 24));
+    }
+    lanes[0] = v1;
+    lanes[1] = v2;
+    lanes[2] = v3;
+    lanes[3] = v4;
+}
+
+void ezp_digest_init(ezp_digest_state *state) {
+    memset(state, 0, sizeof(ezp_digest_state));
+    state->crc = 0xffffffff;
+    state->lanes[0] = PRIME64_1 + PRIME64_2;
+    state->lanes[1] = PRIME64_2;
+    state->lanes[2] = 0;
+    state->lanes[3] = -PRIME64_1;
+}
+
+void ezp_digest_update(ezp_digest_state *state, const uint8_t *data, size_t size) {
+    state->crc = ezp_crc32_update(state->crc, data, size);
+    state->total += size;
+
+    if (state->buffered + size < 32) {
+        memcpy(state->buffer + state->buffered, data, size);
+        state->buffered += size;
+        return;
+    }
+    if (state->buffered) {
+        size_t fill = 32 - state->buffered;
+        memcpy(state->buffer + state->buffered, data, fill);
+        xxh64_stripes(state->lanes, state->buffer, 1);
+        data += fill;
+        size -= fill;
+        state->buffered = 0;
+    }
+    xxh64_stripes(state->lanes, data, size / 32);
+    data += size - size % 32;
+    size %= 32;
+    memcpy(state->buffer, data, size);
+    state->buffered = size;
+}
+
+void ezp_digest_final(const ezp_digest_state *state, ezp_digest *digest) {
+    const uint64_t *v = state->lanes;
+    uint64_t h;
+    if (state->total >= 32) {
+        h = rotl64(v[0], 1) + rotl64(v[1], 7) + rotl64(v[2], 12) + rotl64(v[3], 18);
+        h = xxh64_merge_round(h, v[0]);
+        h = xxh64_merge_round(h, v[1]);
+        h = xxh64_merge_round(h, v[2]);
+        h = xxh64_merge_round(h, v[3]);
+    } else {
+        h = v[2] + PRIME64_5;
+    }
+    h += state->total;
+
+    const uint8_t *p = state->buffer;
+    uint32_t left = state->buffered;
+    for (; left >= 8; left -= 8, p += 8) {
+        h ^= xxh64_round(0, read64(p));
+        h = rotl64(h, 27) * PRIME64_1 + PRIME64_4;
+    }
+    if (left >= 4) {
+        h ^= (uint64_t) read32(p) * PRIME64_1;
+        h = rotl64(h, 23) * PRIME64_2 + PRIME64_3;
+        p += 4;
+        left -= 4;
+    }
+    for (; left > 0; --left, ++p) {
+        h ^= *p * PRIME64_5;
+        h = rotl64(h, 11) * PRIME64_1;
+    }
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+
+    digest->crc32 = ~state->crc;
+    digest->xxh64 = h;
+}
+
+void ezp_digest_image(const uint8_t *data, size_t size, ezp_digest *digest,
+                      uint32_t sector_size, ezp_digest *sector_digests) {
+    ezp_digest_state state;
+    if (digest) {
+        ezp_digest_init(&state);
+        ezp_digest_update(&state, data, size);
+        ezp_digest_final(&state, digest);
+    }
+    if (sector_size && sector_digests) {
+        for (size_t offset = 0; offset + sector_size <= size; offset += sector_size) {
+            ezp_digest_init(&state);
+            ezp_digest_update(&state, data + offset, sector_size);
+            ezp_digest_final(&state, sector_digests++);
+        }
+    }
+}
@@ -0,0 +1,211 @@
+#include "ezp_emulator.h"
+#include "ezp_protocol.h"
+#include "ezp_pending.h"
+#include "ezp_clock.h"
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#define ERASED_BYTE 0xff
+
+/**
+ * chip_flash - flash size announced by the last COMMAND_SET_CHIP_DATA
+ * response - packet returned by the next IN transfer, when has_response is set
+ * started - COMMAND_START_TRANSACTION received, data phase not yet finished
+ * reading, writing - direction of the data phase, known from its first transfer
+ * position - flash offset of the next data transfer
+ * bus_free - monotonic time the bus becomes idle
+ * data_transfers - data phase transfers processed, for fault injection
+ * pending - ring of submitted transfers, in submission order
+ */
+typedef struct {
+    ezp_transport base;
+    ezp_emulator_config config;
+    uint8_t *flash;
+    uint32_t chip_flash;
+    usb_packet response;
+    int has_response;
+    int started;
+    int reading;
+    int writing;
+    uint32_t position;
+    double bus_free;
+    uint32_t data_transfers;
+    ezp_pending_queue pending;
+} emulator;
+
+//occupy the bus for size bytes. Returns the completion time
+static double schedule(emulator *emu, int size) {
+    double now = ezp_monotonic_seconds();
+    double start = emu->bus_free > now ? emu->bus_free : now;
+    emu->bus_free = start + (emu->config.bandwidth > 0 ? size / emu->config.bandwidth : 0);
+    return emu->bus_free + emu->config.latency;
+}
+
+//erase the part of the flash covered by the announced chip size
+static void erase_chip(emulator *emu) {
+    uint32_t size = emu->chip_flash < emu->config.flash_size ? emu->chip_flash : emu->config.flash_size;
+    memset(emu->flash, ERASED_BYTE, size);
+}
+
+static void command(emulator *emu, const usb_packet *packet) {
+    memset(&emu->response, 0, sizeof(usb_packet));
+    emu->has_response = 1;
+    switch (ntohs(packet->command)) {
+        case COMMAND_SET_CHIP_DATA:
+            emu->chip_flash = ntohl(packet->flash_size);
+            emu->response = *packet;
+            emu->started = emu->reading = emu->writing = 0;
+            break;
+        case COMMAND_START_TRANSACTION:
+            emu->started = 1;
+            emu->reading = emu->writing = 0;
+            emu->position = 0;
+            break;
+        case COMMAND_RESET:
+            emu->started = emu->reading = emu->writing = 0;
+            break;
+        case COMMAND_CHECK_CHIP: {
+            uint8_t *response = (uint8_t *) &emu->response;
+            uint32_t id = htonl(((uint32_t) emu->config.type + 1) << 24 | (emu->config.chip_id & 0xffffff));
+            uint32_t code = htonl(PROGRAMMER_CODE_EZP2023);
+            memcpy(response, &id, sizeof(id));
+            memcpy(response + 60, &code, sizeof(code));
+            break;
+        }
+        case COMMAND_START_ERASING:
+            erase_chip(emu);
+            break;
+        default: //COMMAND_ERASE and unknown commands are acknowledged only
+            break;
+    }
+}
+
+//error of the next data phase transfer, LIBUSB_SUCCESS unless it is one of the configured failures
+static int inject_failure(emulator *emu) {
+    uint32_t transfer = ++emu->data_transfers;
+    uint32_t count = emu->config.fail_count ? emu->config.fail_count : 1;
+    if (!emu->config.fail_transfer || transfer < emu->config.fail_transfer ||
+        transfer - emu->config.fail_transfer >= count)
+        return LIBUSB_SUCCESS;
+    return emu->config.fail_error ? emu->config.fail_error : LIBUSB_ERROR_IO;
+}
+
+static int process(emulator *emu, unsigned char endpoint, uint8_t *data, int size, int *actual_size) {
+    *actual_size = 0;
+    uint32_t chip_end = emu->chip_flash < emu->config.flash_size ? emu->chip_flash : emu->config.flash_size;
+    switch (endpoint) {
+        case ENDPOINT_COMMAND_OUT:
+            if (size < (int) sizeof(usb_packet)) return LIBUSB_ERROR_IO;
+            command(emu, (const usb_packet *) data);
+            break;
+        case ENDPOINT_IN:
+            if (emu->has_response) {
+                memcpy(data, &emu->response, size < (int) sizeof(usb_packet) ? size : (int) sizeof(usb_packet));
+                emu->has_response = 0;
+                if (emu->started && !emu->writing) emu->reading = 1; //start response, flash data follows
+            } else if (emu->reading) {
+                int error = inject_failure(emu);
+                if (error != LIBUSB_SUCCESS) return error;
+                uint32_t available = emu->position < chip_end ? chip_end - emu->position : 0;
+                uint32_t copied = (uint32_t) size < available ? (uint32_t) size : available;
+                memcpy(data, emu->flash + emu->position, copied);
+                memset(data + copied, ERASED_BYTE, size - copied);
+                emu->position += size;
+            } else {
+                return LIBUSB_ERROR_TIMEOUT;
+            }
+            break;
+        case ENDPOINT_DATA_OUT: {
+            if (!emu->started || emu->reading) return LIBUSB_ERROR_PIPE;
+            int error = inject_failure(emu);
+            if (error != LIBUSB_SUCCESS) return error;
+            if (!emu->writing) { //a write erases the whole chip first, its start has no response
+                emu->writing = 1;
+                emu->has_response = 0;
+                erase_chip(emu);
+            }
+            if (emu->position < chip_end) {
+                uint32_t available = chip_end - emu->position;
+                memcpy(emu->flash + emu->position, data, (uint32_t) size < available ? (uint32_t) size : available);
+            }
+            emu->position += size;
+            break;
+        }
+        default:
+            return LIBUSB_ERROR_PIPE;
+    }
+    *actual_size = size;
+    return LIBUSB_SUCCESS;
+}
+
+static int emulator_transfer(ezp_transport *transport, unsigned char endpoint, uint8_t *data, int size,
+                             int *actual_size, unsigned int timeout) {
+    (void) timeout;
+    emulator *emu = (emulator *) transport;
+    ezp_sleep_until(schedule(emu, size));
+    return process(emu, endpoint, data, size, actual_size);
+}
+
+static int emulator_submit(ezp_transport *transport, struct libusb_transfer *transfer) {
+    emulator *emu = (emulator *) transport;
+    ezp_pending_transfer *slot = ezp_pending_push(&emu->pending, transfer);
+    if (!slot) return LIBUSB_ERROR_NO_MEM;
+    slot->due = schedule(emu, transfer->length);
+    return LIBUSB_SUCCESS;
+}
+
+static int emulator_cancel(ezp_transport *transport, struct libusb_transfer *transfer) {
+    emulator *emu = (emulator *) transport;
+    ezp_pending_transfer *slot = ezp_pending_find(&emu->pending, transfer);
+    if (!slot) return LIBUSB_ERROR_NOT_FOUND;
+    slot->cancelled = 1;
+    return LIBUSB_SUCCESS;
+}
+
+//the device acts on a transfer once it is due, so a cancelled one has no effect
+static int emulator_complete(ezp_transport *transport, ezp_pending_transfer *pending) {
+    struct libusb_transfer *transfer = pending->transfer;
+    return process((emulator *) transport, transfer->endpoint, transfer->buffer, transfer->length,
+                   &transfer->actual_length);
+}
+
+static int emulator_handle_events(ezp_transport *transport, struct timeval *timeout, int *completed) {
+    emulator *emu = (emulator *) transport;
+    return ezp_pending_handle_events(&emu->pending, transport, emulator_complete, timeout, completed);
+}
+
+static void emulator_close(ezp_transport *transport) {
+    emulator *emu = (emulator *) transport;
+    ezp_pending_free(&emu->pending);
+    free(emu->flash);
+    free(emu);
+}
+
+ezp_programmer *ezp_emulator_new(const ezp_emulator_config *config) {
+    emulator *emu = calloc(1, sizeof(emulator));
+    if (!emu) return NULL;
+    emu->base = (ezp_transport) {
+            .transfer = emulator_transfer,
+            .submit = emulator_submit,
+            .cancel = emulator_cancel,
+            .handle_events = emulator_handle_events,
+            .close = emulator_close
+    };
+    emu->config = *config;
+    emu->flash = malloc(config->flash_size ? config->flash_size : 1);
+    if (!emu->flash) {
+        free(emu);
+        return NULL;
+    }
+    memset(emu->flash, ERASED_BYTE, config->flash_size);
+
+    ezp_programmer *programmer = ezp_programmer_new(NULL, &emu->base);
+    if (!programmer) emulator_close(&emu->base);
+    return programmer;
+}
+
+uint8_t *ezp_emulator_flash(ezp_programmer *programmer) {
+    if (programmer->transport->transfer != emulator_transfer) return NULL;
+    return ((emulator *) programmer->transport)->flash;
+}
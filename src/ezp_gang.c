@@ -0,0 +1,126 @@
+#include "ezp_gang.h"
+#include "ezp_errors.h"
+#include "ezp_kernels.h"
+#include "ezp_clock.h"
+#include <stdlib.h>
+
+#define GANG_WAIT_USEC 1000 //longest wait for one programmer while the others may have work
+
+typedef enum {
+    GANG_WRITE,
+    GANG_VERIFY,
+    GANG_DONE
+} gang_stage;
+
+/**
+ * op - operation of the current stage, NULL once done
+ * readback - contents read back for the verify
+ * events - completions seen by the callbacks, so the loop knows when it made progress
+ */
+typedef struct {
+    ezp_programmer *programmer;
+    gang_stage stage;
+    ezp_async *op;
+    int result;
+    uint8_t *readback;
+    double started;
+    unsigned int *events;
+} gang_device;
+
+static void gang_progress(uint32_t current, uint32_t max, void *user_data) {
+    (void) current;
+    (void) max;
+    gang_device *device = user_data;
+    ++*device->events;
+}
+
+static void gang_done(ezp_async *op, int result, void *user_data) {
+    (void) op;
+    gang_device *device = user_data;
+    device->result = result;
+    ++*device->events;
+}
+
+//the current stage of a device finished, start the next one
+static void gang_advance(gang_device *device, const uint8_t *data, ezp_chip_data *chip_data, ezp_speed speed,
+                         int verify, ezp_gang_result *result) {
+    ezp_async_free(device->op);
+    device->op = NULL;
+    int ret = device->result;
+    if (ret == EZP_OK && device->stage == GANG_WRITE) {
+        result->write_throughput = ezp_get_throughput(device->programmer);
+        if (verify) {
+            device->readback = malloc(chip_data->flash);
+            if (!device->readback) ret = EZP_OUT_OF_MEMORY;
+            else ret = ezp_read_flash_async(device->programmer, device->readback, chip_data, speed, gang_progress,
+                                            gang_done, device, &device->op);
+            if (ret == EZP_OK) {
+                device->stage = GANG_VERIFY;
+                return;
+            }
+        }
+    } else if (ret == EZP_OK && device->stage == GANG_VERIFY) {
+        if (ezp_mismatch(device->readback, data, chip_data->flash) != chip_data->flash) ret = EZP_VERIFY_FAILED;
+        else result->verify_throughput = ezp_get_throughput(device->programmer);
+    }
+    free(device->readback);
+    device->readback = NULL;
+    device->stage = GANG_DONE;
+    result->status = ret;
+    result->seconds = ezp_monotonic_seconds() - device->started;
+}
+
+int ezp_gang_write(ezp_programmer **programmers, int count, const uint8_t *data, ezp_chip_data *chip_data,
+                   ezp_speed speed, int verify, ezp_gang_result *results) {
+    if (count <= 0) return EZP_OK;
+    gang_device *devices = calloc(count, sizeof(gang_device));
+    if (!devices) return EZP_OUT_OF_MEMORY;
+
+    unsigned int events = 0;
+    int active = 0;
+    for (int i = 0; i < count; ++i) {
+        results[i] = (ezp_gang_result) {0};
+        devices[i] = (gang_device) {
+                .programmer = programmers[i],
+                .started = ezp_monotonic_seconds(),
+                .events = &events
+        };
+        devices[i].result = ezp_write_flash_async(programmers[i], data, chip_data, speed, gang_progress,
+                                                  gang_done, &devices[i], &devices[i].op);
+        if (devices[i].result != EZP_OK) gang_advance(&devices[i], data, chip_data, speed, verify, &results[i]);
+        else active++;
+    }
+
+    //one thread drives every programmer. Events are polled on all of them, and only when none made
+    //progress the loop waits, on each programmer in turn, so no device sits idle behind another one
+    int waiting = 0;
+    while (active > 0) {
+        unsigned int seen = events;
+        for (int i = 0; i < count; ++i) {
+            gang_device *device = &devices[i];
+            if (device->stage == GANG_DONE) continue;
+            ezp_programmer_handle_events(device->programmer);
+            if (!ezp_async_finished(device->op)) continue;
+            gang_advance(device, data, chip_data, speed, verify, &results[i]);
+            if (device->stage == GANG_DONE) active--;
+        }
+        if (active == 0 || events != seen) continue;
+
+        for (int i = 0; i < count; ++i) {
+            gang_device *device = &devices[(waiting + i) % count];
+            if (device->stage == GANG_DONE) continue;
+            struct timeval wait = {0, GANG_WAIT_USEC};
+            ezp_transport *transport = device->programmer->transport;
+            transport->handle_events(transport, &wait, NULL);
+            waiting = (waiting + i + 1) % count;
+            break;
+        }
+    }
+
+    int ret = EZP_OK;
+    for (int i = 0; i < count; ++i) {
+        if (ret == EZP_OK) ret = results[i].status;
+    }
+    free(devices);
+    return ret;
+}
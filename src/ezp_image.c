@@ -0,0 +1,259 @@
+#include "ezp_image.h"
+#include "ezp_errors.h"
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/**
+ * map - mapping of a raw binary, its only segment points into it
+ * arena - decoded bytes of a HEX or S-record file, segments point into it. Sized for the whole file
+ *         up front, so it never moves while segments are added
+ * used - arena bytes used
+ */
+struct ezp_image {
+    void *map;
+    size_t map_size;
+    uint8_t *arena;
+    size_t used;
+    ezp_segment *segments;
+    size_t count;
+    size_t capacity;
+};
+
+//hex digit values plus one, 0 for anything else
+static const uint8_t hex_table[256] = {
+        ['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5, ['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+        ['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16,
+        ['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16
+};
+
+static int decode_hex(const uint8_t *text, size_t size, uint8_t *out) {
+    for (size_t i = 0; i < size; ++i) {
+        uint8_t high = hex_table[text[2 * i]];
+        uint8_t low = hex_table[text[2 * i + 1]];
+        if (!high || !low) return 0;
+        out[i] = (uint8_t) ((high - 1) << 4 | (low - 1));
+    }
+    return 1;
+}
+
+static uint8_t record_sum(const uint8_t *record, size_t size) {
+    uint8_t sum = 0;
+    for (size_t i = 0; i < size; ++i) sum += record[i];
+    return sum;
+}
+
+static int add_data(ezp_image *image, uint64_t address, const uint8_t *data, uint32_t length) {
+    if (length == 0) return EZP_OK;
+    if (address + length > (uint64_t) UINT32_MAX + 1) return EZP_ERROR_INVALID_FILE;
+    uint8_t *dest = image->arena + image->used;
+    memcpy(dest, data, length);
+    image->used += length;
+
+    //bytes of the last segment end where the new ones start, so a continuing record just extends it
+    if (image->count > 0) {
+        ezp_segment *last = &image->segments[image->count - 1];
+        if ((uint64_t) last->offset + last->length == address) {
+            last->length += length;
+            return EZP_OK;
+        }
+    }
+    if (image->count == image->capacity) {
+        size_t capacity = image->capacity ? image->capacity * 2 : 16;
+        ezp_segment *segments = realloc(image->segments, capacity * sizeof(ezp_segment));
+        if (!segments) return EZP_OUT_OF_MEMORY;
+        image->segments = segments;
+        image->capacity = capacity;
+    }
+    image->segments[image->count++] = (ezp_segment) {
+            .offset = address,
+            .length = length,
+            .data = dest
+    };
+    return EZP_OK;
+}
+
+//split off the next record, leading and trailing whitespace removed. Returns 0 at the end of the text
+static int next_record(const uint8_t **text, const uint8_t *end, const uint8_t **record, size_t *size) {
+    while (*text < end && isspace(**text)) ++*text;
+    if (*text == end) return 0;
+    const uint8_t *line_end = memchr(*text, '\n', end - *text);
+    if (!line_end) line_end = end;
+    *record = *text;
+    *text = line_end;
+    while (line_end > *record && isspace(line_end[-1])) --line_end;
+    *size = line_end - *record;
+    return 1;
+}
+
+static int parse_ihex(ezp_image *image, const uint8_t *text, size_t size) {
+    const uint8_t *end = text + size;
+    const uint8_t *line;
+    size_t length;
+    uint8_t record[5 + 255];
+    uint32_t base = 0;
+    while (next_record(&text, end, &line, &length)) {
+        //:LLAAAATT, data, checksum
+        if (line[0] != ':' || length < 11 || (length - 1) % 2 != 0 || (length - 1) / 2 > sizeof(record))
+            return EZP_ERROR_INVALID_FILE;
+        size_t bytes = (length - 1) / 2;
+        if (!decode_hex(line + 1, bytes, record) || record[0] + 5u != bytes || record_sum(record, bytes) != 0)
+            return EZP_ERROR_INVALID_FILE;
+
+        uint32_t address = record[1] << 8 | record[2];
+        int ret = EZP_OK;
+        switch (record[3]) {
+            case 0x00: //data
+                ret = add_data(image, (uint64_t) base + address, record + 4, record[0]);
+                break;
+            case 0x01: //end of file
+                return EZP_OK;
+            case 0x02: //extended segment address
+                if (record[0] != 2) return EZP_ERROR_INVALID_FILE;
+                base = (uint32_t) (record[4] << 8 | record[5]) << 4;
+                break;
+            case 0x04: //extended linear address
+                if (record[0] != 2) return EZP_ERROR_INVALID_FILE;
+                base = (uint32_t) (record[4] << 8 | record[5]) << 16;
+                break;
+            case 0x03:
+            case 0x05: //start address, meaningless for a flash image
+                break;
+            default:
+                return EZP_ERROR_INVALID_FILE;
+        }
+        if (ret != EZP_OK) return ret;
+    }
+    return EZP_OK;
+}
+
+static int parse_srec(ezp_image *image, const uint8_t *text, size_t size) {
+    //address bytes of S0 to S9, 0 for the unused S4
+    static const uint8_t address_sizes[10] = {2, 2, 3, 4, 0, 2, 3, 4, 3, 2};
+    const uint8_t *end = text + size;
+    const uint8_t *line;
+    size_t length;
+    uint8_t record[1 + 255];
+    while (next_record(&text, end, &line, &length)) {
+        //Stcc, address, data, checksum
+        if (line[0] != 'S' || length < 4 || (length - 2) % 2 != 0 || (length - 2) / 2 > sizeof(record))
+            return EZP_ERROR_INVALID_FILE;
+        unsigned int type = line[1] - '0';
+        if (type > 9 || address_sizes[type] == 0) return EZP_ERROR_INVALID_FILE;
+        size_t bytes = (length - 2) / 2;
+        if (!decode_hex(line + 2, bytes, record) || record[0] + 1u != bytes || record[0] < address_sizes[type] + 1 ||
+            record_sum(record, bytes) != 0xFF)
+            return EZP_ERROR_INVALID_FILE;
+
+        if (type >= 7) return EZP_OK; //termination
+        if (type == 0 || type >= 5) continue; //header and record counts
+        uint32_t address = 0;
+        for (unsigned int i = 0; i < address_sizes[type]; ++i) address = address << 8 | record[1 + i];
+        int ret = add_data(image, address, record + 1 + address_sizes[type], record[0] - address_sizes[type] - 1);
+        if (ret != EZP_OK) return ret;
+    }
+    return EZP_OK;
+}
+
+static int compare_segments(const void *a, const void *b) {
+    const ezp_segment *first = a, *second = b;
+    return (first->offset > second->offset) - (first->offset < second->offset);
+}
+
+//records may come in any order, but must not overlap
+static int sort_segments(ezp_image *image) {
+    qsort(image->segments, image->count, sizeof(ezp_segment), compare_segments);
+    for (size_t i = 1; i < image->count; ++i) {
+        if ((uint64_t) image->segments[i - 1].offset + image->segments[i - 1].length > image->segments[i].offset)
+            return EZP_ERROR_INVALID_FILE;
+    }
+    return EZP_OK;
+}
+
+static ezp_image_format detect_format(const uint8_t *text, size_t size) {
+    size_t i = 0;
+    while (i < size && isspace(text[i])) ++i;
+    if (i < size && text[i] == ':') return EZP_IMAGE_IHEX;
+    if (i + 1 < size && text[i] == 'S' && isdigit(text[i + 1])) return EZP_IMAGE_SREC;
+    return EZP_IMAGE_BINARY;
+}
+
+int ezp_image_open(ezp_image **image, const char *file, ezp_image_format format) {
+    int fd = open(file, O_RDONLY);
+    if (fd < 0) return EZP_ERROR_IO;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return EZP_ERROR_IO;
+    }
+    size_t size = st.st_size;
+    uint8_t *map = NULL;
+    if (size > 0) {
+        map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            close(fd);
+            return EZP_ERROR_IO;
+        }
+        madvise(map, size, MADV_SEQUENTIAL);
+    }
+    close(fd);
+
+    ezp_image *result = calloc(1, sizeof(ezp_image));
+    if (!result) {
+        if (map) munmap(map, size);
+        return EZP_OUT_OF_MEMORY;
+    }
+    if (format == EZP_IMAGE_AUTO) format = detect_format(map, size);
+
+    int ret = EZP_OK;
+    if (format == EZP_IMAGE_BINARY) {
+        //the mapping is the image, nothing is copied
+        result->map = map;
+        result->map_size = size;
+        if (size > UINT32_MAX) {
+            ret = EZP_ERROR_INVALID_FILE;
+        } else if (size > 0) {
+            result->segments = malloc(sizeof(ezp_segment));
+            if (!result->segments) ret = EZP_OUT_OF_MEMORY;
+            else result->segments[result->count++] = (ezp_segment) {.offset = 0, .length = size, .data = map};
+        }
+    } else {
+        //every data byte takes two hex digits, so half the text holds all of them
+        result->arena = malloc(size / 2 + 1);
+        if (!result->arena) ret = EZP_OUT_OF_MEMORY;
+        else if (format == EZP_IMAGE_IHEX) ret = parse_ihex(result, map, size);
+        else ret = parse_srec(result, map, size);
+        if (ret == EZP_OK) ret = sort_segments(result);
+        if (map) munmap(map, size);
+    }
+
+    if (ret != EZP_OK) {
+        ezp_image_close(result);
+        return ret;
+    }
+    *image = result;
+    return EZP_OK;
+}
+
+void ezp_image_close(ezp_image *image) {
+    if (!image) return;
+    if (image->map) munmap(image->map, image->map_size);
+    free(image->arena);
+    free(image->segments);
+    free(image);
+}
+
+const ezp_segment *ezp_image_segments(const ezp_image *image, size_t *count) {
+    *count = image->count;
+    return image->segments;
+}
+
+uint32_t ezp_image_end(const ezp_image *image) {
+    if (image->count == 0) return 0;
+    const ezp_segment *last = &image->segments[image->count - 1];
+    return last->offset + last->length;
+}
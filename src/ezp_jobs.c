@@ -0,0 +1,273 @@
+#include "ezp_jobs.h"
+#include "ezp_errors.h"
+#include "ezp_kernels.h"
+#include "ezp_clock.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/**
+ * image - image to write or verify, mapped from file or the caller's data
+ * size - image size
+ * mapped - image is a mapping to be released when the job is finished
+ * read - image of a read
+ */
+typedef struct {
+    const uint8_t *image;
+    size_t size;
+    int mapped;
+    uint8_t *read;
+} job_state;
+
+/**
+ * prepared - jobs below are prepared by the worker
+ * current - job running on the programmer
+ * finished - jobs below are handed to the worker to be finished
+ */
+typedef struct {
+    ezp_job *jobs;
+    job_state *states;
+    size_t count;
+    ezp_job_callback done;
+    void *user_data;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    size_t prepared;
+    size_t current;
+    size_t finished;
+} job_queue;
+
+static int map_image(const char *file, job_state *state) {
+    int fd = open(file, O_RDONLY);
+    if (fd < 0) return EZP_ERROR_IO;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0 || st.st_size > UINT32_MAX) {
+        close(fd);
+        return EZP_ERROR_INVALID_FILE;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return EZP_ERROR_IO;
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    state->image = map;
+    state->size = st.st_size;
+    state->mapped = 1;
+    return EZP_OK;
+}
+
+static uint32_t blank_tail(const uint8_t *data, size_t size) {
+    size_t end = size;
+    while (end >= EZP_STREAM_CHUNK_SIZE &&
+           ezp_fill_span(data + end - EZP_STREAM_CHUNK_SIZE, EZP_STREAM_CHUNK_SIZE, 0xFF) == EZP_STREAM_CHUNK_SIZE)
+        end -= EZP_STREAM_CHUNK_SIZE;
+    while (end > 0 && data[end - 1] == 0xFF) --end;
+    return size - end;
+}
+
+//runs on the worker while the previous job is on the programmer; the digest pass also faults the mapping in
+static void prepare_job(ezp_job *job, job_state *state) {
+    double started = ezp_monotonic_seconds();
+    if (job->type == EZP_JOB_WRITE || job->type == EZP_JOB_VERIFY) {
+        if (job->file) {
+            job->status = map_image(job->file, state);
+        } else {
+            state->image = job->data;
+            state->size = job->chip_data.flash;
+        }
+        if (job->status == EZP_OK) {
+            ezp_digest_image(state->image, state->size, &job->digest, 0, NULL);
+            job->blank_tail = blank_tail(state->image, state->size);
+        }
+    }
+    job->stage_seconds[EZP_JOB_STAGE_PREPARE] = ezp_monotonic_seconds() - started;
+}
+
+static int save_image(const char *file, const uint8_t *data, uint32_t size) {
+    FILE *f = fopen(file, "wb");
+    if (!f) return EZP_ERROR_IO;
+    int failed = fwrite(data, 1, size, f) != size;
+    if (fclose(f) != 0) failed = 1;
+    return failed ? EZP_ERROR_IO : EZP_OK;
+}
+
+static void finish_job(job_queue *queue, size_t index) {
+    ezp_job *job = &queue->jobs[index];
+    job_state *state = &queue->states[index];
+    double started = ezp_monotonic_seconds();
+    if (state->mapped) munmap((void *) state->image, state->size);
+    if (state->read) {
+        if (job->file) {
+            if (job->status == EZP_OK) job->status = save_image(job->file, state->read, job->chip_data.flash);
+            free(state->read);
+        } else if (job->status == EZP_OK) {
+            job->image = state->read;
+        } else {
+            free(state->read);
+        }
+    }
+    job->stage_seconds[EZP_JOB_STAGE_FINISH] = ezp_monotonic_seconds() - started;
+    if (queue->done) queue->done(job, queue->user_data);
+}
+
+//prepares one job ahead of the programmer, and finishes jobs in order once the programmer is done with them
+static void *job_worker_run(void *arg) {
+    job_queue *queue = arg;
+    size_t finish = 0;
+    pthread_mutex_lock(&queue->lock);
+    while (finish < queue->count) {
+        if (queue->prepared < queue->count && queue->prepared <= queue->current + 1) {
+            size_t index = queue->prepared;
+            pthread_mutex_unlock(&queue->lock);
+            prepare_job(&queue->jobs[index], &queue->states[index]);
+            pthread_mutex_lock(&queue->lock);
+            queue->prepared = index + 1;
+            pthread_cond_broadcast(&queue->cond);
+        } else if (finish < queue->finished) {
+            pthread_mutex_unlock(&queue->lock);
+            finish_job(queue, finish++);
+            pthread_mutex_lock(&queue->lock);
+        } else {
+            pthread_cond_wait(&queue->cond, &queue->lock);
+        }
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return NULL;
+}
+
+static int detect_chip(ezp_programmer *programmer, ezp_job *job, const ezp_chips_db *db) {
+    ezp_flash type;
+    uint32_t chip_id;
+    int ret = ezp_test_flash(programmer, &type, &chip_id);
+    if (ret != EZP_OK) return ret;
+    if (!db) return chip_id == job->chip_data.chip_id ? EZP_OK : EZP_FLASH_NOT_DETECTED;
+
+    //ids are shared by several parts, so the caller's chip data is kept when it is one of them
+    size_t count = ezp_chips_db_find_by_id(db, chip_id, NULL, 0);
+    if (count == 0) return EZP_FLASH_NOT_DETECTED;
+    uint32_t *matches = malloc(count * sizeof(uint32_t));
+    if (!matches) return EZP_OUT_OF_MEMORY;
+    ezp_chips_db_find_by_id(db, chip_id, matches, count);
+    ezp_chip_data entry;
+    for (size_t i = 0; i < count; ++i) {
+        ret = ezp_chips_db_get(db, matches[i], &entry);
+        if (ret != EZP_OK) break;
+        if (strncmp(entry.name, job->chip_data.name, sizeof(entry.name)) == 0) {
+            free(matches);
+            return EZP_OK;
+        }
+    }
+    free(matches);
+    if (ret != EZP_OK) return ret;
+    if (count > 1) return EZP_CHIP_AMBIGUOUS;
+    job->chip_data = entry;
+    return EZP_OK;
+}
+
+static int run_job(ezp_programmer *programmer, ezp_job *job, job_state *state, const ezp_chips_db *db,
+                   ezp_callback callback, void *user_data) {
+    double started = ezp_monotonic_seconds();
+    if (job->detect) {
+        int ret = detect_chip(programmer, job, db);
+        job->stage_seconds[EZP_JOB_STAGE_DETECT] = ezp_monotonic_seconds() - started;
+        if (ret != EZP_OK) return ret;
+    }
+    if (state->image && state->size != job->chip_data.flash)
+        return state->mapped ? EZP_ERROR_INVALID_FILE : EZP_FLASH_SIZE_OR_PAGE_INVALID;
+
+    int ret = EZP_OK;
+    started = ezp_monotonic_seconds();
+    switch (job->type) {
+        case EZP_JOB_READ:
+            state->read = malloc(job->chip_data.flash ? job->chip_data.flash : 1);
+            if (!state->read) return EZP_OUT_OF_MEMORY;
+            ret = ezp_read_flash_digest(programmer, state->read, &job->chip_data, job->speed, &job->digest, 0, NULL,
+                                        callback, user_data);
+            break;
+        case EZP_JOB_WRITE:
+            //every write erases the chip first, so a blank image needs no data transfer at all
+            if (job->blank_tail == state->size)
+                ret = ezp_erase_flash(programmer, &job->chip_data, job->speed, EZP_ERASE_CHIP, 0, 0, 0,
+                                      callback, user_data);
+            else
+                ret = ezp_write_flash(programmer, state->image, &job->chip_data, job->speed, callback, user_data);
+            break;
+        case EZP_JOB_VERIFY:
+            ret = ezp_verify_flash(programmer, state->image, &job->chip_data, job->speed, NULL, NULL, 0,
+                                   callback, user_data);
+            break;
+        case EZP_JOB_ERASE:
+            ret = ezp_erase_flash(programmer, &job->chip_data, job->speed, EZP_ERASE_CHIP, 0, 0, 0,
+                                  callback, user_data);
+            break;
+    }
+    job->stage_seconds[EZP_JOB_STAGE_TRANSFER] = ezp_monotonic_seconds() - started;
+
+    if (ret == EZP_OK && job->type == EZP_JOB_WRITE && job->verify) {
+        started = ezp_monotonic_seconds();
+        ret = ezp_verify_flash(programmer, state->image, &job->chip_data, job->speed, NULL, NULL, 0,
+                               callback, user_data);
+        job->stage_seconds[EZP_JOB_STAGE_VERIFY] = ezp_monotonic_seconds() - started;
+    }
+    return ret;
+}
+
+int ezp_run_jobs(ezp_programmer *programmer, ezp_job *jobs, size_t count, const ezp_chips_db *db,
+                 ezp_callback callback, ezp_job_callback done, void *user_data) {
+    if (count == 0) return EZP_OK;
+    job_queue queue = {
+            .jobs = jobs,
+            .count = count,
+            .done = done,
+            .user_data = user_data
+    };
+    queue.states = calloc(count, sizeof(job_state));
+    if (!queue.states) return EZP_OUT_OF_MEMORY;
+    for (size_t i = 0; i < count; ++i) {
+        jobs[i].image = NULL;
+        jobs[i].status = EZP_OK;
+        jobs[i].digest = (ezp_digest) {0};
+        jobs[i].blank_tail = 0;
+        for (int stage = 0; stage < EZP_JOB_STAGE_COUNT; ++stage) jobs[i].stage_seconds[stage] = 0;
+    }
+
+    pthread_mutex_init(&queue.lock, NULL);
+    pthread_cond_init(&queue.cond, NULL);
+    pthread_t worker;
+    if (pthread_create(&worker, NULL, job_worker_run, &queue) != 0) {
+        pthread_cond_destroy(&queue.cond);
+        pthread_mutex_destroy(&queue.lock);
+        free(queue.states);
+        return EZP_OUT_OF_MEMORY;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        double started = ezp_monotonic_seconds();
+        pthread_mutex_lock(&queue.lock);
+        queue.current = i;
+        pthread_cond_broadcast(&queue.cond);
+        while (queue.prepared <= i) pthread_cond_wait(&queue.cond, &queue.lock);
+        pthread_mutex_unlock(&queue.lock);
+        jobs[i].stage_seconds[EZP_JOB_STAGE_WAIT] = ezp_monotonic_seconds() - started;
+
+        if (jobs[i].status == EZP_OK)
+            jobs[i].status = run_job(programmer, &jobs[i], &queue.states[i], db, callback, user_data);
+
+        pthread_mutex_lock(&queue.lock);
+        queue.finished = i + 1;
+        pthread_cond_broadcast(&queue.cond);
+        pthread_mutex_unlock(&queue.lock);
+    }
+    pthread_join(worker, NULL);
+
+    int ret = EZP_OK;
+    for (size_t i = 0; i < count && ret == EZP_OK; ++i) ret = jobs[i].status;
+    pthread_cond_destroy(&queue.cond);
+    pthread_mutex_destroy(&queue.lock);
+    free(queue.states);
+    return ret;
+}
@@ -0,0 +1,346 @@
+#include "ezp_kernels.h"
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define KERNELS_X86
+#endif
+
+#if defined(__aarch64__) && defined(__linux__)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#define KERNELS_ARM64
+#endif
+
+#define CRC32_POLY 0xedb88320
+
+typedef size_t (*compare_kernel)(const uint8_t *a, const uint8_t *b, size_t size);
+typedef size_t (*fill_kernel)(const uint8_t *data, size_t size, uint8_t value);
+typedef uint32_t (*crc_kernel)(uint32_t crc, const uint8_t *data, size_t size);
+
+//slicing-by-8 tables, built at load time
+static uint32_t crc_table[8][256];
+
+static size_t mismatch_scalar(const uint8_t *a, const uint8_t *b, size_t size) {
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t wa, wb;
+        memcpy(&wa, a + i, 8);
+        memcpy(&wb, b + i, 8);
+        if (wa != wb) break;
+    }
+    for (; i < size; ++i) {
+        if (a[i] != b[i]) return i;
+    }
+    return size;
+}
+
+static size_t match_scalar(const uint8_t *a, const uint8_t *b, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        if (a[i] == b[i]) return i;
+    }
+    return size;
+}
+
+static size_t fill_span_scalar(const uint8_t *data, size_t size, uint8_t value) {
+    uint64_t pattern = 0x0101010101010101ULL * value;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        if (word != pattern) break;
+    }
+    for (; i < size; ++i) {
+        if (data[i] != value) return i;
+    }
+    return size;
+}
+
+static uint32_t crc32_table(uint32_t crc, const uint8_t *data, size_t size) {
+    while (size >= 8) {
+        uint32_t lo = crc ^ ((uint32_t) data[0] | (uint32_t) data[1] << 8 | (uint32_t) data[2] << 16 |
+                             (uint32_t) data[3] << 24);
+        crc = crc_table[7][lo & 0xff] ^ crc_table[6][(lo >> 8) & 0xff] ^
+              crc_table[5][(lo >> 16) & 0xff] ^ crc_table[4][lo >> 24] ^
+              crc_table[3][data[4]] ^ crc_table[2][data[5]] ^
+              crc_table[1][data[6]] ^ crc_table[0][data[7]];
+        data += 8;
+        size -= 8;
+    }
+    while (size--) crc = crc_table[0][(crc ^ *data++) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+static void crc_table_init() {
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; ++bit) crc = crc & 1 ? (crc >> 1) ^ CRC32_POLY : crc >> 1;
+        crc_table[0][i] = crc;
+    }
+    for (uint32_t i = 0; i < 256; ++i) {
+        for (int t = 1; t < 8; ++t) {
+            crc_table[t][i] = crc_table[0][crc_table[t - 1][i] & 0xff] ^ (crc_table[t - 1][i] >> 8);
+        }
+    }
+}
+
+#ifdef KERNELS_X86
+
+//carry-less multiplication folding, after Intel's "Fast CRC Computation for Generic Polynomials Using
+//PCLMULQDQ Instruction". Folds 64 bytes per iteration, the tail shorter than 16 bytes goes to the table
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t crc32_pclmul(uint32_t crc, const uint8_t *data, size_t size) {
+    if (size < 64) return crc32_table(crc, data, size);
+
+    const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);
+    const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+    const __m128i k5k0 = _mm_set_epi64x(0x0000000000, 0x0163cd6124);
+    const __m128i poly = _mm_set_epi64x(0x01f7011641, 0x01db710641);
+    const __m128i mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+
+    __m128i x1 = _mm_loadu_si128((const __m128i *) (data + 0x00));
+    __m128i x2 = _mm_loadu_si128((const __m128i *) (data + 0x10));
+    __m128i x3 = _mm_loadu_si128((const __m128i *) (data + 0x20));
+    __m128i x4 = _mm_loadu_si128((const __m128i *) (data + 0x30));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int) crc));
+    data += 64;
+    size -= 64;
+
+    while (size >= 64) {
+        __m128i x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+        __m128i x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+        __m128i x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+        __m128i x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i *) (data + 0x00)));
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i *) (data + 0x10)));
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i *) (data + 0x20)));
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i *) (data + 0x30)));
+        data += 64;
+        size -= 64;
+    }
+
+    //fold the four lanes into one
+    __m128i x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), x2), x5);
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), x3), x5);
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), x4), x5);
+
+    while (size >= 16) {
+        x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, _mm_loadu_si128((const __m128i *) data)), x5);
+        data += 16;
+        size -= 16;
+    }
+
+    //128 to 64 bits
+    x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, mask32);
+    x1 = _mm_xor_si128(_mm_clmulepi64_si128(x1, k5k0, 0x00), x2);
+
+    //barrett reduction to 32 bits
+    x2 = _mm_and_si128(x1, mask32);
+    x2 = _mm_clmulepi64_si128(x2, poly, 0x10);
+    x2 = _mm_and_si128(x2, mask32);
+    x2 = _mm_clmulepi64_si128(x2, poly, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    return crc32_table((uint32_t) _mm_extract_epi32(x1, 1), data, size);
+}
+
+__attribute__((target("sse2")))
+static size_t mismatch_sse2(const uint8_t *a, const uint8_t *b, size_t size) {
+    size_t i = 0;
+    //64 bytes per iteration, the exact position is only searched for once a difference is seen
+    for (; i + 64 <= size; i += 64) {
+        __m128i eq0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (a + i)),
+                                     _mm_loadu_si128((const __m128i *) (b + i)));
+        __m128i eq1 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (a + i + 16)),
+                                     _mm_loadu_si128((const __m128i *) (b + i + 16)));
+        __m128i eq2 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (a + i + 32)),
+                                     _mm_loadu_si128((const __m128i *) (b + i + 32)));
+        __m128i eq3 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (a + i + 48)),
+                                     _mm_loadu_si128((const __m128i *) (b + i + 48)));
+        __m128i eq = _mm_and_si128(_mm_and_si128(eq0, eq1), _mm_and_si128(eq2, eq3));
+        if (_mm_movemask_epi8(eq) != 0xffff) break;
+    }
+    for (; i + 16 <= size; i += 16) {
+        unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (a + i)),
+                                                             _mm_loadu_si128((const __m128i *) (b + i))));
+        if (mask != 0xffff) return i + __builtin_ctz(~mask);
+    }
+    return i + mismatch_scalar(a + i, b + i, size - i);
+}
+
+__attribute__((target("sse2")))
+static size_t match_sse2(const uint8_t *a, const uint8_t *b, size_t size) {
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (a + i)),
+                                                             _mm_loadu_si128((const __m128i *) (b + i))));
+        if (mask) return i + __builtin_ctz(mask);
+    }
+    return i + match_scalar(a + i, b + i, size - i);
+}
+
+__attribute__((target("sse2")))
+static size_t fill_span_sse2(const uint8_t *data, size_t size, uint8_t value) {
+    const __m128i pattern = _mm_set1_epi8((char) value);
+    size_t i = 0;
+    for (; i + 64 <= size; i += 64) {
+        __m128i eq0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (data + i)), pattern);
+        __m128i eq1 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (data + i + 16)), pattern);
+        __m128i eq2 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (data + i + 32)), pattern);
+        __m128i eq3 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (data + i + 48)), pattern);
+        __m128i eq = _mm_and_si128(_mm_and_si128(eq0, eq1), _mm_and_si128(eq2, eq3));
+        if (_mm_movemask_epi8(eq) != 0xffff) break;
+    }
+    for (; i + 16 <= size; i += 16) {
+        unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (data + i)), pattern));
+        if (mask != 0xffff) return i + __builtin_ctz(~mask);
+    }
+    return i + fill_span_scalar(data + i, size - i, value);
+}
+
+__attribute__((target("avx2")))
+static size_t fill_span_avx2(const uint8_t *data, size_t size, uint8_t value) {
+    const __m256i pattern = _mm256_set1_epi8((char) value);
+    size_t i = 0;
+    for (; i + 128 <= size; i += 128) {
+        __m256i eq0 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) (data + i)), pattern);
+        __m256i eq1 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) (data + i + 32)), pattern);
+        __m256i eq2 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) (data + i + 64)), pattern);
+        __m256i eq3 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) (data + i + 96)), pattern);
+        __m256i eq = _mm256_and_si256(_mm256_and_si256(eq0, eq1), _mm256_and_si256(eq2, eq3));
+        if ((uint32_t) _mm256_movemask_epi8(eq) != 0xffffffff) break;
+    }
+    for (; i + 32 <= size; i += 32) {
+        uint32_t mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) (data + i)),
+                                                               pattern));
+        if (mask != 0xffffffff) return i + __builtin_ctz(~mask);
+    }
+    return i + fill_span_sse2(data + i, size - i, value);
+}
+
+__attribute__((target("avx2")))
+static size_t mismatch_avx2(const uint8_t *a, const uint8_t *b, size_t size) {
+    size_t i = 0;
+    for (; i + 128 <= size; i += 128) {
+        __m256i eq0 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) (a + i)),
+                                        _mm256_loadu_si256((const __m256i *) (b + i)));
+        __m256i eq1 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) (a + i + 32)),
+                                        _mm256_loadu_si256((const __m256i *) (b + i + 32)));
+        __m256i eq2 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) (a + i + 64)),
+                                        _mm256_loadu_si256((const __m256i *) (b + i + 64)));
+        __m256i eq3 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) (a + i + 96)),
+                                        _mm256_loadu_si256((const __m256i *) (b + i + 96)));
+        __m256i eq = _mm256_and_si256(_mm256_and_si256(eq0, eq1), _mm256_and_si256(eq2, eq3));
+        if ((uint32_t) _mm256_movemask_epi8(eq) != 0xffffffff) break;
+    }
+    for (; i + 32 <= size; i += 32) {
+        uint32_t mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) (a + i)),
+                                                               _mm256_loadu_si256((const __m256i *) (b + i))));
+        if (mask != 0xffffffff) return i + __builtin_ctz(~mask);
+    }
+    return i + mismatch_sse2(a + i, b + i, size - i);
+}
+
+__attribute__((target("avx2")))
+static size_t match_avx2(const uint8_t *a, const uint8_t *b, size_t size) {
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        uint32_t mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) (a + i)),
+                                                               _mm256_loadu_si256((const __m256i *) (b + i))));
+        if (mask) return i + __builtin_ctz(mask);
+    }
+    return i + match_sse2(a + i, b + i, size - i);
+}
+
+#endif //KERNELS_X86
+
+#ifdef KERNELS_ARM64
+
+__attribute__((target("+crc")))
+static uint32_t crc32_armv8(uint32_t crc, const uint8_t *data, size_t size) {
+    while (size >= 8) {
+        uint64_t word;
+        memcpy(&word, data, 8);
+        crc = __crc32d(crc, word);
+        data += 8;
+        size -= 8;
+    }
+    while (size--) crc = __crc32b(crc, *data++);
+    return crc;
+}
+
+#endif //KERNELS_ARM64
+
+static compare_kernel mismatch_impl = mismatch_scalar;
+static compare_kernel match_impl = match_scalar;
+static fill_kernel fill_span_impl = fill_span_scalar;
+static crc_kernel crc_impl = crc32_table;
+static const char *kernels_isa = "scalar";
+static const char *crc_isa = "table";
+
+//pick the widest kernels the cpu supports, once, before any caller can race on them
+__attribute__((constructor))
+static void kernels_init() {
+    crc_table_init();
+#ifdef KERNELS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1")) {
+        crc_impl = crc32_pclmul;
+        crc_isa = "pclmul";
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        mismatch_impl = mismatch_avx2;
+        match_impl = match_avx2;
+        fill_span_impl = fill_span_avx2;
+        kernels_isa = "avx2";
+    } else if (__builtin_cpu_supports("sse2")) {
+        mismatch_impl = mismatch_sse2;
+        match_impl = match_sse2;
+        fill_span_impl = fill_span_sse2;
+        kernels_isa = "sse2";
+    }
+#endif
+#ifdef KERNELS_ARM64
+    if (getauxval(AT_HWCAP) & HWCAP_CRC32) {
+        crc_impl = crc32_armv8;
+        crc_isa = "armv8-crc";
+    }
+#endif
+}
+
+size_t ezp_mismatch(const uint8_t *a, const uint8_t *b, size_t size) {
+    return mismatch_impl(a, b, size);
+}
+
+size_t ezp_match(const uint8_t *a, const uint8_t *b, size_t size) {
+    return match_impl(a, b, size);
+}
+
+size_t ezp_fill_span(const uint8_t *data, size_t size, uint8_t value) {
+    return fill_span_impl(data, size, value);
+}
+
+uint32_t ezp_crc32_update(uint32_t crc, const uint8_t *data, size_t size) {
+    return crc_impl(crc, data, size);
+}
+
+const char *ezp_kernels_isa() {
+    return kernels_isa;
+}
+
+const char *ezp_crc32_isa() {
+    return crc_isa;
+}
@@ -0,0 +1,56 @@
+#ifndef LIBEZP2023PLUS_EZP_KERNELS_H
+#define LIBEZP2023PLUS_EZP_KERNELS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Find the first differing byte of two buffers
+ * @param a
+ * @param b
+ * @param size bytes to compare
+ * @return offset of the first differing byte, or size if the buffers are equal
+ */
+size_t ezp_mismatch(const uint8_t *a, const uint8_t *b, size_t size);
+
+/**
+ * Find the first equal byte of two buffers
+ * @param a
+ * @param b
+ * @param size bytes to compare
+ * @return offset of the first equal byte, or size if all bytes differ
+ */
+size_t ezp_match(const uint8_t *a, const uint8_t *b, size_t size);
+
+/**
+ * Measure the run of a byte value at the start of a buffer
+ * @param data
+ * @param size
+ * @param value byte value, e.g. 0xff for erased NOR flash
+ * @return length of the leading run of value, size if the whole buffer holds value
+ */
+size_t ezp_fill_span(const uint8_t *data, size_t size, uint8_t value);
+
+/**
+ * Update a CRC-32 (IEEE 802.3, reflected) register. The register is not inverted before or after,
+ * callers start from 0xffffffff and invert the final value
+ * @param crc current register value
+ * @param data
+ * @param size
+ * @return new register value
+ */
+uint32_t ezp_crc32_update(uint32_t crc, const uint8_t *data, size_t size);
+
+/**
+ * Name of the instruction set selected at runtime for the kernels
+ * @return "avx2", "sse2" or "scalar"
+ */
+const char *ezp_kernels_isa();
+
+/**
+ * Name of the CRC-32 implementation selected at runtime
+ * @return "pclmul", "armv8-crc" or "table"
+ */
+const char *ezp_crc32_isa();
+
+#endif //LIBEZP2023PLUS_EZP_KERNELS_H
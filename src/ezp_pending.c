@@ -0,0 +1,85 @@
+#include "ezp_pending.h"
+#include "ezp_clock.h"
+#include <stdlib.h>
+#include <math.h>
+
+ezp_pending_transfer *ezp_pending_push(ezp_pending_queue *queue, struct libusb_transfer *transfer) {
+    if (queue->count == queue->capacity) {
+        size_t capacity = queue->capacity ? queue->capacity * 2 : 16;
+        ezp_pending_transfer *slots = malloc(capacity * sizeof(ezp_pending_transfer));
+        if (!slots) return NULL;
+        for (size_t i = 0; i < queue->count; ++i) {
+            slots[i] = queue->slots[(queue->head + i) % queue->capacity];
+        }
+        free(queue->slots);
+        queue->slots = slots;
+        queue->head = 0;
+        queue->capacity = capacity;
+    }
+    ezp_pending_transfer *slot = &queue->slots[(queue->head + queue->count++) % queue->capacity];
+    *slot = (ezp_pending_transfer) {.transfer = transfer};
+    return slot;
+}
+
+ezp_pending_transfer *ezp_pending_find(ezp_pending_queue *queue, const struct libusb_transfer *transfer) {
+    for (size_t i = 0; i < queue->count; ++i) {
+        ezp_pending_transfer *slot = &queue->slots[(queue->head + i) % queue->capacity];
+        if (slot->transfer == transfer && !slot->cancelled) return slot;
+    }
+    return NULL;
+}
+
+int ezp_pending_handle_events(ezp_pending_queue *queue, ezp_transport *transport, ezp_pending_complete complete,
+                              struct timeval *timeout, int *completed) {
+    double deadline = timeout ? ezp_monotonic_seconds() + (double) timeout->tv_sec + (double) timeout->tv_usec / 1e6
+                              : INFINITY;
+    int handled = 0;
+    while (queue->count > 0 && !(completed && *completed)) {
+        ezp_pending_transfer slot = queue->slots[queue->head];
+        if (slot.due > ezp_monotonic_seconds()) {
+            if (handled) break; //like libusb, return once something happened
+            if (slot.due > deadline) {
+                ezp_sleep_until(deadline);
+                break;
+            }
+            ezp_sleep_until(slot.due);
+        }
+        queue->head = (queue->head + 1) % queue->capacity;
+        queue->count--;
+
+        struct libusb_transfer *transfer = slot.transfer;
+        if (slot.cancelled) {
+            transfer->actual_length = 0;
+            transfer->status = LIBUSB_TRANSFER_CANCELLED;
+        } else {
+            transfer->status = ezp_transfer_status(complete(transport, &slot));
+        }
+        transfer->callback(transfer);
+        handled++;
+    }
+    return LIBUSB_SUCCESS;
+}
+
+void ezp_pending_free(ezp_pending_queue *queue) {
+    free(queue->slots);
+    *queue = (ezp_pending_queue) {0};
+}
+
+enum libusb_transfer_status ezp_transfer_status(int error) {
+    switch (error) {
+        case LIBUSB_SUCCESS:
+            return LIBUSB_TRANSFER_COMPLETED;
+        case LIBUSB_ERROR_TIMEOUT:
+            return LIBUSB_TRANSFER_TIMED_OUT;
+        case LIBUSB_ERROR_PIPE:
+            return LIBUSB_TRANSFER_STALL;
+        case LIBUSB_ERROR_NO_DEVICE:
+            return LIBUSB_TRANSFER_NO_DEVICE;
+        case LIBUSB_ERROR_OVERFLOW:
+            return LIBUSB_TRANSFER_OVERFLOW;
+        case LIBUSB_ERROR_INTERRUPTED:
+            return LIBUSB_TRANSFER_CANCELLED;
+        default:
+            return LIBUSB_TRANSFER_ERROR;
+    }
+}
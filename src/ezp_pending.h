@@ -0,0 +1,77 @@
+#ifndef LIBEZP2023PLUS_EZP_PENDING_H
+#define LIBEZP2023PLUS_EZP_PENDING_H
+
+#include "ezp_transport.h"
+#include <stddef.h>
+
+/**
+ * Transfer submitted to a transport simulated in process
+ * due - monotonic seconds the transfer completes at
+ * status, actual_length - outcome, for transports that know it at submission
+ * cancelled - cancelled before it completed
+ */
+typedef struct {
+    struct libusb_transfer *transfer;
+    double due;
+    int status;
+    int actual_length;
+    int cancelled;
+} ezp_pending_transfer;
+
+/**
+ * Completes a due transfer that was not cancelled. Sets transfer->actual_length and the transfer data,
+ * and returns the libusb error code of the transfer
+ */
+typedef int (*ezp_pending_complete)(ezp_transport *transport, ezp_pending_transfer *pending);
+
+/**
+ * Ring of submitted transfers, in submission order. Zero initialized it is empty
+ */
+typedef struct {
+    ezp_pending_transfer *slots;
+    size_t head;
+    size_t count;
+    size_t capacity;
+} ezp_pending_queue;
+
+/**
+ * Append a transfer, growing the ring when it is full
+ * @param queue
+ * @param transfer
+ * @return slot of the transfer, zeroed apart from transfer. NULL when out of memory
+ */
+ezp_pending_transfer *ezp_pending_push(ezp_pending_queue *queue, struct libusb_transfer *transfer);
+
+/**
+ * @param queue
+ * @param transfer
+ * @return slot of a submitted transfer not cancelled yet, NULL when there is none
+ */
+ezp_pending_transfer *ezp_pending_find(ezp_pending_queue *queue, const struct libusb_transfer *transfer);
+
+/**
+ * Complete due transfers in submission order, sleeping until they are due, see ezp_transport handle_events.
+ * Callbacks may submit new transfers
+ * @param queue
+ * @param transport passed to complete
+ * @param complete completes transfers that were not cancelled
+ * @param timeout
+ * @param completed
+ * @return LIBUSB_SUCCESS
+ */
+int ezp_pending_handle_events(ezp_pending_queue *queue, ezp_transport *transport, ezp_pending_complete complete,
+                              struct timeval *timeout, int *completed);
+
+/**
+ * Release the ring, transfers still in it are dropped
+ * @param queue
+ */
+void ezp_pending_free(ezp_pending_queue *queue);
+
+/**
+ * @param error libusb error code
+ * @return status of a transfer that completed with error
+ */
+enum libusb_transfer_status ezp_transfer_status(int error);
+
+#endif //LIBEZP2023PLUS_EZP_PENDING_H
@@ -1,10 +1,19 @@
 #include "ezp_prog.h"
 #include "ezp_errors.h"
+#include "ezp_kernels.h"
+#include "ezp_protocol.h"
+#include "ezp_trace.h"
+#include "ezp_clock.h"
 #include <libusb-1.0/libusb.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <arpa/inet.h>
 #include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <pthread.h>
 
 #define VID 0x1fc8
 #define PID 0x310b
@@ -65,85 +74,1283 @@ static void hexDump(FILE * file, const char *title, const void *addr, const unsi
                             lambda \
                         }
 
-#define COMMAND_RESET 0x0108
-#define COMMAND_START_TRANSACTION 0x5
-#define COMMAND_CHECK_CHIP 0x9
-#define COMMAND_SET_CHIP_DATA 0x7
-#define COMMAND_START_ERASING 0x0102
-#define COMMAND_ERASE 0x0a
+#define ERASE_TIMEOUT 300000 //full erase of big SPI parts takes minutes
+#define ERASED_BYTE 0xff
 
 typedef struct {
-    uint16_t command;
-    uint8_t clazz;
-    uint8_t algorithm;
-    uint16_t flash_page_size; //1,2,4...256
-    uint16_t delay;
-    uint32_t flash_size;
-    uint32_t chip_id;
-    uint8_t speed;
-    uint8_t dummy2[11];
-    uint8_t voltage;
-    uint8_t dummy4[35];
-} __attribute__((packed)) usb_packet;
+    ezp_status_callback callback;
+    void *user_data;
+} internal_user_data;
+
+typedef struct {
+    const uint8_t *image;
+    uint32_t sector_size;
+    uint8_t *changed;
+} diff_state;
+
+typedef struct {
+    const uint8_t *image;
+    ezp_range *ranges;
+    size_t count;
+    size_t capacity;
+    size_t max_count;
+    int out_of_memory;
+} verify_state;
+
+typedef struct {
+    ezp_digest_state image;
+    ezp_digest_state sector;
+    uint32_t sector_size;
+    ezp_digest *sectors;
+} read_digest;
+
+typedef struct block_queue block_queue;
+
+typedef struct {
+    block_queue *queue;
+    struct libusb_transfer *transfer;
+    size_t block;
+    int completed;
+    double submitted;
+} queue_slot;
+
+/**
+ * Ring of preallocated bulk transfers moving blocks_count blocks of block_size bytes
+ * between an endpoint and base. Up to depth transfers are kept in flight; completions
+ * are retired strictly in block order, and every retired slot is resubmitted for the
+ * next pending block.
+ * When sink is set, blocks land in a pool of pool_chunks buffers of chunk_blocks blocks
+ * instead, and every completed chunk is handed to the sink before its buffer is reused.
+ * The first skip_blocks blocks are received into scratch and dropped.
+ * When digest is set, every retired block is hashed while it is still hot in cache.
+ * When checkpoint is set, it follows every retired block. Only used without a sink.
+ * When segments is set, blocks are sent from the segments instead of base: blocks inside a segment point
+ * into it, gaps point to the blank block, and blocks straddling a segment edge are composed in staging.
+ * A block that times out before moving any data is retried: the ring drains, and once every
+ * transfer behind the block is back without data, it restarts at that block. retry_block and
+ * retry_count bound the attempts per block.
+ * When on_finished is set, it is called from the event handler once the last transfer
+ * has completed, so the queue can be driven by an external event loop.
+ */
+struct block_queue {
+    ezp_transport *transport;
+    ezp_programmer *programmer;
+    libusb_device_handle *handle;
+    unsigned char endpoint;
+    uint8_t *base;
+    const ezp_segment *segments;
+    size_t segments_count;
+    uint8_t *blank;
+    uint8_t *staging;
+    size_t skip_blocks;
+    uint8_t *scratch;
+    uint8_t *pool;
+    size_t chunk_blocks;
+    size_t pool_chunks;
+    ezp_sink sink;
+    void *sink_data;
+    read_digest *digest;
+    ezp_checkpoint *checkpoint;
+    uint16_t block_size;
+    size_t blocks_count;
+    size_t next_submit;
+    size_t next_retire;
+    unsigned int depth;
+    unsigned int in_flight;
+    queue_slot *slots;
+    int error;
+    int aborted;
+    int finished;
+    int draining;
+    size_t retry_block;
+    unsigned int retry_count;
+    uint32_t total;
+    ezp_callback callback;
+    void *user_data;
+    void (*on_finished)(block_queue *queue);
+    void *owner;
+};
+
+/**
+ * usb - libusb context, NULL for the libusb default context used by ezp_init
+ * lock, cond - guard and signal the status state below
+ * status - status callback handed to libusb while registered
+ * registered - hotplug_cb_handle holds a registered status callback
+ * listening - a status listener runs and should keep running
+ * listener_finished - the status listener left its event loop
+ */
+struct ezp_context {
+    libusb_context *usb;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    internal_user_data status;
+    libusb_hotplug_callback_handle hotplug_cb_handle;
+    int registered;
+    int listening;
+    int listener_finished;
+};
+
+typedef enum {
+    ASYNC_SEND_CHIP_DATA,
+    ASYNC_RECV_CHIP_DATA,
+    ASYNC_SEND_START,
+    ASYNC_RECV_START,
+    ASYNC_DATA,
+    ASYNC_SEND_RESET,
+    ASYNC_RECV_RESET,
+    ASYNC_DONE
+} async_stage;
+
+/**
+ * A read or write transaction driven entirely by transfer callbacks. Control packets go
+ * through the single control transfer, the data phase through queue. result keeps the
+ * first error; once it is set the operation only sends a reset before it completes.
+ */
+struct ezp_async {
+    ezp_programmer *programmer;
+    int write;
+    async_stage stage;
+    usb_packet packet;
+    struct libusb_transfer *control;
+    block_queue queue;
+    double started;
+    int result;
+    int cancelled;
+    ezp_async_callback done;
+    void *user_data;
+    double control_submitted;
+    unsigned int control_retries;
+};
+
+static ezp_context default_context = {
+        .usb = NULL,
+        .lock = PTHREAD_MUTEX_INITIALIZER,
+        .cond = PTHREAD_COND_INITIALIZER,
+        .listener_finished = 1
+};
+
+static void usb_packet_flip(usb_packet *packet) {
+    packet->command = htons(packet->command);
+    packet->flash_page_size = htons(packet->flash_page_size);
+    packet->delay = htons(packet->delay);
+    packet->flash_size = htonl(packet->flash_size);
+    packet->chip_id = htonl(packet->chip_id);
+}
+
+//account a completed transfer in the statistics and the capture of the programmer.
+//Latency bucket b holds [2^(b-1), 2^b) microseconds, bucket 0 those below 1 microsecond
+static void record_transfer(ezp_programmer *programmer, unsigned char endpoint, const uint8_t *data, int size,
+                            int actual_size, int error, double started) {
+    double finished = ezp_monotonic_seconds();
+    if (programmer->capture) {
+        ezp_capture_record(programmer->capture, endpoint, data, size, actual_size, error, started, finished);
+    }
+
+    ezp_stats *stats = &programmer->stats;
+    double seconds = finished - started;
+    if (endpoint & LIBUSB_ENDPOINT_IN) {
+        stats->transfers_in++;
+        stats->bytes_in += actual_size;
+    } else {
+        stats->transfers_out++;
+        stats->bytes_out += actual_size;
+    }
+    if (error == LIBUSB_ERROR_TIMEOUT) stats->timeouts++;
+    else if (error != LIBUSB_SUCCESS) stats->errors++;
+    else if (actual_size != size) stats->short_transfers++;
+
+    uint64_t us = seconds > 0 ? (uint64_t) (seconds * 1e6) : 0;
+    unsigned int bucket = us ? 64 - __builtin_clzll(us) : 0;
+    stats->latency_histogram[bucket < EZP_LATENCY_BUCKETS ? bucket : EZP_LATENCY_BUCKETS - 1]++;
+}
+
+//splits one operation into phases, every phase_end accounts the time since the previous mark
+typedef struct {
+    ezp_stats *stats;
+    ezp_stats_op op;
+    double mark;
+} phase_timer;
+
+static void phase_begin(phase_timer *timer, ezp_programmer *programmer, ezp_stats_op op) {
+    timer->stats = &programmer->stats;
+    timer->op = op;
+    timer->stats->operations[op]++;
+    memset(timer->stats->last_phase_seconds[op], 0, sizeof(timer->stats->last_phase_seconds[op]));
+    timer->mark = ezp_monotonic_seconds();
+}
+
+static void phase_end(phase_timer *timer, ezp_phase phase) {
+    double now = ezp_monotonic_seconds();
+    timer->stats->phase_seconds[timer->op][phase] += now - timer->mark;
+    timer->stats->last_phase_seconds[timer->op][phase] = now - timer->mark;
+    timer->mark = now;
+}
+
+int ezp_init() {
+    return libusb_init_context(NULL, NULL, 0);
+}
+
+ezp_context *ezp_default_context() {
+    return &default_context;
+}
+
+int ezp_context_new(ezp_context **context) {
+    ezp_context *ctx = calloc(1, sizeof(ezp_context));
+    if (!ctx) return LIBUSB_ERROR_NO_MEM;
+    int ret = libusb_init_context(&ctx->usb, NULL, 0);
+    if (ret != LIBUSB_SUCCESS) {
+        free(ctx);
+        return ret;
+    }
+    pthread_mutex_init(&ctx->lock, NULL);
+    pthread_cond_init(&ctx->cond, NULL);
+    ctx->listener_finished = 1;
+    *context = ctx;
+    return LIBUSB_SUCCESS;
+}
+
+typedef struct {
+    ezp_transport base;
+    libusb_context *usb;
+    libusb_device_handle *handle;
+} usb_transport;
+
+static int usb_transfer(ezp_transport *transport, unsigned char endpoint, uint8_t *data, int size, int *actual_size,
+                        unsigned int timeout) {
+    return libusb_bulk_transfer(((usb_transport *) transport)->handle, endpoint, data, size, actual_size, timeout);
+}
+
+static int usb_submit(ezp_transport *transport, struct libusb_transfer *transfer) {
+    (void) transport;
+    return libusb_submit_transfer(transfer);
+}
+
+static int usb_cancel(ezp_transport *transport, struct libusb_transfer *transfer) {
+    (void) transport;
+    return libusb_cancel_transfer(transfer);
+}
+
+static int usb_handle_events(ezp_transport *transport, struct timeval *timeout, int *completed) {
+    libusb_context *usb = ((usb_transport *) transport)->usb;
+    if (!timeout) return libusb_handle_events_completed(usb, completed);
+    return libusb_handle_events_timeout_completed(usb, timeout, completed);
+}
+
+static void usb_close(ezp_transport *transport) {
+    libusb_close(((usb_transport *) transport)->handle);
+    free(transport);
+}
+
+ezp_programmer *ezp_programmer_new(ezp_context *context, ezp_transport *transport) {
+    ezp_programmer *ezp_prog = (ezp_programmer *) malloc(sizeof(ezp_programmer));
+    if (!ezp_prog) return NULL;
+    ezp_prog->context = context;
+    ezp_prog->transport = transport;
+    ezp_prog->handle = NULL;
+    ezp_prog->queue_depth = EZP_DEFAULT_QUEUE_DEPTH;
+    ezp_prog->timeout = EZP_DEFAULT_TIMEOUT;
+    ezp_prog->retries = EZP_DEFAULT_RETRIES;
+    ezp_prog->read_restarts = 0;
+    ezp_prog->throughput = 0;
+    memset(&ezp_prog->stats, 0, sizeof(ezp_stats));
+    ezp_prog->capture = NULL;
+    ezp_prog->speed_cache_count = 0;
+    return ezp_prog;
+}
+
+//takes the handle over, also on failure
+static ezp_programmer *programmer_new(ezp_context *context, libusb_device_handle *handle) {
+    usb_transport *transport = malloc(sizeof(usb_transport));
+    if (!transport) {
+        libusb_close(handle);
+        return NULL;
+    }
+    transport->base = (ezp_transport) {
+            .transfer = usb_transfer,
+            .submit = usb_submit,
+            .cancel = usb_cancel,
+            .handle_events = usb_handle_events,
+            .close = usb_close
+    };
+    transport->usb = context->usb;
+    transport->handle = handle;
+
+    ezp_programmer *ezp_prog = ezp_programmer_new(context, &transport->base);
+    if (!ezp_prog) {
+        usb_close(&transport->base);
+        return NULL;
+    }
+    ezp_prog->handle = handle;
+    return ezp_prog;
+}
+
+ezp_programmer *ezp_context_find_programmer(ezp_context *context) {
+    libusb_device_handle *handle = libusb_open_device_with_vid_pid(context->usb, VID, PID);
+    if (!handle) return NULL;
+
+    return programmer_new(context, handle);
+}
+
+ezp_programmer *ezp_find_programmer() {
+    return ezp_context_find_programmer(&default_context);
+}
+
+int ezp_context_find_programmers(ezp_context *context, ezp_programmer ***programmers) {
+    *programmers = NULL;
+    libusb_device **devices;
+    ssize_t devices_count = libusb_get_device_list(context->usb, &devices);
+    if (devices_count < 0) return EZP_LIBUSB_ERROR;
+
+    ezp_programmer **list = calloc(devices_count ? devices_count : 1, sizeof(ezp_programmer *));
+    if (!list) {
+        libusb_free_device_list(devices, 1);
+        return EZP_OUT_OF_MEMORY;
+    }
+    int count = 0;
+    for (ssize_t i = 0; i < devices_count; ++i) {
+        struct libusb_device_descriptor desc;
+        if (libusb_get_device_descriptor(devices[i], &desc) != LIBUSB_SUCCESS) continue;
+        if (desc.idVendor != VID || desc.idProduct != PID) continue;
+
+        libusb_device_handle *handle = NULL;
+        int ret = libusb_open(devices[i], &handle);
+        CHECK_RESULT(ret, {
+            continue; //connected but not accessible, see EZP_CONNECTED
+        })
+        ezp_programmer *ezp_prog = programmer_new(context, handle);
+        if (!ezp_prog) continue;
+        list[count++] = ezp_prog;
+    }
+    libusb_free_device_list(devices, 1);
+
+    if (count == 0) {
+        free(list);
+        return 0;
+    }
+    *programmers = list;
+    return count;
+}
+
+int ezp_find_programmers(ezp_programmer ***programmers) {
+    return ezp_context_find_programmers(&default_context, programmers);
+}
+
+void ezp_free_programmers(ezp_programmer **programmers, int count) {
+    if (!programmers) return;
+    for (int i = 0; i < count; ++i) ezp_free_programmer(programmers[i]);
+    free(programmers);
+}
+
+void ezp_set_queue_depth(ezp_programmer *programmer, unsigned int depth) {
+    programmer->queue_depth = depth ? depth : 1;
+}
+
+double ezp_get_throughput(const ezp_programmer *programmer) {
+    return programmer->throughput;
+}
+
+void ezp_get_stats(const ezp_programmer *programmer, ezp_stats *stats) {
+    *stats = programmer->stats;
+}
+
+void ezp_reset_stats(ezp_programmer *programmer) {
+    memset(&programmer->stats, 0, sizeof(ezp_stats));
+}
+
+void ezp_set_timeout(ezp_programmer *programmer, unsigned int timeout) {
+    programmer->timeout = timeout;
+}
+
+void ezp_set_retries(ezp_programmer *programmer, unsigned int retries) {
+    programmer->retries = retries;
+}
+
+void ezp_set_read_restarts(ezp_programmer *programmer, unsigned int restarts) {
+    programmer->read_restarts = restarts;
+}
+
+//synchronous transfer, repeated while it times out before moving any data, so the stream stays in step
+static int bulk_transfer(ezp_programmer *programmer, unsigned char endpoint, uint8_t *data, int size,
+                         int *actual_size) {
+    for (unsigned int attempt = 0;; ++attempt) {
+        *actual_size = 0;
+        double started = ezp_monotonic_seconds();
+        int r = programmer->transport->transfer(programmer->transport, endpoint, data, size, actual_size,
+                                                programmer->timeout);
+        record_transfer(programmer, endpoint, data, size, *actual_size, r, started);
+        if (r != LIBUSB_ERROR_TIMEOUT || *actual_size != 0 || attempt >= programmer->retries) return r;
+        programmer->stats.retries++;
+    }
+}
+
+static int send_to_programmer(ezp_programmer *programmer, const uint8_t *data, int size, uint8_t isData) {
+    hexDump(stderr, "send_to_programmer", data, size);
+    int actual_size;
+    unsigned char endpoint = isData ? ENDPOINT_DATA_OUT : ENDPOINT_COMMAND_OUT;
+    int r = bulk_transfer(programmer, endpoint, (uint8_t *) data, size, &actual_size);
+    if (actual_size != size) fprintf(stderr, "Warning! actual_size != size");
+    return r;
+}
+
+static int recv_from_programmer(ezp_programmer *programmer, uint8_t *data, int size) {
+    int actual_size;
+    int r = bulk_transfer(programmer, ENDPOINT_IN, data, size, &actual_size);
+    hexDump(stderr, "recv_from_programmer", data, size);
+    if (r == LIBUSB_SUCCESS && actual_size != size) fprintf(stderr, "Warning! actual_size != size");
+    return r;
+}
+
+static int transfer_status_error(enum libusb_transfer_status status) {
+    switch (status) {
+        case LIBUSB_TRANSFER_COMPLETED:
+            return LIBUSB_SUCCESS;
+        case LIBUSB_TRANSFER_TIMED_OUT:
+            return LIBUSB_ERROR_TIMEOUT;
+        case LIBUSB_TRANSFER_STALL:
+            return LIBUSB_ERROR_PIPE;
+        case LIBUSB_TRANSFER_NO_DEVICE:
+            return LIBUSB_ERROR_NO_DEVICE;
+        case LIBUSB_TRANSFER_OVERFLOW:
+            return LIBUSB_ERROR_OVERFLOW;
+        case LIBUSB_TRANSFER_CANCELLED:
+            return LIBUSB_ERROR_INTERRUPTED;
+        default:
+            return LIBUSB_ERROR_IO;
+    }
+}
+
+static void block_queue_cancel(block_queue *queue) {
+    for (unsigned int i = 0; i < queue->depth; ++i) {
+        if (!queue->slots[i].completed) queue->transport->cancel(queue->transport, queue->slots[i].transfer);
+    }
+}
+
+static void block_queue_fail(block_queue *queue, int error) {
+    if (queue->error) return; //keep the first error to complete, not necessarily the one of the lowest block
+    queue->error = error;
+    block_queue_cancel(queue);
+}
+
+//the staging buffer of a block belongs to its slot, so it is not reused while the block is in flight
+static uint8_t *segment_block(block_queue *queue, size_t block) {
+    uint32_t offset = block * queue->block_size;
+    uint32_t end = offset + queue->block_size;
+    //first segment ending past the block start
+    size_t low = 0, high = queue->segments_count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (queue->segments[middle].offset + queue->segments[middle].length <= offset) low = middle + 1;
+        else high = middle;
+    }
+    const ezp_segment *segment = &queue->segments[low];
+    if (low == queue->segments_count || segment->offset >= end) return queue->blank;
+    if (segment->offset <= offset && segment->offset + segment->length >= end)
+        return (uint8_t *) segment->data + (offset - segment->offset); //OUT transfers only read from the buffer
+
+    uint8_t *staging = queue->staging + (block % queue->depth) * queue->block_size;
+    memset(staging, ERASED_BYTE, queue->block_size);
+    for (; low < queue->segments_count && segment->offset < end; ++low, ++segment) {
+        uint32_t from = segment->offset > offset ? segment->offset : offset;
+        uint32_t to = segment->offset + segment->length < end ? segment->offset + segment->length : end;
+        memcpy(staging + (from - offset), segment->data + (from - segment->offset), to - from);
+    }
+    return staging;
+}
+
+static uint8_t *block_queue_buffer(block_queue *queue, size_t block) {
+    if (block < queue->skip_blocks) return queue->scratch;
+    if (queue->segments) return segment_block(queue, block);
+    if (!queue->pool) return queue->base + (block - queue->skip_blocks) * queue->block_size;
+    size_t chunk = (block / queue->chunk_blocks) % queue->pool_chunks;
+    return queue->pool + (chunk * queue->chunk_blocks + block % queue->chunk_blocks) * queue->block_size;
+}
+
+static void read_digest_update(read_digest *digest, const uint8_t *data, uint32_t offset, uint32_t size) {
+    ezp_digest_update(&digest->image, data, size);
+    if (!digest->sectors) return;
+    ezp_digest_update(&digest->sector, data, size);
+    if ((offset + size) % digest->sector_size == 0) {
+        ezp_digest_final(&digest->sector, &digest->sectors[(offset + size) / digest->sector_size - 1]);
+        ezp_digest_init(&digest->sector);
+    }
+}
+
+//hand a completed block over to the caller. Returns non-zero when the sink asks to stop
+static int block_queue_retire(block_queue *queue, size_t block) {
+    if (queue->digest && block >= queue->skip_blocks) {
+        read_digest_update(queue->digest, block_queue_buffer(queue, block), block * queue->block_size,
+                           queue->block_size);
+    }
+    if (queue->checkpoint && block >= queue->skip_blocks) {
+        queue->checkpoint->offset = (block + 1) * queue->block_size;
+    }
+    if (queue->callback) queue->callback(block * queue->block_size, queue->total, queue->user_data);
+    if (!queue->sink) return 0;
+    if ((block + 1) % queue->chunk_blocks != 0 && block + 1 != queue->blocks_count) return 0;
+
+    size_t first = block - block % queue->chunk_blocks;
+    return queue->sink(block_queue_buffer(queue, first), first * queue->block_size,
+                       (block + 1 - first) * queue->block_size, queue->sink_data);
+}
+
+static void LIBUSB_CALL block_queue_cb(struct libusb_transfer *transfer);
+
+static void block_queue_submit(block_queue *queue, queue_slot *slot) {
+    uint8_t *ptr = block_queue_buffer(queue, queue->next_submit);
+    libusb_fill_bulk_transfer(slot->transfer, queue->handle, queue->endpoint, ptr, queue->block_size,
+                              block_queue_cb, slot, queue->programmer->timeout);
+    slot->block = queue->next_submit;
+    slot->completed = 0;
+    slot->submitted = ezp_monotonic_seconds();
+    int ret = queue->transport->submit(queue->transport, slot->transfer);
+    if (ret != LIBUSB_SUCCESS) {
+        slot->completed = 1;
+        block_queue_fail(queue, ret);
+        return;
+    }
+    queue->next_submit++;
+    queue->in_flight++;
+}
+
+//take over the failure of a slot that moved no data. Returns non-zero when the block will be asked for again
+static int block_queue_retry(block_queue *queue, queue_slot *slot, int error) {
+    if (queue->error || slot->transfer->actual_length != 0) return 0;
+    //transfers behind the retried block come back cancelled or timed out, which costs nothing
+    if (queue->draining) return slot->block > queue->retry_block;
+    if (error != LIBUSB_ERROR_TIMEOUT) return 0;
+
+    if (slot->block != queue->retry_block) {
+        queue->retry_block = slot->block;
+        queue->retry_count = 0;
+    }
+    if (queue->retry_count++ >= queue->programmer->retries) return 0;
+    //transfers behind the block are still queued on the endpoint. Once they are all back without data,
+    //nothing was lost and the block is next in the stream again
+    queue->draining = 1;
+    queue->next_submit = slot->block;
+    block_queue_cancel(queue);
+    return 1;
+}
+
+//every transfer is back after a retried failure, so the ring restarts at the failed block
+static void block_queue_resume(block_queue *queue) {
+    queue->draining = 0;
+    queue->programmer->stats.retries++;
+    for (unsigned int i = 0; i < queue->depth && queue->next_submit < queue->blocks_count && !queue->error; ++i) {
+        block_queue_submit(queue, &queue->slots[queue->next_submit % queue->depth]);
+    }
+}
+
+//retire completed blocks in order and refill the ring
+static void block_queue_advance(block_queue *queue) {
+    while (!queue->error && queue->next_retire < queue->next_submit) {
+        queue_slot *slot = &queue->slots[queue->next_retire % queue->depth];
+        if (!slot->completed) break;
+        if (slot->transfer->actual_length != slot->transfer->length) fprintf(stderr, "Warning! actual_size != size");
+        if (block_queue_retire(queue, queue->next_retire++)) {
+            queue->aborted = 1;
+            block_queue_fail(queue, LIBUSB_ERROR_INTERRUPTED);
+            break;
+        }
+        if (queue->next_submit < queue->blocks_count && !queue->draining) block_queue_submit(queue, slot);
+    }
+    if (queue->in_flight == 0 && queue->draining && !queue->error) block_queue_resume(queue);
+    if (queue->in_flight == 0 && !queue->finished) {
+        queue->finished = 1;
+        if (queue->on_finished) queue->on_finished(queue);
+    }
+}
+
+static void LIBUSB_CALL block_queue_cb(struct libusb_transfer *transfer) {
+    queue_slot *slot = transfer->user_data;
+    block_queue *queue = slot->queue;
+    slot->completed = 1;
+    queue->in_flight--;
+    hexDump(stderr, "block_queue_cb", transfer->buffer, transfer->actual_length);
+    record_transfer(queue->programmer, transfer->endpoint, transfer->buffer, transfer->length,
+                    transfer->actual_length, transfer_status_error(transfer->status), slot->submitted);
+    int error = transfer_status_error(transfer->status);
+    if (queue->draining && slot->block > queue->retry_block && transfer->actual_length != 0) {
+        //a later block got data, so the stream moved past the retried block
+        block_queue_fail(queue, LIBUSB_ERROR_TIMEOUT);
+    } else if (error != LIBUSB_SUCCESS && !block_queue_retry(queue, slot, error)) {
+        block_queue_fail(queue, error);
+    }
+    block_queue_advance(queue);
+}
+
+//allocate the ring and submit its first transfers. finished is already set when nothing went in flight
+static void block_queue_start(block_queue *queue) {
+    if (queue->depth > queue->blocks_count) queue->depth = queue->blocks_count;
+    if (queue->depth == 0) {
+        queue->finished = 1;
+        return;
+    }
+
+    queue->slots = calloc(queue->depth, sizeof(queue_slot));
+    if (!queue->slots) {
+        queue->depth = 0;
+        queue->error = LIBUSB_ERROR_NO_MEM;
+        queue->finished = 1;
+        return;
+    }
+    for (unsigned int i = 0; i < queue->depth; ++i) {
+        queue->slots[i].queue = queue;
+        queue->slots[i].completed = 1;
+        queue->slots[i].transfer = libusb_alloc_transfer(0);
+        if (!queue->slots[i].transfer) {
+            queue->error = LIBUSB_ERROR_NO_MEM;
+            break;
+        }
+    }
+
+    for (unsigned int i = 0; i < queue->depth && !queue->error; ++i) {
+        block_queue_submit(queue, &queue->slots[i]);
+    }
+    if (queue->in_flight == 0) queue->finished = 1;
+}
+
+static void block_queue_release(block_queue *queue) {
+    if (!queue->slots) return;
+    for (unsigned int i = 0; i < queue->depth; ++i) {
+        if (queue->slots[i].transfer) libusb_free_transfer(queue->slots[i].transfer);
+    }
+    free(queue->slots);
+    queue->slots = NULL;
+}
+
+static int block_queue_run(block_queue *queue) {
+    block_queue_start(queue);
+    while (!queue->finished) {
+        int ret = queue->transport->handle_events(queue->transport, NULL, &queue->finished);
+        if (ret != LIBUSB_SUCCESS && ret != LIBUSB_ERROR_INTERRUPTED) block_queue_fail(queue, ret);
+    }
+    block_queue_release(queue);
+    return queue->error;
+}
+
+static void update_throughput(ezp_programmer *programmer, size_t bytes, double started) {
+    double elapsed = ezp_monotonic_seconds() - started;
+    programmer->throughput = elapsed > 0 ? (double) bytes / elapsed : 0;
+}
+
+static int send_reset(ezp_programmer *programmer) {
+    usb_packet packet = {
+            .command = COMMAND_RESET
+    };
+    usb_packet_flip(&packet);
+    return send_to_programmer(programmer, (uint8_t *) &packet, sizeof(usb_packet), 0);
+}
+
+//receive the data phase of a transaction, pipelined when the programmer allows several transfers in flight
+static int recv_blocks(ezp_programmer *programmer, block_queue *queue) {
+    double started = ezp_monotonic_seconds();
+    queue->transport = programmer->transport;
+    queue->programmer = programmer;
+    queue->handle = programmer->handle;
+    queue->endpoint = ENDPOINT_IN;
+    queue->depth = programmer->queue_depth > 1 ? programmer->queue_depth : 1;
+
+    if (queue->sink) {
+        //one chunk more than the ring can span, so no transfer lands in the chunk held by the sink
+        queue->chunk_blocks = EZP_STREAM_CHUNK_SIZE > queue->block_size ? EZP_STREAM_CHUNK_SIZE / queue->block_size : 1;
+        queue->pool_chunks = (queue->depth + queue->chunk_blocks - 1) / queue->chunk_blocks + 1;
+        queue->pool = malloc(queue->pool_chunks * queue->chunk_blocks * queue->block_size);
+        if (!queue->pool) return LIBUSB_ERROR_NO_MEM;
+    }
+
+    int ret = LIBUSB_SUCCESS;
+    if (queue->depth > 1) {
+        ret = block_queue_run(queue);
+    } else {
+        while (ret == LIBUSB_SUCCESS && queue->next_retire < queue->blocks_count) {
+            ret = recv_from_programmer(programmer, block_queue_buffer(queue, queue->next_retire),
+                                       queue->block_size);
+            if (ret == LIBUSB_SUCCESS && block_queue_retire(queue, queue->next_retire++)) {
+                queue->aborted = 1;
+                ret = LIBUSB_ERROR_INTERRUPTED;
+            }
+        }
+    }
+
+    free(queue->pool);
+    queue->pool = NULL;
+    if (ret == LIBUSB_SUCCESS) update_throughput(programmer, queue->blocks_count * queue->block_size, started);
+    return ret;
+}
+
+//send the data phase of a write straight from the caller's buffer. The ring depth bounds how far
+//the host runs ahead of the programmer
+static int send_blocks(ezp_programmer *programmer, block_queue *queue) {
+    double started = ezp_monotonic_seconds();
+    queue->transport = programmer->transport;
+    queue->programmer = programmer;
+    queue->handle = programmer->handle;
+    queue->endpoint = ENDPOINT_DATA_OUT;
+    queue->depth = programmer->queue_depth > 1 ? programmer->queue_depth : 1;
+
+    if (queue->segments) {
+        //one blank block serves every gap, one staging block per slot serves the segment edges
+        queue->blank = malloc(queue->block_size);
+        queue->staging = malloc((size_t) queue->depth * queue->block_size);
+        if (!queue->blank || !queue->staging) {
+            free(queue->blank);
+            free(queue->staging);
+            return LIBUSB_ERROR_NO_MEM;
+        }
+        memset(queue->blank, ERASED_BYTE, queue->block_size);
+    }
+
+    int ret = LIBUSB_SUCCESS;
+    if (queue->depth > 1) {
+        ret = block_queue_run(queue);
+    } else {
+        while (ret == LIBUSB_SUCCESS && queue->next_retire < queue->blocks_count) {
+            ret = send_to_programmer(programmer, block_queue_buffer(queue, queue->next_retire),
+                                     queue->block_size, 1);
+            if (ret == LIBUSB_SUCCESS) block_queue_retire(queue, queue->next_retire++);
+        }
+    }
+
+    free(queue->blank);
+    free(queue->staging);
+    queue->blank = queue->staging = NULL;
+
+    if (ret == LIBUSB_SUCCESS) update_throughput(programmer, queue->blocks_count * queue->block_size, started);
+    return ret;
+}
+
+static ezp_speed_entry *speed_entry(ezp_programmer *programmer, uint32_t chip_id) {
+    for (unsigned int i = 0; i < programmer->speed_cache_count; ++i) {
+        if (programmer->speed_cache[i].chip_id == chip_id) return &programmer->speed_cache[i];
+    }
+    return NULL;
+}
+
+static void remember_speed(ezp_programmer *programmer, uint32_t chip_id, ezp_speed speed) {
+    ezp_speed_entry *entry = speed_entry(programmer, chip_id);
+    if (entry) {
+        entry->speed = speed;
+        return;
+    }
+    if (programmer->speed_cache_count == EZP_SPEED_CACHE_SIZE) { //drop the oldest
+        memmove(programmer->speed_cache, programmer->speed_cache + 1,
+                (EZP_SPEED_CACHE_SIZE - 1) * sizeof(ezp_speed_entry));
+        programmer->speed_cache_count--;
+    }
+    programmer->speed_cache[programmer->speed_cache_count++] = (ezp_speed_entry) {
+            .chip_id = chip_id,
+            .speed = speed
+    };
+}
+
+void ezp_forget_speed(ezp_programmer *programmer, uint32_t chip_id) {
+    ezp_speed_entry *entry = speed_entry(programmer, chip_id);
+    if (!entry) return;
+    size_t index = entry - programmer->speed_cache;
+    memmove(entry, entry + 1, (programmer->speed_cache_count - index - 1) * sizeof(ezp_speed_entry));
+    programmer->speed_cache_count--;
+}
+
+//replace SPEED_AUTO with the speed found for the chip, probing it when it is not known yet.
+//Only SPI_FLASH has a speed to probe: for eeprom_24 the original software sends the voltage in the speed field,
+//other classes send 0
+static int resolve_speed(ezp_programmer *programmer, ezp_chip_data *chip_data, ezp_speed *speed) {
+    if (*speed != SPEED_AUTO) return EZP_OK;
+    if (chip_data->clazz != SPI_FLASH) {
+        *speed = chip_data->clazz == EEPROM_24 ? (ezp_speed) chip_data->voltage : SPEED_12MHZ;
+        return EZP_OK;
+    }
+    ezp_speed_entry *entry = speed_entry(programmer, chip_data->chip_id);
+    if (entry) {
+        *speed = entry->speed;
+        return EZP_OK;
+    }
+    return ezp_find_speed(programmer, chip_data, speed);
+}
+
+//chip data, start, data phase and reset of a read. chip_data must already be validated
+static int read_transaction(ezp_programmer *programmer, ezp_chip_data *chip_data, ezp_speed speed,
+                            block_queue *queue) {
+    int ret = resolve_speed(programmer, chip_data, &speed);
+    if (ret != EZP_OK) return ret;
+
+    phase_timer timer;
+    phase_begin(&timer, programmer, EZP_STATS_READ);
+
+    //send second packet with chip data 00 07
+    usb_packet packet = {
+            .command = COMMAND_SET_CHIP_DATA,
+            .clazz = chip_data->clazz,
+            .algorithm = chip_data->algorithm,
+            .flash_page_size = chip_data->flash_page,
+            .delay = chip_data->delay,
+            .flash_size = chip_data->flash,
+            .chip_id = chip_data->chip_id,
+            .speed = speed, //in original software: if chip is eeprom_24, then this field equals voltage.
+                            //maybe speed value is valid only for spi_flash
+            .voltage = chip_data->voltage
+    };
+    usb_packet_flip(&packet);
+    ret = send_to_programmer(programmer, (uint8_t *) &packet, sizeof(usb_packet), 0);
+    CHECK_RESULT(ret, {
+        return EZP_LIBUSB_ERROR;
+    })
+    //read response
+    ret = recv_from_programmer(programmer, (uint8_t *) &packet, sizeof(usb_packet));
+    CHECK_RESULT(ret, {
+        return EZP_LIBUSB_ERROR;
+    })
+    phase_end(&timer, EZP_PHASE_SETUP);
+
+    //send begin data transaction packet 00 05
+    memset(&packet, 0, sizeof(usb_packet));
+    packet.command = COMMAND_START_TRANSACTION;
+    usb_packet_flip(&packet);
+    ret = send_to_programmer(programmer, (uint8_t *) &packet, sizeof(usb_packet), 0);
+    CHECK_RESULT(ret, {
+        return EZP_LIBUSB_ERROR;
+    })
+    //read response
+    ret = recv_from_programmer(programmer, (uint8_t *) &packet, sizeof(usb_packet));
+    CHECK_RESULT(ret, {
+        return EZP_LIBUSB_ERROR;
+    })
+    phase_end(&timer, EZP_PHASE_START);
+
+    //loop
+    queue->block_size = chip_data->flash_page > 64 ? chip_data->flash_page : 64;
+    queue->blocks_count = chip_data->flash / queue->block_size;
+    queue->total = chip_data->flash;
+    ret = recv_blocks(programmer, queue);
+    phase_end(&timer, EZP_PHASE_DATA);
+    if (queue->aborted) {
+        send_reset(programmer);
+        return EZP_ABORTED;
+    }
+    CHECK_RESULT(ret, {
+        send_reset(programmer);
+        return EZP_LIBUSB_ERROR;
+    })
+
+    //send reset packet 01 08
+    ret = send_reset(programmer);
+    CHECK_RESULT(ret, {//error after read, so data may be valid
+        return EZP_LIBUSB_ERROR;
+    })
+    //read response
+    ret = recv_from_programmer(programmer, (uint8_t *) &packet, sizeof(usb_packet));
+    CHECK_RESULT(ret, {//error after read, so data may be valid
+        return EZP_LIBUSB_ERROR;
+    })
+    phase_end(&timer, EZP_PHASE_RESET);
+
+    return EZP_OK;
+}
+
+int
+ezp_read_flash(ezp_programmer *programmer, uint8_t **data, ezp_chip_data *chip_data, ezp_speed speed,
+               ezp_callback callback, void *user_data) {
+    if (chip_data->flash % chip_data->flash_page != 0)
+        return EZP_FLASH_SIZE_OR_PAGE_INVALID;
+
+    *data = (uint8_t *) malloc(chip_data->flash);
+    if (!*data) return EZP_OUT_OF_MEMORY;
+
+    ezp_checkpoint checkpoint = {0};
+    int ret = ezp_read_flash_resume(programmer, *data, chip_data, speed, &checkpoint, callback, user_data);
+    if (ret != EZP_OK && checkpoint.offset != chip_data->flash) {
+        free(*data);
+        *data = NULL;
+    }
+    return ret;
+}
+
+int ezp_read_flash_into(ezp_programmer *programmer, uint8_t *data, ezp_chip_data *chip_data, ezp_speed speed,
+                        ezp_callback callback, void *user_data) {
+    ezp_checkpoint checkpoint = {0};
+    return ezp_read_flash_resume(programmer, data, chip_data, speed, &checkpoint, callback, user_data);
+}
+
+int ezp_read_flash_resume(ezp_programmer *programmer, uint8_t *data, ezp_chip_data *chip_data, ezp_speed speed,
+                          ezp_checkpoint *checkpoint, ezp_callback callback, void *user_data) {
+    if (chip_data->flash % chip_data->flash_page != 0)
+        return EZP_FLASH_SIZE_OR_PAGE_INVALID;
+
+    uint16_t right_page_size = chip_data->flash_page > 64 ? chip_data->flash_page : 64;
+    if (checkpoint->flash != chip_data->flash || checkpoint->offset > chip_data->flash ||
+        checkpoint->offset % right_page_size != 0) {
+        checkpoint->offset = 0;
+        checkpoint->flash = chip_data->flash;
+    }
+    if (checkpoint->offset == chip_data->flash) return EZP_OK;
+
+    uint8_t *scratch = malloc(right_page_size);
+    if (!scratch) return EZP_OUT_OF_MEMORY;
+    int ret;
+    for (unsigned int attempt = 0;; ++attempt) {
+        block_queue queue = {
+                .base = data + checkpoint->offset,
+                .skip_blocks = checkpoint->offset / right_page_size,
+                .scratch = scratch,
+                .checkpoint = checkpoint,
+                .callback = callback,
+                .user_data = user_data
+        };
+        ret = read_transaction(programmer, chip_data, speed, &queue);
+        //an error after the last block leaves valid data, the checkpoint tells the caller
+        if (ret != EZP_LIBUSB_ERROR || checkpoint->offset == chip_data->flash || attempt >= programmer->read_restarts)
+            break;
+        programmer->stats.retries++;
+        if (speed == SPEED_AUTO) ezp_forget_speed(programmer, chip_data->chip_id); //probe again, maybe slower
+    }
+    free(scratch);
+    return ret;
+}
+
+int ezp_read_flash_to_file(ezp_programmer *programmer, const char *file, ezp_chip_data *chip_data, ezp_speed speed,
+                           ezp_callback callback, void *user_data) {
+    if (chip_data->flash % chip_data->flash_page != 0)
+        return EZP_FLASH_SIZE_OR_PAGE_INVALID;
+
+    int fd = open(file, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return EZP_ERROR_IO;
+    if (ftruncate(fd, chip_data->flash) != 0) {
+        close(fd);
+        return EZP_ERROR_IO;
+    }
+    //transfers land directly in the page cache of the dump file
+    uint8_t *map = mmap(NULL, chip_data->flash, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        close(fd);
+        return EZP_ERROR_IO;
+    }
+    madvise(map, chip_data->flash, MADV_SEQUENTIAL);
+
+    int ret = ezp_read_flash_into(programmer, map, chip_data, speed, callback, user_data);
+
+    if (munmap(map, chip_data->flash) != 0 && ret == EZP_OK) ret = EZP_ERROR_IO;
+    if (close(fd) != 0 && ret == EZP_OK) ret = EZP_ERROR_IO;
+    return ret;
+}
+
+static int range_valid(ezp_chip_data *chip_data, uint32_t offset, uint32_t length) {
+    uint16_t right_page_size = chip_data->flash_page > 64 ? chip_data->flash_page : 64;
+    return length > 0 && offset % right_page_size == 0 && length % right_page_size == 0 &&
+           offset <= chip_data->flash && length <= chip_data->flash - offset;
+}
+
+int ezp_read_flash_range(ezp_programmer *programmer, uint8_t *data, uint32_t offset, uint32_t length,
+                         ezp_chip_data *chip_data, ezp_speed speed, ezp_callback callback, void *user_data) {
+    if (chip_data->flash % chip_data->flash_page != 0)
+        return EZP_FLASH_SIZE_OR_PAGE_INVALID;
+    if (!range_valid(chip_data, offset, length))
+        return EZP_INVALID_RANGE;
+
+    //the programmer always streams from address 0, so only the part past the window can be left out.
+    //eeprom addressing depends on the declared size, so those are read whole and cut on the host
+    ezp_chip_data window = *chip_data;
+    if (chip_data->clazz == SPI_FLASH) window.flash = offset + length;
+
+    uint16_t right_page_size = chip_data->flash_page > 64 ? chip_data->flash_page : 64;
+    uint8_t *scratch = malloc(right_page_size);
+    if (!scratch) return EZP_OUT_OF_MEMORY;
+    uint8_t *tail = NULL; //range plus the rest of the chip, when it has to be received too
+    if (window.flash > offset + length) {
+        tail = malloc(window.flash - offset);
+        if (!tail) {
+            free(scratch);
+            return EZP_OUT_OF_MEMORY;
+        }
+    }
+
+    block_queue queue = {
+            .base = tail ? tail : data,
+            .skip_blocks = offset / right_page_size,
+            .scratch = scratch,
+            .callback = callback,
+            .user_data = user_data
+    };
+    int ret = read_transaction(programmer, &window, speed, &queue);
+    if (tail) {
+        if (ret == EZP_OK) memcpy(data, tail, length);
+        free(tail);
+    }
+    free(scratch);
+    return ret;
+}
+
+int ezp_write_flash_range(ezp_programmer *programmer, const uint8_t *data, uint32_t offset, uint32_t length,
+                          ezp_chip_data *chip_data, ezp_speed speed, ezp_callback callback, void *user_data) {
+    if (chip_data->flash % chip_data->flash_page != 0)
+        return EZP_FLASH_SIZE_OR_PAGE_INVALID;
+    if (!range_valid(chip_data, offset, length))
+        return EZP_INVALID_RANGE;
+
+    //writing always erases and programs from address 0, so the rest of the chip is read back and kept
+    uint8_t *image = malloc(chip_data->flash);
+    if (!image) return EZP_OUT_OF_MEMORY;
+    int ret = ezp_read_flash_into(programmer, image, chip_data, speed, callback, user_data);
+    if (ret == EZP_OK && memcmp(image + offset, data, length) != 0) {
+        memcpy(image + offset, data, length);
+        ret = ezp_write_flash(programmer, image, chip_data, speed, callback, user_data);
+    }
+    free(image);
+    return ret;
+}
+
+int ezp_find_speed(ezp_programmer *programmer, ezp_chip_data *chip_data, ezp_speed *speed) {
+    if (chip_data->clazz != SPI_FLASH)
+        return EZP_UNSUPPORTED;
+    if (chip_data->flash % chip_data->flash_page != 0)
+        return EZP_FLASH_SIZE_OR_PAGE_INVALID;
+
+    uint16_t right_page_size = chip_data->flash_page > 64 ? chip_data->flash_page : 64;
+    uint32_t sample = EZP_SPEED_SAMPLE_SIZE - EZP_SPEED_SAMPLE_SIZE % right_page_size;
+    if (sample == 0) sample = right_page_size;
+    if (sample > chip_data->flash) sample = chip_data->flash;
+    uint8_t *first = malloc(2 * (size_t) sample);
+    if (!first) return EZP_OUT_OF_MEMORY;
+    uint8_t *second = first + sample;
+
+    //marginal wiring shows up as transfer errors or as reads that disagree
+    int ret = EZP_LIBUSB_ERROR;
+    for (int candidate = SPEED_12MHZ; candidate <= SPEED_375KHZ; ++candidate) {
+        ret = ezp_read_flash_range(programmer, first, 0, sample, chip_data, candidate, NULL, NULL);
+        if (ret == EZP_OK) ret = ezp_read_flash_range(programmer, second, 0, sample, chip_data, candidate, NULL, NULL);
+        if (ret == EZP_OK && memcmp(first, second, sample) != 0) ret = EZP_VERIFY_FAILED;
+        if (ret == EZP_OK) {
+            remember_speed(programmer, chip_data->chip_id, candidate);
+            *speed = candidate;
+            break;
+        }
+        if (ret != EZP_LIBUSB_ERROR && ret != EZP_VERIFY_FAILED) break; //slower would not help
+    }
+    free(first);
+    return ret;
+}
+
+int ezp_load_speed_cache(ezp_programmer *programmer, const char *file) {
+    FILE *f = fopen(file, "r");
+    if (!f) return EZP_ERROR_IO;
+    unsigned int chip_id;
+    int speed;
+    int ret;
+    while ((ret = fscanf(f, "%x %d", &chip_id, &speed)) == 2) {
+        if (speed < SPEED_12MHZ || speed > SPEED_375KHZ) break;
+        remember_speed(programmer, chip_id, speed);
+    }
+    int valid = ret == EOF && !ferror(f);
+    fclose(f);
+    return valid ? EZP_OK : EZP_ERROR_INVALID_FILE;
+}
+
+int ezp_save_speed_cache(const ezp_programmer *programmer, const char *file) {
+    FILE *f = fopen(file, "w");
+    if (!f) return EZP_ERROR_IO;
+    for (unsigned int i = 0; i < programmer->speed_cache_count; ++i) {
+        fprintf(f, "%06X %d\n", programmer->speed_cache[i].chip_id, programmer->speed_cache[i].speed);
+    }
+    int failed = ferror(f);
+    if (fclose(f) != 0) failed = 1;
+    return failed ? EZP_ERROR_IO : EZP_OK;
+}
 
-typedef struct {
-    ezp_status_callback callback;
-    void *user_data;
-} internal_user_data;
+//mark every sector where the chip contents differ from the image
+static int diff_sink(const uint8_t *data, uint32_t offset, uint32_t size, void *user_data) {
+    diff_state *state = user_data;
+    uint32_t pos = 0;
+    while (pos < size) {
+        uint32_t sector = (offset + pos) / state->sector_size;
+        uint32_t end = (sector + 1) * state->sector_size - offset;
+        if (end > size) end = size;
+        if (!state->changed[sector] &&
+            ezp_mismatch(data + pos, state->image + offset + pos, end - pos) != end - pos) {
+            state->changed[sector] = 1;
+        }
+        pos = end;
+    }
+    return 0;
+}
 
-static libusb_hotplug_callback_handle hotplug_cb_handle;
-static volatile int status_listener_running = 0;
-static volatile int status_listener_finished = 0;
+int ezp_write_flash_diff(ezp_programmer *programmer, const uint8_t *data, ezp_chip_data *chip_data, ezp_speed speed,
+                         uint32_t sector_size, ezp_diff_report *report, ezp_callback callback, void *user_data) {
+    if (chip_data->flash % chip_data->flash_page != 0)
+        return EZP_FLASH_SIZE_OR_PAGE_INVALID;
+    if (sector_size == 0) sector_size = EZP_SECTOR_SIZE;
+    if (chip_data->flash % sector_size != 0)
+        return EZP_INVALID_RANGE;
 
-static void usb_packet_flip(usb_packet *packet) {
-    packet->command = htons(packet->command);
-    packet->flash_page_size = htons(packet->flash_page_size);
-    packet->delay = htons(packet->delay);
-    packet->flash_size = htonl(packet->flash_size);
-    packet->chip_id = htonl(packet->chip_id);
+    double started = ezp_monotonic_seconds();
+    uint32_t sectors_count = chip_data->flash / sector_size;
+    diff_state state = {
+            .image = data,
+            .sector_size = sector_size,
+            .changed = calloc(sectors_count, 1)
+    };
+    if (!state.changed) return EZP_OUT_OF_MEMORY;
+
+    //the current contents are compared as they stream in, without a second full-chip buffer
+    int ret = ezp_read_flash_stream(programmer, chip_data, speed, diff_sink, &state, callback, user_data);
+    uint32_t changed = 0;
+    for (uint32_t i = 0; i < sectors_count; ++i) changed += state.changed[i];
+    free(state.changed);
+
+    //the programmer erases and programs the whole chip, so any change means a full write
+    if (ret == EZP_OK && changed > 0) {
+        ret = ezp_write_flash(programmer, data, chip_data, speed, callback, user_data);
+    }
+
+    if (report) {
+        report->sectors_count = sectors_count;
+        report->sectors_changed = changed;
+        report->sectors_written = ret == EZP_OK && changed > 0 ? sectors_count : 0;
+        report->sectors_skipped = ret == EZP_OK ? sectors_count - report->sectors_written : 0;
+        report->bytes_saved = report->sectors_skipped * sector_size;
+        report->seconds = ezp_monotonic_seconds() - started;
+    }
+    return ret;
 }
 
-int ezp_init() {
-    return libusb_init_context(NULL, NULL, 0);
+//collect differing byte runs, merging runs that continue across chunks
+static int verify_sink(const uint8_t *data, uint32_t offset, uint32_t size, void *user_data) {
+    verify_state *state = user_data;
+    const uint8_t *expected = state->image + offset;
+    size_t pos = ezp_mismatch(data, expected, size);
+    while (pos < size) {
+        size_t end = pos + ezp_match(data + pos, expected + pos, size - pos);
+        ezp_range *last = state->count ? &state->ranges[state->count - 1] : NULL;
+        if (last && last->offset + last->length == offset + pos) {
+            last->length += end - pos;
+        } else {
+            if (state->count == state->capacity) {
+                size_t capacity = state->capacity ? state->capacity * 2 : 16;
+                ezp_range *ranges = realloc(state->ranges, capacity * sizeof(ezp_range));
+                if (!ranges) {
+                    state->out_of_memory = 1;
+                    return 1;
+                }
+                state->ranges = ranges;
+                state->capacity = capacity;
+            }
+            state->ranges[state->count++] = (ezp_range) {offset + pos, end - pos};
+        }
+        pos = end + ezp_mismatch(data + end, expected + end, size - end);
+    }
+    return state->max_count && state->count >= state->max_count;
 }
 
-ezp_programmer *ezp_find_programmer() {
-    libusb_device_handle *handle = libusb_open_device_with_vid_pid(NULL, VID, PID);
-    if (!handle) return NULL;
+int ezp_verify_flash(ezp_programmer *programmer, const uint8_t *data, ezp_chip_data *chip_data, ezp_speed speed,
+                     ezp_range **mismatches, size_t *mismatches_count, size_t max_mismatches,
+                     ezp_callback callback, void *user_data) {
+    if (chip_data->flash % chip_data->flash_page != 0)
+        return EZP_FLASH_SIZE_OR_PAGE_INVALID;
 
-    ezp_programmer *ezp_prog = (ezp_programmer *) malloc(sizeof(ezp_programmer));
-    ezp_prog->handle = handle;
+    verify_state state = {
+            .image = data,
+            .max_count = mismatches ? max_mismatches : 1
+    };
+    int ret = ezp_read_flash_stream(programmer, chip_data, speed, verify_sink, &state, callback, user_data);
+    if (state.out_of_memory) ret = EZP_OUT_OF_MEMORY;
+    else if (ret == EZP_ABORTED || (ret == EZP_OK && state.count > 0)) ret = EZP_VERIFY_FAILED;
 
-    return ezp_prog;
+    if (mismatches_count) *mismatches_count = state.count;
+    if (mismatches) {
+        *mismatches = state.ranges;
+    } else {
+        free(state.ranges);
+    }
+    return ret;
 }
 
-static int send_to_programmer(libusb_device_handle *handle, const uint8_t *data, int size, uint8_t isData) {
-    hexDump(stderr, "send_to_programmer", data, size);
-    int actual_size;
-    int r = libusb_bulk_transfer(handle, LIBUSB_ENDPOINT_OUT | (isData ? 1 : 2),
-                                 (uint8_t *)data, size, &actual_size, 1000);
-    if (actual_size != size) fprintf(stderr, "Warning! actual_size != size");
-    return r;
+static int discard_sink(const uint8_t *data, uint32_t offset, uint32_t size, void *user_data) {
+    (void) data;
+    (void) offset;
+    (void) size;
+    (void) user_data;
+    return 0;
 }
 
-static int recv_from_programmer(libusb_device_handle *handle, uint8_t *data, int size) {
-    int actual_size;
-    int r = libusb_bulk_transfer(handle, LIBUSB_ENDPOINT_IN | 2,
-                                 (uint8_t *)data, size, &actual_size, 1000);
-    hexDump(stderr, "recv_from_programmer", data, size);
-    if (actual_size != size) fprintf(stderr, "Warning! actual_size != size");
-    return r;
+int ezp_read_flash_digest(ezp_programmer *programmer, uint8_t *data, ezp_chip_data *chip_data, ezp_speed speed,
+                          ezp_digest *digest, uint32_t sector_size, ezp_digest *sector_digests,
+                          ezp_callback callback, void *user_data) {
+    if (chip_data->flash % chip_data->flash_page != 0)
+        return EZP_FLASH_SIZE_OR_PAGE_INVALID;
+    uint16_t right_page_size = chip_data->flash_page > 64 ? chip_data->flash_page : 64;
+    if (sector_digests && (sector_size == 0 || sector_size % right_page_size != 0 ||
+                           chip_data->flash % sector_size != 0))
+        return EZP_INVALID_RANGE;
+
+    read_digest state = {
+            .sector_size = sector_size,
+            .sectors = sector_digests
+    };
+    ezp_digest_init(&state.image);
+    ezp_digest_init(&state.sector);
+
+    //without a destination the blocks only pass through the stream pool
+    block_queue queue = {
+            .base = data,
+            .sink = data ? NULL : discard_sink,
+            .digest = &state,
+            .callback = callback,
+            .user_data = user_data
+    };
+    int ret = read_transaction(programmer, chip_data, speed, &queue);
+    if (ret == EZP_OK && digest) ezp_digest_final(&state.image, digest);
+    return ret;
 }
 
-int
-ezp_read_flash(ezp_programmer *programmer, uint8_t **data, ezp_chip_data *chip_data, ezp_speed speed,
-               ezp_callback callback, void *user_data) {
+int ezp_write_flash_blank_aware(ezp_programmer *programmer, const uint8_t *data, ezp_chip_data *chip_data,
+                                ezp_speed speed, uint32_t *bytes_skipped, ezp_callback callback, void *user_data) {
     if (chip_data->flash % chip_data->flash_page != 0)
         return EZP_FLASH_SIZE_OR_PAGE_INVALID;
 
-    *data = (uint8_t *) malloc(chip_data->flash);
+    //the programmer streams pages from address 0 on, so only the blank tail can be left out.
+    //eeprom addressing depends on the declared size, so those are always written whole
+    uint32_t end = chip_data->flash;
+    if (chip_data->clazz == SPI_FLASH) {
+        uint16_t right_page_size = chip_data->flash_page > 64 ? chip_data->flash_page : 64;
+        while (end >= right_page_size &&
+               ezp_fill_span(data + end - right_page_size, right_page_size, ERASED_BYTE) == right_page_size) {
+            end -= right_page_size;
+        }
+    }
 
-    //send second packet with chip data 00 07
+    int ret = EZP_OK;
+    if (end > 0) {
+        ezp_chip_data window = *chip_data;
+        window.flash = end;
+        ret = ezp_write_flash(programmer, data, &window, speed, callback, user_data);
+    }
+    if (bytes_skipped) *bytes_skipped = ret == EZP_OK ? chip_data->flash - end : 0;
+    return ret;
+}
+
+static int blank_sink(const uint8_t *data, uint32_t offset, uint32_t size, void *user_data) {
+    uint32_t *first_non_blank = user_data;
+    size_t blank = ezp_fill_span(data, size, ERASED_BYTE);
+    if (blank == size) return 0;
+    *first_non_blank = offset + blank;
+    return 1;
+}
+
+int ezp_blank_check_flash(ezp_programmer *programmer, ezp_chip_data *chip_data, ezp_speed speed,
+                          uint32_t *first_non_blank, ezp_callback callback, void *user_data) {
+    uint32_t offset = chip_data->flash;
+    int ret = ezp_read_flash_stream(programmer, chip_data, speed, blank_sink, &offset, callback, user_data);
+    if (ret == EZP_ABORTED && offset < chip_data->flash) ret = EZP_NOT_BLANK;
+    if (first_non_blank) *first_non_blank = offset;
+    return ret;
+}
+
+//chip data, erase and reset. chip_data must already be validated
+static int erase_transaction(ezp_programmer *programmer, ezp_chip_data *chip_data, ezp_speed speed,
+                             ezp_callback callback, void *user_data) {
+    int ret = resolve_speed(programmer, chip_data, &speed);
+    if (ret != EZP_OK) return ret;
+
+    //send packet with chip data 00 07
     usb_packet packet = {
             .command = COMMAND_SET_CHIP_DATA,
             .clazz = chip_data->clazz,
@@ -152,80 +1359,134 @@ ezp_read_flash(ezp_programmer *programmer, uint8_t **data, ezp_chip_data *chip_d
             .delay = chip_data->delay,
             .flash_size = chip_data->flash,
             .chip_id = chip_data->chip_id,
-            .speed = speed, //in original software: if chip is eeprom_24, then this field equals voltage.
-                            //maybe speed value is valid only for spi_flash
+            .speed = speed,
             .voltage = chip_data->voltage
     };
     usb_packet_flip(&packet);
-    int ret = send_to_programmer(programmer->handle, (uint8_t *) &packet, sizeof(usb_packet), 0);
+    ret = send_to_programmer(programmer, (uint8_t *) &packet, sizeof(usb_packet), 0);
     CHECK_RESULT(ret, {
-        free(*data);
-        *data = NULL;
         return EZP_LIBUSB_ERROR;
     })
     //read response
-    ret = recv_from_programmer(programmer->handle, (uint8_t *) &packet, sizeof(usb_packet));
+    ret = recv_from_programmer(programmer, (uint8_t *) &packet, sizeof(usb_packet));
     CHECK_RESULT(ret, {
-        free(*data);
-        *data = NULL;
         return EZP_LIBUSB_ERROR;
     })
 
-    //send begin data transaction packet 00 05
+    //send erase packet 00 0a
     memset(&packet, 0, sizeof(usb_packet));
-    packet.command = COMMAND_START_TRANSACTION;
+    packet.command = COMMAND_ERASE;
     usb_packet_flip(&packet);
-    ret = send_to_programmer(programmer->handle, (uint8_t *) &packet, sizeof(usb_packet), 0);
+    ret = send_to_programmer(programmer, (uint8_t *) &packet, sizeof(usb_packet), 0);
     CHECK_RESULT(ret, {
-        free(*data);
-        *data = NULL;
         return EZP_LIBUSB_ERROR;
     })
     //read response
-    ret = recv_from_programmer(programmer->handle, (uint8_t *) &packet, sizeof(usb_packet));
+    ret = recv_from_programmer(programmer, (uint8_t *) &packet, sizeof(usb_packet));
     CHECK_RESULT(ret, {
-        free(*data);
-        *data = NULL;
+        send_reset(programmer);
         return EZP_LIBUSB_ERROR;
     })
 
-    //loop
-    uint16_t right_page_size = chip_data->flash_page > 64 ? chip_data->flash_page : 64;
-    size_t blocks_count = chip_data->flash / right_page_size;
-    uint8_t *ptr = *data;
-    for (size_t i = 0; i < blocks_count; ++i) {
-        if (callback) callback(i * right_page_size, chip_data->flash, user_data);
-        ret = recv_from_programmer(programmer->handle, ptr, right_page_size);
-        CHECK_RESULT(ret, {
-            free(*data);
-            *data = NULL;
-            return EZP_LIBUSB_ERROR;
-        })
-        ptr += right_page_size;
-    }
-
-    //send reset packet 01 08
+    //send start erasing packet 01 02, the response arrives once the chip is erased
     memset(&packet, 0, sizeof(usb_packet));
-    packet.command = COMMAND_RESET;
+    packet.command = COMMAND_START_ERASING;
     usb_packet_flip(&packet);
-    ret = send_to_programmer(programmer->handle, (uint8_t *) &packet, sizeof(usb_packet), 0);
-    CHECK_RESULT(ret, {//error after read, so data may be valid
+    ret = send_to_programmer(programmer, (uint8_t *) &packet, sizeof(usb_packet), 0);
+    CHECK_RESULT(ret, {
+        send_reset(programmer);
+        return EZP_LIBUSB_ERROR;
+    })
+    if (callback) callback(0, chip_data->flash, user_data);
+    //one long receive instead of bulk_transfer, whose retries would count the expected wait as timeouts
+    int actual_size = 0;
+    double started = ezp_monotonic_seconds();
+    ret = programmer->transport->transfer(programmer->transport, ENDPOINT_IN, (uint8_t *) &packet,
+                                          sizeof(usb_packet), &actual_size, programmer->timeout ? ERASE_TIMEOUT : 0);
+    record_transfer(programmer, ENDPOINT_IN, (uint8_t *) &packet, sizeof(usb_packet), actual_size, ret, started);
+    CHECK_RESULT(ret, {
+        send_reset(programmer);
+        return EZP_LIBUSB_ERROR;
+    })
+    if (callback) callback(chip_data->flash, chip_data->flash, user_data);
+
+    //send reset packet 01 08
+    ret = send_reset(programmer);
+    CHECK_RESULT(ret, {
         return EZP_LIBUSB_ERROR;
     })
     //read response
-    ret = recv_from_programmer(programmer->handle, (uint8_t *) &packet, sizeof(usb_packet));
-    CHECK_RESULT(ret, {//error after read, so data may be valid
+    ret = recv_from_programmer(programmer, (uint8_t *) &packet, sizeof(usb_packet));
+    CHECK_RESULT(ret, {
         return EZP_LIBUSB_ERROR;
     })
 
     return EZP_OK;
 }
 
-int ezp_write_flash(ezp_programmer *programmer, const uint8_t *data, ezp_chip_data *chip_data, ezp_speed speed,
-                    ezp_callback callback, void *user_data) {
+int ezp_erase_flash(ezp_programmer *programmer, ezp_chip_data *chip_data, ezp_speed speed, ezp_erase_mode mode,
+                    uint32_t offset, uint32_t length, int skip_if_blank, ezp_callback callback, void *user_data) {
+    (void) offset;
+    (void) length;
+    if (chip_data->flash % chip_data->flash_page != 0)
+        return EZP_FLASH_SIZE_OR_PAGE_INVALID;
+    //the programmer has no addressed erase, and emulating one would rewrite the whole chip
+    if (mode != EZP_ERASE_CHIP) return EZP_UNSUPPORTED;
+
+    if (skip_if_blank) {
+        int ret = ezp_blank_check_flash(programmer, chip_data, speed, NULL, callback, user_data);
+        if (ret != EZP_NOT_BLANK) return ret;
+    }
+    return erase_transaction(programmer, chip_data, speed, callback, user_data);
+}
+
+static int fd_sink(const uint8_t *data, uint32_t offset, uint32_t size, void *user_data) {
+    (void) offset;
+    int *fd = user_data;
+    while (size > 0) {
+        ssize_t written = write(*fd, data, size);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) {
+            *fd = -1;
+            return 1;
+        }
+        data += written;
+        size -= written;
+    }
+    return 0;
+}
+
+int ezp_read_flash_stream(ezp_programmer *programmer, ezp_chip_data *chip_data, ezp_speed speed,
+                          ezp_sink sink, void *sink_data, ezp_callback callback, void *user_data) {
     if (chip_data->flash % chip_data->flash_page != 0)
         return EZP_FLASH_SIZE_OR_PAGE_INVALID;
 
+    block_queue queue = {
+            .sink = sink,
+            .sink_data = sink_data,
+            .callback = callback,
+            .user_data = user_data
+    };
+    return read_transaction(programmer, chip_data, speed, &queue);
+}
+
+int ezp_read_flash_to_fd(ezp_programmer *programmer, int fd, ezp_chip_data *chip_data, ezp_speed speed,
+                         ezp_callback callback, void *user_data) {
+    int sink_fd = fd;
+    int ret = ezp_read_flash_stream(programmer, chip_data, speed, fd_sink, &sink_fd, callback, user_data);
+    if (ret == EZP_ABORTED && sink_fd < 0) return EZP_ERROR_IO;
+    return ret;
+}
+
+//chip data, data phase from the queue and reset. chip_data must already be validated
+static int write_transaction(ezp_programmer *programmer, block_queue *queue, ezp_chip_data *chip_data,
+                             ezp_speed speed) {
+    int ret = resolve_speed(programmer, chip_data, &speed);
+    if (ret != EZP_OK) return ret;
+
+    phase_timer timer;
+    phase_begin(&timer, programmer, EZP_STATS_WRITE);
+
     usb_packet packet = {
             .command = COMMAND_SET_CHIP_DATA,
             .clazz = chip_data->clazz,
@@ -239,50 +1500,318 @@ int ezp_write_flash(ezp_programmer *programmer, const uint8_t *data, ezp_chip_da
             .voltage = chip_data->voltage
     };
     usb_packet_flip(&packet);
-    int ret = send_to_programmer(programmer->handle, (uint8_t *) &packet, sizeof(usb_packet), 0);
+    ret = send_to_programmer(programmer, (uint8_t *) &packet, sizeof(usb_packet), 0);
     CHECK_RESULT(ret, {
         return EZP_LIBUSB_ERROR;
     })
     //read response
-    ret = recv_from_programmer(programmer->handle, (uint8_t *) &packet, sizeof(usb_packet));
+    ret = recv_from_programmer(programmer, (uint8_t *) &packet, sizeof(usb_packet));
     CHECK_RESULT(ret, {
         return EZP_LIBUSB_ERROR;
     })
+    phase_end(&timer, EZP_PHASE_SETUP);
 
     //send begin data transaction packet 00 05
     memset(&packet, 0, sizeof(usb_packet));
     packet.command = COMMAND_START_TRANSACTION;
     usb_packet_flip(&packet);
-    ret = send_to_programmer(programmer->handle, (uint8_t *) &packet, sizeof(usb_packet), 0);
+    ret = send_to_programmer(programmer, (uint8_t *) &packet, sizeof(usb_packet), 0);
     CHECK_RESULT(ret, {
         return EZP_LIBUSB_ERROR;
     })
+    phase_end(&timer, EZP_PHASE_START);
 
     //loop
     uint16_t right_page_size = chip_data->flash_page > 64 ? chip_data->flash_page : 64;
-    size_t blocks_count = chip_data->flash / right_page_size;
-    const uint8_t *ptr = data;
-    for (size_t i = 0; i < blocks_count; ++i) {
-        ret = send_to_programmer(programmer->handle, ptr, right_page_size, 1);
-        CHECK_RESULT(ret, {
-            return EZP_LIBUSB_ERROR;
-        })
-        ptr += right_page_size;
-        if (callback) callback(i * right_page_size, chip_data->flash, user_data);
+    queue->block_size = right_page_size;
+    queue->blocks_count = chip_data->flash / right_page_size;
+    queue->total = chip_data->flash;
+    ret = send_blocks(programmer, queue);
+    phase_end(&timer, EZP_PHASE_DATA);
+    if (ret == LIBUSB_ERROR_NO_MEM) {
+        send_reset(programmer);
+        return EZP_OUT_OF_MEMORY;
     }
+    CHECK_RESULT(ret, {
+        send_reset(programmer); //leave the programmer idle after an aborted write
+        return EZP_LIBUSB_ERROR;
+    })
 
     //send reset packet 01 08
-    memset(&packet, 0, sizeof(usb_packet));
-    packet.command = COMMAND_RESET;
-    usb_packet_flip(&packet);
-    ret = send_to_programmer(programmer->handle, (uint8_t *) &packet, sizeof(usb_packet), 0);
+    ret = send_reset(programmer);
     CHECK_RESULT(ret, {
         return EZP_LIBUSB_ERROR;
     })
+    phase_end(&timer, EZP_PHASE_RESET);
+
+    return EZP_OK;
+}
+
+int ezp_write_flash(ezp_programmer *programmer, const uint8_t *data, ezp_chip_data *chip_data, ezp_speed speed,
+                    ezp_callback callback, void *user_data) {
+    if (chip_data->flash % chip_data->flash_page != 0)
+        return EZP_FLASH_SIZE_OR_PAGE_INVALID;
+    block_queue queue = {
+            .base = (uint8_t *) data, //OUT transfers only read from the buffer
+            .callback = callback,
+            .user_data = user_data
+    };
+    return write_transaction(programmer, &queue, chip_data, speed);
+}
+
+int ezp_write_flash_segments(ezp_programmer *programmer, const ezp_segment *segments, size_t count,
+                             ezp_chip_data *chip_data, ezp_speed speed, ezp_callback callback, void *user_data) {
+    if (chip_data->flash % chip_data->flash_page != 0)
+        return EZP_FLASH_SIZE_OR_PAGE_INVALID;
+    uint32_t end = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (segments[i].offset < end || segments[i].offset > chip_data->flash ||
+            segments[i].length > chip_data->flash - segments[i].offset)
+            return EZP_INVALID_RANGE;
+        end = segments[i].offset + segments[i].length;
+    }
+    //a segment list without segments still needs segments set, so it is written as a blank image
+    static const ezp_segment none;
+    block_queue queue = {
+            .segments = count ? segments : &none,
+            .segments_count = count,
+            .callback = callback,
+            .user_data = user_data
+    };
+    return write_transaction(programmer, &queue, chip_data, speed);
+}
+
+static void async_step(ezp_async *op);
+
+static void async_complete(ezp_async *op) {
+    op->stage = ASYNC_DONE;
+    block_queue_release(&op->queue);
+    //done may free op, so it is touched last
+    if (op->done) op->done(op, op->result, op->user_data);
+}
+
+static void async_fail(ezp_async *op, int result) {
+    if (op->result == EZP_OK) op->result = result;
+    if (op->stage < ASYNC_SEND_START) {
+        async_complete(op); //nothing started yet, the programmer is still idle
+        return;
+    }
+    op->stage = ASYNC_SEND_RESET;
+    async_step(op);
+}
+
+static void LIBUSB_CALL async_control_cb(struct libusb_transfer *transfer) {
+    ezp_async *op = transfer->user_data;
+    hexDump(stderr, "async_control_cb", transfer->buffer, transfer->actual_length);
+    record_transfer(op->programmer, transfer->endpoint, transfer->buffer, transfer->length,
+                    transfer->actual_length, transfer_status_error(transfer->status), op->control_submitted);
+    //a packet that timed out before moving any data can be sent or asked for again
+    if (transfer->status == LIBUSB_TRANSFER_TIMED_OUT && transfer->actual_length == 0 && !op->cancelled &&
+        op->control_retries < op->programmer->retries) {
+        op->control_retries++;
+        op->programmer->stats.retries++;
+        op->control_submitted = ezp_monotonic_seconds();
+        if (op->programmer->transport->submit(op->programmer->transport, transfer) == LIBUSB_SUCCESS) return;
+    }
+    if (transfer->status != LIBUSB_TRANSFER_COMPLETED) {
+        if (op->stage >= ASYNC_SEND_RESET) { //error after the data phase, so data may be valid
+            if (op->result == EZP_OK) op->result = EZP_LIBUSB_ERROR;
+            async_complete(op);
+            return;
+        }
+        async_fail(op, op->cancelled ? EZP_ABORTED : EZP_LIBUSB_ERROR);
+        return;
+    }
+    if (op->cancelled && op->stage < ASYNC_DATA) {
+        async_fail(op, EZP_ABORTED);
+        return;
+    }
+
+    switch (op->stage) {
+        case ASYNC_SEND_START:
+            op->stage = op->write ? ASYNC_DATA : ASYNC_RECV_START; //write start has no response
+            break;
+        case ASYNC_SEND_RESET:
+            //the programmer answers a reset only after a successful read
+            if (op->write || op->result != EZP_OK) {
+                async_complete(op);
+                return;
+            }
+            op->stage = ASYNC_RECV_RESET;
+            break;
+        case ASYNC_RECV_RESET:
+            async_complete(op);
+            return;
+        default:
+            op->stage++;
+            break;
+    }
+    async_step(op);
+}
+
+static void async_data_finished(block_queue *queue) {
+    ezp_async *op = queue->owner;
+    if (queue->aborted || op->cancelled) {
+        async_fail(op, EZP_ABORTED);
+        return;
+    }
+    if (queue->error != LIBUSB_SUCCESS) {
+        async_fail(op, EZP_LIBUSB_ERROR);
+        return;
+    }
+    update_throughput(op->programmer, queue->blocks_count * queue->block_size, op->started);
+    op->stage = ASYNC_SEND_RESET;
+    async_step(op);
+}
+
+static void async_submit_control(ezp_async *op, unsigned char endpoint) {
+    libusb_fill_bulk_transfer(op->control, op->programmer->handle, endpoint, (uint8_t *) &op->packet,
+                              sizeof(usb_packet), async_control_cb, op, op->programmer->timeout);
+    op->control_submitted = ezp_monotonic_seconds();
+    op->control_retries = 0;
+    int ret = op->programmer->transport->submit(op->programmer->transport, op->control);
+    if (ret != LIBUSB_SUCCESS) {
+        if (op->stage >= ASYNC_SEND_RESET) {
+            if (op->result == EZP_OK) op->result = EZP_LIBUSB_ERROR;
+            async_complete(op);
+            return;
+        }
+        async_fail(op, EZP_LIBUSB_ERROR);
+    }
+}
+
+//issue the transfer of the current stage. Every path ends in a submitted transfer or in async_complete
+static void async_step(ezp_async *op) {
+    switch (op->stage) {
+        case ASYNC_SEND_CHIP_DATA:
+            //packet already holds the chip data
+            async_submit_control(op, ENDPOINT_COMMAND_OUT);
+            break;
+        case ASYNC_SEND_START:
+            memset(&op->packet, 0, sizeof(usb_packet));
+            op->packet.command = COMMAND_START_TRANSACTION;
+            usb_packet_flip(&op->packet);
+            async_submit_control(op, ENDPOINT_COMMAND_OUT);
+            break;
+        case ASYNC_RECV_CHIP_DATA:
+        case ASYNC_RECV_START:
+        case ASYNC_RECV_RESET:
+            async_submit_control(op, ENDPOINT_IN);
+            break;
+        case ASYNC_DATA:
+            op->started = ezp_monotonic_seconds();
+            block_queue_start(&op->queue);
+            if (op->queue.finished) async_data_finished(&op->queue);
+            break;
+        case ASYNC_SEND_RESET:
+            memset(&op->packet, 0, sizeof(usb_packet));
+            op->packet.command = COMMAND_RESET;
+            usb_packet_flip(&op->packet);
+            async_submit_control(op, ENDPOINT_COMMAND_OUT);
+            break;
+        case ASYNC_DONE:
+            break;
+    }
+}
+
+static int async_begin(ezp_programmer *programmer, int write, uint8_t *data, ezp_chip_data *chip_data,
+                       ezp_speed speed, ezp_callback callback, ezp_async_callback done, void *user_data,
+                       ezp_async **op) {
+    *op = NULL;
+    if (chip_data->flash % chip_data->flash_page != 0)
+        return EZP_FLASH_SIZE_OR_PAGE_INVALID;
+    int ret = resolve_speed(programmer, chip_data, &speed);
+    if (ret != EZP_OK) return ret;
+
+    ezp_async *new_op = calloc(1, sizeof(ezp_async));
+    if (!new_op) return EZP_OUT_OF_MEMORY;
+    new_op->control = libusb_alloc_transfer(0);
+    if (!new_op->control) {
+        free(new_op);
+        return EZP_OUT_OF_MEMORY;
+    }
+    new_op->programmer = programmer;
+    new_op->write = write;
+    new_op->done = done;
+    new_op->user_data = user_data;
+
+    uint16_t right_page_size = chip_data->flash_page > 64 ? chip_data->flash_page : 64;
+    block_queue *queue = &new_op->queue;
+    queue->transport = programmer->transport;
+    queue->programmer = programmer;
+    queue->handle = programmer->handle;
+    queue->endpoint = write ? ENDPOINT_DATA_OUT : ENDPOINT_IN;
+    queue->depth = programmer->queue_depth > 1 ? programmer->queue_depth : 1;
+    queue->base = data;
+    queue->block_size = right_page_size;
+    queue->blocks_count = chip_data->flash / right_page_size;
+    queue->total = chip_data->flash;
+    queue->callback = callback;
+    queue->user_data = user_data;
+    queue->on_finished = async_data_finished;
+    queue->owner = new_op;
+
+    new_op->packet = (usb_packet) {
+            .command = COMMAND_SET_CHIP_DATA,
+            .clazz = chip_data->clazz,
+            .algorithm = chip_data->algorithm,
+            .flash_page_size = chip_data->flash_page,
+            .delay = chip_data->delay,
+            .flash_size = chip_data->flash,
+            .chip_id = chip_data->chip_id,
+            .speed = speed,
+            .voltage = chip_data->voltage
+    };
+    usb_packet_flip(&new_op->packet);
 
+    new_op->stage = ASYNC_SEND_CHIP_DATA;
+    libusb_fill_bulk_transfer(new_op->control, programmer->handle, ENDPOINT_COMMAND_OUT,
+                              (uint8_t *) &new_op->packet, sizeof(usb_packet), async_control_cb, new_op,
+                              programmer->timeout);
+    new_op->control_submitted = ezp_monotonic_seconds();
+    ret = programmer->transport->submit(programmer->transport, new_op->control);
+    CHECK_RESULT(ret, {
+        libusb_free_transfer(new_op->control);
+        free(new_op);
+        return EZP_LIBUSB_ERROR;
+    })
+    *op = new_op;
     return EZP_OK;
 }
 
+int ezp_read_flash_async(ezp_programmer *programmer, uint8_t *data, ezp_chip_data *chip_data, ezp_speed speed,
+                         ezp_callback callback, ezp_async_callback done, void *user_data, ezp_async **op) {
+    return async_begin(programmer, 0, data, chip_data, speed, callback, done, user_data, op);
+}
+
+int ezp_write_flash_async(ezp_programmer *programmer, const uint8_t *data, ezp_chip_data *chip_data,
+                          ezp_speed speed, ezp_callback callback, ezp_async_callback done, void *user_data,
+                          ezp_async **op) {
+    //OUT transfers only read from the buffer
+    return async_begin(programmer, 1, (uint8_t *) data, chip_data, speed, callback, done, user_data, op);
+}
+
+void ezp_async_cancel(ezp_async *op) {
+    if (op->stage == ASYNC_DONE || op->cancelled) return;
+    op->cancelled = 1;
+    if (op->stage == ASYNC_DATA) {
+        op->queue.aborted = 1;
+        block_queue_fail(&op->queue, LIBUSB_ERROR_INTERRUPTED);
+    } else if (op->stage < ASYNC_DATA) {
+        op->programmer->transport->cancel(op->programmer->transport, op->control);
+    }
+    //the reset exchange is left to finish, so the programmer ends idle
+}
+
+int ezp_async_finished(const ezp_async *op) {
+    return op->stage == ASYNC_DONE;
+}
+
+void ezp_async_free(ezp_async *op) {
+    if (!op) return;
+    libusb_free_transfer(op->control);
+    free(op);
+}
 
 const char * const ezp_flash_enum_str[] = {
     "SPI_FLASH",
@@ -294,30 +1823,35 @@ const char * const ezp_flash_enum_str[] = {
 
 
 int ezp_test_flash(ezp_programmer *programmer, ezp_flash *type, uint32_t *chip_id) {
+    phase_timer timer;
+    phase_begin(&timer, programmer, EZP_STATS_TEST);
+
     //send first packet with chip data 00 09
     usb_packet packet = {
             .command = COMMAND_CHECK_CHIP
     };
     usb_packet_flip(&packet);
-    int ret = send_to_programmer(programmer->handle, (uint8_t *) &packet, sizeof(usb_packet), 0);
+    int ret = send_to_programmer(programmer, (uint8_t *) &packet, sizeof(usb_packet), 0);
     CHECK_RESULT(ret, {
         return EZP_LIBUSB_ERROR;
     })
     //read response
     uint8_t buffer[64];
-    ret = recv_from_programmer(programmer->handle, buffer, sizeof(usb_packet));
+    ret = recv_from_programmer(programmer, buffer, sizeof(usb_packet));
     CHECK_RESULT(ret, {
         return EZP_LIBUSB_ERROR;
     })
+    phase_end(&timer, EZP_PHASE_SETUP);
 
     //send reset packet 01 08
     memset(&packet, 0, sizeof(usb_packet));
     packet.command = COMMAND_RESET;
     usb_packet_flip(&packet);
-    ret = send_to_programmer(programmer->handle, (uint8_t *) &packet, sizeof(usb_packet), 0);
+    ret = send_to_programmer(programmer, (uint8_t *) &packet, sizeof(usb_packet), 0);
     CHECK_RESULT(ret, {
         return EZP_LIBUSB_ERROR;
     })
+    phase_end(&timer, EZP_PHASE_RESET);
 
     *type = buffer[0];
     *chip_id = htonl(*(uint32_t *) (buffer)) & ~(0xff << 24);
@@ -381,47 +1915,151 @@ hotplug_callback(libusb_context *ctx, libusb_device *dev, libusb_hotplug_event e
     return 0;
 }
 
-int ezp_listen_programmer_status(ezp_status_callback callback, void *user_data) {
-    if (!libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG)) {
-        return EZP_HOTPLUG_UNSUPPORTED;
-    }
-
-    internal_user_data iud;
-    iud.callback = callback;
-    iud.user_data = user_data;
+//caller holds context->lock
+static int register_status_locked(ezp_context *context, ezp_status_callback callback, void *user_data) {
+    if (context->registered) return EZP_LIBUSB_ERROR; //one status callback per context
 
-    int res = libusb_hotplug_register_callback(NULL,
+    context->status.callback = callback;
+    context->status.user_data = user_data;
+    int res = libusb_hotplug_register_callback(context->usb,
                                                LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED | LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT,
-                                               0, VID, PID, LIBUSB_HOTPLUG_MATCH_ANY, hotplug_callback, &iud,
-                                               &hotplug_cb_handle);
+                                               0, VID, PID, LIBUSB_HOTPLUG_MATCH_ANY, hotplug_callback,
+                                               &context->status, &context->hotplug_cb_handle);
     CHECK_RESULT(res, {
         fprintf(stderr, "Error: libusb_hotplug_register_callback\n");
         return EZP_LIBUSB_ERROR;
     })
+    context->registered = 1;
+    return EZP_OK;
+}
+
+//caller holds context->lock
+static void deregister_status_locked(ezp_context *context) {
+    if (!context->registered) return;
+    libusb_hotplug_deregister_callback(context->usb, context->hotplug_cb_handle);
+    context->registered = 0;
+}
+
+int ezp_context_register_status_callback(ezp_context *context, ezp_status_callback callback, void *user_data) {
+    if (!libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG)) {
+        return EZP_HOTPLUG_UNSUPPORTED;
+    }
+    pthread_mutex_lock(&context->lock);
+    int ret = register_status_locked(context, callback, user_data);
+    pthread_mutex_unlock(&context->lock);
+    return ret;
+}
+
+void ezp_context_deregister_status_callback(ezp_context *context) {
+    pthread_mutex_lock(&context->lock);
+    deregister_status_locked(context);
+    pthread_mutex_unlock(&context->lock);
+}
+
+const struct libusb_pollfd **ezp_context_get_pollfds(ezp_context *context) {
+    return libusb_get_pollfds(context->usb);
+}
+
+void ezp_context_set_pollfd_notifiers(ezp_context *context, libusb_pollfd_added_cb added_cb,
+                                      libusb_pollfd_removed_cb removed_cb, void *user_data) {
+    libusb_set_pollfd_notifiers(context->usb, added_cb, removed_cb, user_data);
+}
+
+int ezp_context_get_next_timeout(ezp_context *context, struct timeval *tv) {
+    int ret = libusb_get_next_timeout(context->usb, tv);
+    if (ret < 0) return EZP_LIBUSB_ERROR;
+    return ret;
+}
+
+int ezp_programmer_handle_events(ezp_programmer *programmer) {
+    struct timeval zero = {0, 0};
+    int ret = programmer->transport->handle_events(programmer->transport, &zero, NULL);
+    if (ret != LIBUSB_SUCCESS && ret != LIBUSB_ERROR_INTERRUPTED) return EZP_LIBUSB_ERROR;
+    return EZP_OK;
+}
+
+int ezp_context_handle_events(ezp_context *context) {
+    struct timeval zero = {0, 0};
+    int ret = libusb_handle_events_timeout_completed(context->usb, &zero, NULL);
+    if (ret != LIBUSB_SUCCESS && ret != LIBUSB_ERROR_INTERRUPTED) return EZP_LIBUSB_ERROR;
+    return EZP_OK;
+}
+
+int ezp_context_listen_programmer_status(ezp_context *context, ezp_status_callback callback, void *user_data) {
+    if (!libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG)) {
+        return EZP_HOTPLUG_UNSUPPORTED;
+    }
+
+    pthread_mutex_lock(&context->lock);
+    if (context->listening || !context->listener_finished) {
+        pthread_mutex_unlock(&context->lock);
+        return EZP_LIBUSB_ERROR; //one listener per context
+    }
+    int ret = register_status_locked(context, callback, user_data);
+    if (ret != EZP_OK) {
+        pthread_mutex_unlock(&context->lock);
+        return ret;
+    }
+    context->listening = 1;
+    context->listener_finished = 0;
+    pthread_mutex_unlock(&context->lock);
 
-    status_listener_running = 1;
-    while (status_listener_running) {
-        res = libusb_handle_events(NULL);
+    for (;;) {
+        pthread_mutex_lock(&context->lock);
+        int listening = context->listening;
+        pthread_mutex_unlock(&context->lock);
+        if (!listening) break;
+
+        int res = libusb_handle_events(context->usb);
         CHECK_RESULT(res, {
             fprintf(stderr, "Error: libusb_handle_events\n");
-            return EZP_LIBUSB_ERROR;
+            ret = EZP_LIBUSB_ERROR;
+            break;
         })
     }
-    status_listener_finished = 1;
-    return 0;
+
+    pthread_mutex_lock(&context->lock);
+    if (context->listening) { //left on error, nobody deregistered the callback
+        deregister_status_locked(context);
+        context->listening = 0;
+    }
+    context->listener_finished = 1;
+    pthread_cond_broadcast(&context->cond);
+    pthread_mutex_unlock(&context->lock);
+    return ret;
+}
+
+int ezp_listen_programmer_status(ezp_status_callback callback, void *user_data) {
+    return ezp_context_listen_programmer_status(&default_context, callback, user_data);
+}
+
+void ezp_context_stop_listening(ezp_context *context) {
+    pthread_mutex_lock(&context->lock);
+    if (context->listening) {
+        context->listening = 0;
+        deregister_status_locked(context);
+        libusb_interrupt_event_handler(context->usb);
+    }
+    while (!context->listener_finished) pthread_cond_wait(&context->cond, &context->lock);
+    pthread_mutex_unlock(&context->lock);
 }
 
 void ezp_free_programmer(ezp_programmer *programmer) {
-    libusb_close(programmer->handle);
+    programmer->transport->close(programmer->transport);
     free(programmer);
 }
 
+void ezp_context_free(ezp_context *context) {
+    ezp_context_stop_listening(context);
+    ezp_context_deregister_status_callback(context);
+    libusb_exit(context->usb);
+    pthread_cond_destroy(&context->cond);
+    pthread_mutex_destroy(&context->lock);
+    free(context);
+}
+
 void ezp_free() {
-    if (status_listener_running) {
-        status_listener_running = 0;
-        libusb_hotplug_deregister_callback(NULL, hotplug_cb_handle);
-        while (!status_listener_finished) __asm__("nop");
-        status_listener_finished = 0;
-    }
+    ezp_context_stop_listening(&default_context);
+    ezp_context_deregister_status_callback(&default_context);
     libusb_exit(NULL);
-}
\ No newline at end of file
+}
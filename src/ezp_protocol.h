@@ -0,0 +1,36 @@
+#ifndef LIBEZP2023PLUS_EZP_PROTOCOL_H
+#define LIBEZP2023PLUS_EZP_PROTOCOL_H
+
+#include <stdint.h>
+
+#define COMMAND_RESET 0x0108
+#define COMMAND_START_TRANSACTION 0x5
+#define COMMAND_CHECK_CHIP 0x9
+#define COMMAND_SET_CHIP_DATA 0x7
+#define COMMAND_START_ERASING 0x0102
+#define COMMAND_ERASE 0x0a
+
+#define ENDPOINT_DATA_OUT 0x01
+#define ENDPOINT_COMMAND_OUT 0x02
+#define ENDPOINT_IN 0x82
+
+#define PROGRAMMER_CODE_EZP2023 0x9A7336BD
+
+/**
+ * Command packet, big-endian on the wire. Every command and every response is one packet
+ */
+typedef struct {
+    uint16_t command;
+    uint8_t clazz;
+    uint8_t algorithm;
+    uint16_t flash_page_size; //1,2,4...256
+    uint16_t delay;
+    uint32_t flash_size;
+    uint32_t chip_id;
+    uint8_t speed;
+    uint8_t dummy2[11];
+    uint8_t voltage;
+    uint8_t dummy4[35];
+} __attribute__((packed)) usb_packet;
+
+#endif //LIBEZP2023PLUS_EZP_PROTOCOL_H
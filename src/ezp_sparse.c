@@ -0,0 +1,191 @@
+#include "ezp_sparse.h"
+#include "ezp_errors.h"
+#include "ezp_kernels.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/**
+ * fd - data file
+ * error - why the sink stopped the read, EZP_OK while it runs
+ * runs - uniform runs found so far, adjacent chunks of one value merged
+ */
+typedef struct {
+    int fd;
+    int error;
+    ezp_run *runs;
+    uint32_t count;
+    uint32_t capacity;
+} sparse_writer;
+
+static int add_run(sparse_writer *writer, uint32_t offset, uint32_t length, uint8_t value) {
+    if (writer->count > 0) {
+        ezp_run *last = &writer->runs[writer->count - 1];
+        if (last->value == value && last->offset + last->length == offset) {
+            last->length += length;
+            return EZP_OK;
+        }
+    }
+    if (writer->count == writer->capacity) {
+        uint32_t capacity = writer->capacity ? writer->capacity * 2 : 64;
+        ezp_run *runs = realloc(writer->runs, capacity * sizeof(ezp_run));
+        if (!runs) return EZP_OUT_OF_MEMORY;
+        writer->runs = runs;
+        writer->capacity = capacity;
+    }
+    writer->runs[writer->count++] = (ezp_run) {
+            .offset = offset,
+            .length = length,
+            .value = value
+    };
+    return EZP_OK;
+}
+
+//uniform chunks are only recorded, so they stay holes of the truncated data file
+static int sparse_sink(const uint8_t *data, uint32_t offset, uint32_t size, void *user_data) {
+    sparse_writer *writer = user_data;
+    if (ezp_fill_span(data, size, data[0]) == size) {
+        writer->error = add_run(writer, offset, size, data[0]);
+        return writer->error != EZP_OK;
+    }
+    while (size > 0) {
+        ssize_t written = pwrite(writer->fd, data, size, offset);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) {
+            writer->error = EZP_ERROR_IO;
+            return 1;
+        }
+        data += written;
+        offset += written;
+        size -= written;
+    }
+    return 0;
+}
+
+static int write_runs(const char *runs_file, uint32_t size, const sparse_writer *writer) {
+    FILE *f = fopen(runs_file, "wb");
+    if (!f) return EZP_ERROR_IO;
+    ezp_runs_header header = {
+            .magic = EZP_RUNS_MAGIC,
+            .version = EZP_RUNS_VERSION,
+            .size = size,
+            .count = writer->count
+    };
+    int failed = fwrite(&header, sizeof(header), 1, f) != 1 ||
+                 fwrite(writer->runs, sizeof(ezp_run), writer->count, f) != writer->count;
+    if (fclose(f) != 0) failed = 1;
+    return failed ? EZP_ERROR_IO : EZP_OK;
+}
+
+int ezp_read_flash_to_sparse_file(ezp_programmer *programmer, const char *file, const char *runs_file,
+                                  ezp_chip_data *chip_data, ezp_speed speed, ezp_callback callback, void *user_data) {
+    if (chip_data->flash % chip_data->flash_page != 0)
+        return EZP_FLASH_SIZE_OR_PAGE_INVALID;
+
+    sparse_writer writer = {
+            .error = EZP_OK
+    };
+    writer.fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (writer.fd < 0) return EZP_ERROR_IO;
+    //a freshly truncated file is one big hole, so nothing has to be punched
+    if (ftruncate(writer.fd, chip_data->flash) != 0) {
+        close(writer.fd);
+        return EZP_ERROR_IO;
+    }
+
+    int ret = ezp_read_flash_stream(programmer, chip_data, speed, sparse_sink, &writer, callback, user_data);
+    if (ret == EZP_ABORTED && writer.error != EZP_OK) ret = writer.error;
+    if (close(writer.fd) != 0 && ret == EZP_OK) ret = EZP_ERROR_IO;
+    if (ret == EZP_OK) ret = write_runs(runs_file, chip_data->flash, &writer);
+    free(writer.runs);
+    return ret;
+}
+
+static int read_runs(const char *runs_file, ezp_runs_header *header, ezp_run **runs) {
+    FILE *f = fopen(runs_file, "rb");
+    if (!f) return EZP_ERROR_IO;
+    if (fread(header, sizeof(ezp_runs_header), 1, f) != 1 || header->magic != EZP_RUNS_MAGIC ||
+        header->version != EZP_RUNS_VERSION) {
+        fclose(f);
+        return EZP_ERROR_INVALID_FILE;
+    }
+    *runs = malloc(header->count ? header->count * sizeof(ezp_run) : 1);
+    if (!*runs) {
+        fclose(f);
+        return EZP_OUT_OF_MEMORY;
+    }
+    size_t count = fread(*runs, sizeof(ezp_run), header->count, f);
+    fclose(f);
+
+    //runs must be sorted, disjoint and inside the image
+    uint32_t end = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if ((*runs)[i].offset < end || (*runs)[i].offset > header->size ||
+            (*runs)[i].length > header->size - (*runs)[i].offset) {
+            count = 0;
+            break;
+        }
+        end = (*runs)[i].offset + (*runs)[i].length;
+    }
+    if (count != header->count) {
+        free(*runs);
+        return EZP_ERROR_INVALID_FILE;
+    }
+    return EZP_OK;
+}
+
+int ezp_load_sparse_file(const char *file, const char *runs_file, uint8_t **data, uint32_t *size) {
+    ezp_runs_header header;
+    ezp_run *runs;
+    int ret = read_runs(runs_file, &header, &runs);
+    if (ret != EZP_OK) return ret;
+
+    int fd = open(file, O_RDONLY);
+    if (fd < 0) {
+        free(runs);
+        return EZP_ERROR_IO;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size != header.size) {
+        close(fd);
+        free(runs);
+        return EZP_ERROR_INVALID_FILE;
+    }
+    uint8_t *image = malloc(header.size ? header.size : 1);
+    if (!image) {
+        close(fd);
+        free(runs);
+        return EZP_OUT_OF_MEMORY;
+    }
+    //only pages outside the runs are touched, holes are never faulted in
+    const uint8_t *map = NULL;
+    if (header.size) {
+        map = mmap(NULL, header.size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            close(fd);
+            free(runs);
+            free(image);
+            return EZP_ERROR_IO;
+        }
+    }
+
+    uint32_t position = 0;
+    for (uint32_t i = 0; i < header.count; ++i) {
+        memcpy(image + position, map + position, runs[i].offset - position);
+        memset(image + runs[i].offset, runs[i].value, runs[i].length);
+        position = runs[i].offset + runs[i].length;
+    }
+    if (position < header.size) memcpy(image + position, map + position, header.size - position);
+
+    if (map) munmap((void *) map, header.size);
+    close(fd);
+    free(runs);
+    *data = image;
+    *size = header.size;
+    return EZP_OK;
+}
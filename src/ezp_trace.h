@@ -0,0 +1,20 @@
+#ifndef LIBEZP2023PLUS_EZP_TRACE_H
+#define LIBEZP2023PLUS_EZP_TRACE_H
+
+#include "ezp_capture.h"
+
+/**
+ * Append a completed transfer to a capture
+ * @param capture
+ * @param endpoint
+ * @param data transfer buffer
+ * @param length bytes requested
+ * @param actual_length bytes transferred
+ * @param status libusb error code the transfer completed with
+ * @param started monotonic seconds the transfer was submitted at
+ * @param finished monotonic seconds the transfer completed at
+ */
+void ezp_capture_record(ezp_capture *capture, unsigned char endpoint, const uint8_t *data, int length,
+                        int actual_length, int status, double started, double finished);
+
+#endif //LIBEZP2023PLUS_EZP_TRACE_H
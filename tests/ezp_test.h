@@ -0,0 +1,70 @@
+#ifndef LIBEZP2023PLUS_EZP_TEST_H
+#define LIBEZP2023PLUS_EZP_TEST_H
+
+#include "ezp_prog.h"
+#include "ezp_emulator.h"
+#include "ezp_errors.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TEST_FLASH_SIZE (256 * 1024)
+#define TEST_CHIP_ID 0xef4018
+
+/**
+ * Fail the current test when condition does not hold. Tests return 0 when they pass
+ */
+#define CHECK(condition) do { \
+    if (!(condition)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+        return 1; \
+    } \
+} while (0)
+
+/**
+ * Run a test and count it as failed when it returns non zero
+ */
+#define RUN(test, failed) do { \
+    if (test()) { \
+        fprintf(stderr, "FAIL %s\n", #test); \
+        (failed)++; \
+    } else { \
+        printf("PASS %s\n", #test); \
+    } \
+} while (0)
+
+//fields are assigned one by one, partial initializers warn when C++ tests include this header
+static inline ezp_chip_data test_chip(uint32_t flash) {
+    ezp_chip_data chip_data;
+    memset(&chip_data, 0, sizeof(chip_data));
+    strcpy(chip_data.name, "SPI_FLASH,TEST,EMULATED");
+    chip_data.chip_id = TEST_CHIP_ID;
+    chip_data.flash = flash;
+    chip_data.flash_page = 256;
+    chip_data.clazz = SPI_FLASH;
+    return chip_data;
+}
+
+//emulator without timing, so tests only wait for the host
+static inline ezp_emulator_config test_config(uint32_t flash) {
+    ezp_emulator_config config;
+    memset(&config, 0, sizeof(config));
+    config.flash_size = flash;
+    config.chip_id = TEST_CHIP_ID;
+    config.type = SPI_FLASH;
+    return config;
+}
+
+//deterministic image, different for every seed
+static inline uint8_t *test_image(uint32_t size, uint32_t seed) {
+    uint8_t *image = (uint8_t *) malloc(size);
+    if (!image) return NULL;
+    uint32_t state = seed * 2654435761u + 1;
+    for (uint32_t i = 0; i < size; ++i) {
+        state = state * 1103515245u + 12345u;
+        image[i] = (uint8_t) (state >> 16);
+    }
+    return image;
+}
+
+#endif //LIBEZP2023PLUS_EZP_TEST_H
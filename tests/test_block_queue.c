@@ -0,0 +1,113 @@
+#include "ezp_test.h"
+
+/**
+ * Progress reports the offset of every completed block, like the original page loop did, so the last
+ * report is the start of the last block
+ * last - current of the previous progress call
+ * max - max of the previous progress call
+ * calls - progress calls
+ * ordered - current never went backwards
+ */
+typedef struct {
+    uint32_t last;
+    uint32_t max;
+    unsigned int calls;
+    int ordered;
+} progress;
+
+static void on_progress(uint32_t current, uint32_t max, void *user_data) {
+    progress *state = user_data;
+    if (current < state->last) state->ordered = 0;
+    state->last = current;
+    state->max = max;
+    state->calls++;
+}
+
+static void on_done(ezp_async *op, int result, void *user_data) {
+    (void) op;
+    *(int *) user_data = result;
+}
+
+static int read_async(ezp_programmer *programmer, uint8_t *data, ezp_chip_data *chip_data) {
+    int result = 1;
+    ezp_async *op;
+    int ret = ezp_read_flash_async(programmer, data, chip_data, SPEED_12MHZ, NULL, on_done, &result, &op);
+    if (ret != EZP_OK) return ret;
+    while (!ezp_async_finished(op)) ezp_programmer_handle_events(programmer);
+    ezp_async_free(op);
+    return result;
+}
+
+static int round_trip(unsigned int depth) {
+    ezp_emulator_config config = test_config(TEST_FLASH_SIZE);
+    ezp_programmer *programmer = ezp_emulator_new(&config);
+    ezp_chip_data chip_data = test_chip(TEST_FLASH_SIZE);
+    uint8_t *image = test_image(TEST_FLASH_SIZE, depth);
+    uint8_t *read = calloc(1, TEST_FLASH_SIZE);
+    CHECK(programmer && image && read);
+    ezp_set_queue_depth(programmer, depth);
+
+    progress written = {.ordered = 1}, verified = {.ordered = 1};
+    int write = ezp_write_flash(programmer, image, &chip_data, SPEED_12MHZ, on_progress, &written);
+    int verify = ezp_verify_flash(programmer, image, &chip_data, SPEED_12MHZ, NULL, NULL, 0, on_progress, &verified);
+    int ret = read_async(programmer, read, &chip_data);
+    ezp_free_programmer(programmer);
+    CHECK(write == EZP_OK);
+    CHECK(written.ordered && written.calls > 0 && written.max == TEST_FLASH_SIZE && written.last < written.max);
+    CHECK(verify == EZP_OK);
+    CHECK(verified.ordered && verified.calls > 0 && verified.max == TEST_FLASH_SIZE);
+    CHECK(ret == EZP_OK);
+    CHECK(memcmp(read, image, TEST_FLASH_SIZE) == 0);
+    free(read);
+    free(image);
+    return 0;
+}
+
+static int test_depth_1() {
+    return round_trip(1);
+}
+
+static int test_depth_8() {
+    return round_trip(8);
+}
+
+//a failure in the middle of a full queue cancels the rest, and the next operation starts clean
+static int failure(unsigned int depth) {
+    ezp_emulator_config config = test_config(TEST_FLASH_SIZE);
+    config.fail_transfer = 20;
+    ezp_programmer *programmer = ezp_emulator_new(&config);
+    ezp_chip_data chip_data = test_chip(TEST_FLASH_SIZE);
+    uint8_t *image = test_image(TEST_FLASH_SIZE, 10 + depth);
+    uint8_t *read = calloc(1, TEST_FLASH_SIZE);
+    CHECK(programmer && image && read);
+    ezp_set_queue_depth(programmer, depth);
+    memcpy(ezp_emulator_flash(programmer), image, TEST_FLASH_SIZE);
+
+    int failed = read_async(programmer, read, &chip_data);
+    int ret = read_async(programmer, read, &chip_data);
+    int equal = memcmp(read, image, TEST_FLASH_SIZE) == 0;
+    ezp_free_programmer(programmer);
+    free(read);
+    free(image);
+    CHECK(failed == EZP_LIBUSB_ERROR);
+    CHECK(ret == EZP_OK);
+    CHECK(equal);
+    return 0;
+}
+
+static int test_failure_depth_1() {
+    return failure(1);
+}
+
+static int test_failure_depth_8() {
+    return failure(8);
+}
+
+int main() {
+    int failed = 0;
+    RUN(test_depth_1, failed);
+    RUN(test_depth_8, failed);
+    RUN(test_failure_depth_1, failed);
+    RUN(test_failure_depth_8, failed);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,212 @@
+#include "ezp_test.h"
+#include <pthread.h>
+#include <unistd.h>
+
+#define DB_ENTRIES 4000
+#define DB_THREADS 4
+#define DB_ROUNDS 8
+
+static char legacy_file[] = "/tmp/ezp_test_XXXXXX";
+
+//entries in scrambled name order, so opening has real sorting to do
+static int write_legacy() {
+    ezp_chip_data *entries = calloc(DB_ENTRIES, sizeof(ezp_chip_data));
+    CHECK(entries);
+    for (uint32_t i = 0; i < DB_ENTRIES; ++i) {
+        uint32_t number = i * 2654435761u % 1000003u;
+        snprintf(entries[i].name, sizeof(entries[i].name), "SPI_FLASH,MAKER,CHIP%07u", number);
+        entries[i].chip_id = 0x100000 + i % 64;
+        entries[i].flash = 65536;
+        entries[i].flash_page = 256;
+    }
+    int fd = mkstemp(legacy_file);
+    CHECK(fd >= 0);
+    close(fd);
+    int ret = ezp_chips_data_write(entries, DB_ENTRIES, legacy_file);
+    free(entries);
+    CHECK(ret == EZP_OK);
+    return 0;
+}
+
+//every entry matches the prefix, and they come sorted by name
+static int check_name_order(const ezp_chips_db *db) {
+    uint32_t *matches = malloc(DB_ENTRIES * sizeof(uint32_t));
+    CHECK(matches);
+    CHECK(ezp_chips_db_find_prefix(db, "chip", matches, DB_ENTRIES) == DB_ENTRIES);
+    ezp_chip_data previous, current;
+    CHECK(ezp_chips_db_get(db, matches[0], &previous) == EZP_OK);
+    for (uint32_t i = 1; i < DB_ENTRIES; ++i) {
+        CHECK(ezp_chips_db_get(db, matches[i], &current) == EZP_OK);
+        CHECK(strcmp(previous.name, current.name) < 0);
+        previous = current;
+    }
+    free(matches);
+    return 0;
+}
+
+static void *open_rounds(void *arg) {
+    (void) arg;
+    for (int round = 0; round < DB_ROUNDS; ++round) {
+        ezp_chips_db *db;
+        if (ezp_chips_db_open(&db, legacy_file) != EZP_OK) return (void *) 1;
+        int failed = check_name_order(db);
+        ezp_chips_db_close(db);
+        if (failed) return (void *) 1;
+    }
+    return NULL;
+}
+
+//every id is found, each entry once
+static int check_ids(const ezp_chips_db *db) {
+    size_t total = 0;
+    for (uint32_t id = 0; id < 64; ++id) total += ezp_chips_db_find_by_id(db, 0x100000 + id, NULL, 0);
+    CHECK(total == DB_ENTRIES);
+    return 0;
+}
+
+static void *convert_rounds(void *arg) {
+    (void) arg;
+    char file[] = "/tmp/ezp_test_XXXXXX";
+    int fd = mkstemp(file);
+    if (fd < 0) return (void *) 1;
+    close(fd);
+    int failed = 0;
+    for (int round = 0; round < DB_ROUNDS && !failed; ++round) {
+        ezp_chips_db *db;
+        if (ezp_chips_data_convert(legacy_file, file) != EZP_OK || ezp_chips_db_open(&db, file) != EZP_OK) {
+            failed = 1;
+            break;
+        }
+        failed = check_name_order(db) || check_ids(db);
+        ezp_chips_db_close(db);
+    }
+    unlink(file);
+    return failed ? (void *) 1 : NULL;
+}
+
+static int run_threads(void *(*rounds)(void *)) {
+    pthread_t threads[DB_THREADS];
+    for (int i = 0; i < DB_THREADS; ++i) CHECK(pthread_create(&threads[i], NULL, rounds, NULL) == 0);
+    int failed = 0;
+    for (int i = 0; i < DB_THREADS; ++i) {
+        void *result;
+        pthread_join(threads[i], &result);
+        failed |= result != NULL;
+    }
+    return failed;
+}
+
+static int test_concurrent_open() {
+    CHECK(run_threads(open_rounds) == 0);
+    return 0;
+}
+
+static int test_concurrent_convert() {
+    CHECK(run_threads(convert_rounds) == 0);
+    return 0;
+}
+
+static const char *const search_names[] = {
+        "SPI_FLASH,WINBOND,W25Q64FV",
+        "SPI_FLASH,WINBOND,W25Q128FV",
+        "SPI_FLASH,GIGADEVICE,GD25Q64",
+        "SPI_FLASH,ELM,GD25Q64",
+        "24_EEPROM,ATMEL,AT24C64",
+        "24_EEPROM,WINBOND,W24C02"
+};
+
+//the matches are exactly the entries with the expected names, in any order
+static int check_matches(const ezp_chips_db *db, const uint32_t *matches, size_t count, const char *const *expected,
+                         size_t expected_count) {
+    CHECK(count == expected_count);
+    for (size_t i = 0; i < expected_count; ++i) {
+        int found = 0;
+        for (size_t j = 0; j < count; ++j) {
+            ezp_chip_data chip_data;
+            CHECK(ezp_chips_db_get(db, matches[j], &chip_data) == EZP_OK);
+            found |= strcmp(chip_data.name, expected[i]) == 0;
+        }
+        CHECK(found);
+    }
+    return 0;
+}
+
+static int check_search(const ezp_chips_db *db) {
+    static const char *const queries[] = {"W25Q64FV", "w25q64-fv", " w25 q64 fv "};
+    uint32_t matches[8];
+    //case and separators are ignored, and so are type and manufacturer
+    for (size_t i = 0; i < sizeof(queries) / sizeof(queries[0]); ++i) {
+        size_t count = ezp_chips_db_find_by_name(db, queries[i], matches, 8);
+        CHECK(check_matches(db, matches, count, (const char *const[]) {"SPI_FLASH,WINBOND,W25Q64FV"}, 1) == 0);
+    }
+    CHECK(ezp_chips_db_find_by_name(db, "winbond", matches, 8) == 0);
+    CHECK(ezp_chips_db_find_by_name(db, "W25Q64", matches, 8) == 0);
+
+    //one name made by two manufacturers
+    size_t count = ezp_chips_db_find_by_name(db, "gd25q64", matches, 8);
+    CHECK(check_matches(db, matches, count,
+                        (const char *const[]) {"SPI_FLASH,GIGADEVICE,GD25Q64", "SPI_FLASH,ELM,GD25Q64"}, 2) == 0);
+    CHECK(ezp_chips_db_find_by_name(db, "GD25Q64", matches, 1) == 2);
+
+    //substrings of type, manufacturer or chip name
+    count = ezp_chips_db_search(db, "winbond", matches, 8);
+    CHECK(check_matches(db, matches, count, (const char *const[]) {"SPI_FLASH,WINBOND,W25Q64FV",
+            "SPI_FLASH,WINBOND,W25Q128FV", "24_EEPROM,WINBOND,W24C02"}, 3) == 0);
+    count = ezp_chips_db_search(db, "24c", matches, 8);
+    CHECK(check_matches(db, matches, count,
+                        (const char *const[]) {"24_EEPROM,ATMEL,AT24C64", "24_EEPROM,WINBOND,W24C02"}, 2) == 0);
+    count = ezp_chips_db_search(db, "Q64", matches, 8);
+    CHECK(check_matches(db, matches, count, (const char *const[]) {"SPI_FLASH,WINBOND,W25Q64FV",
+            "SPI_FLASH,GIGADEVICE,GD25Q64", "SPI_FLASH,ELM,GD25Q64"}, 3) == 0);
+    CHECK(ezp_chips_db_search(db, "w25q64-fv", matches, 8) == 0);
+    return 0;
+}
+
+//name lookups and search give the same results on both formats
+static int test_search() {
+    size_t count = sizeof(search_names) / sizeof(search_names[0]);
+    ezp_chip_data entries[sizeof(search_names) / sizeof(search_names[0])];
+    memset(entries, 0, sizeof(entries));
+    for (size_t i = 0; i < count; ++i) {
+        snprintf(entries[i].name, sizeof(entries[i].name), "%s", search_names[i]);
+        entries[i].chip_id = 0x200000 + i;
+        entries[i].flash = 65536;
+        entries[i].flash_page = 256;
+        entries[i].clazz = strncmp(search_names[i], "24_EEPROM", 9) == 0 ? EEPROM_24 : SPI_FLASH;
+    }
+    char legacy[] = "/tmp/ezp_test_XXXXXX";
+    char indexed[] = "/tmp/ezp_test_XXXXXX";
+    int legacy_fd = mkstemp(legacy);
+    int indexed_fd = mkstemp(indexed);
+    CHECK(legacy_fd >= 0 && indexed_fd >= 0);
+    close(legacy_fd);
+    close(indexed_fd);
+    int written = ezp_chips_data_write(entries, count, legacy);
+    int converted = ezp_chips_data_convert(legacy, indexed);
+
+    int failed = written != EZP_OK || converted != EZP_OK;
+    const char *files[] = {legacy, indexed};
+    for (size_t i = 0; i < 2 && !failed; ++i) {
+        ezp_chips_db *db;
+        if (ezp_chips_db_open(&db, files[i]) != EZP_OK) {
+            failed = 1;
+            break;
+        }
+        failed = ezp_chips_db_count(db) != count || check_search(db);
+        ezp_chips_db_close(db);
+    }
+    unlink(legacy);
+    unlink(indexed);
+    CHECK(!failed);
+    return 0;
+}
+
+int main() {
+    if (write_legacy()) return EXIT_FAILURE;
+    int failed = 0;
+    RUN(test_concurrent_open, failed);
+    RUN(test_concurrent_convert, failed);
+    RUN(test_search, failed);
+    unlink(legacy_file);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,95 @@
+#include "ezp_test.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <unistd.h>
+
+/**
+ * ret - what the listener returned
+ * finished - set once the listener returned
+ */
+typedef struct {
+    ezp_context *context;
+    int ret;
+    atomic_int finished;
+} listener;
+
+static void on_status(ezp_status status, void *user_data) {
+    (void) status;
+    (void) user_data;
+}
+
+static void *listen_status(void *arg) {
+    listener *state = arg;
+    state->ret = ezp_context_listen_programmer_status(state->context, on_status, NULL);
+    atomic_store(&state->finished, 1);
+    return NULL;
+}
+
+//libusb may not reach any USB bus in the test environment, then there is nothing to test
+static int new_context(ezp_context **context) {
+    if (ezp_context_new(context) == 0) return 1;
+    printf("SKIP no libusb context\n");
+    return 0;
+}
+
+//users compiled against the first releases read handle at offset 0
+static int test_handle_first() {
+    CHECK(offsetof(ezp_programmer, handle) == 0);
+    return 0;
+}
+
+static int test_contexts_independent() {
+    ezp_context *first, *second;
+    if (!new_context(&first)) return 0;
+    CHECK(ezp_context_new(&second) == 0);
+    CHECK(first != second && first != ezp_default_context());
+
+    //one status callback per context, registering on one does not affect the other
+    int registered = ezp_context_register_status_callback(first, on_status, NULL);
+    if (registered != EZP_HOTPLUG_UNSUPPORTED) {
+        CHECK(registered == EZP_OK);
+        CHECK(ezp_context_register_status_callback(first, on_status, NULL) == EZP_LIBUSB_ERROR);
+        CHECK(ezp_context_register_status_callback(second, on_status, NULL) == EZP_OK);
+        ezp_context_deregister_status_callback(first);
+        CHECK(ezp_context_register_status_callback(first, on_status, NULL) == EZP_OK);
+    }
+    struct timeval timeout;
+    CHECK(ezp_context_get_next_timeout(first, &timeout) >= 0);
+    CHECK(ezp_context_handle_events(second) == EZP_OK);
+    ezp_context_free(first);
+    ezp_context_free(second);
+    return 0;
+}
+
+//stopping a listener that has not started yet does nothing, so stop until it has returned
+static int listen_and_stop(listener *state) {
+    pthread_t thread;
+    atomic_store(&state->finished, 0);
+    CHECK(pthread_create(&thread, NULL, listen_status, state) == 0);
+    while (!atomic_load(&state->finished)) {
+        ezp_context_stop_listening(state->context);
+        usleep(1000);
+    }
+    pthread_join(thread, NULL);
+    CHECK(state->ret == EZP_OK || state->ret == EZP_HOTPLUG_UNSUPPORTED);
+    return 0;
+}
+
+//a stopped listener can be started again
+static int test_stop_listening() {
+    listener state = {0};
+    if (!new_context(&state.context)) return 0;
+    CHECK(listen_and_stop(&state) == 0);
+    CHECK(listen_and_stop(&state) == 0);
+    ezp_context_free(state.context);
+    return 0;
+}
+
+int main() {
+    int failed = 0;
+    RUN(test_handle_first, failed);
+    RUN(test_contexts_independent, failed);
+    RUN(test_stop_listening, failed);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
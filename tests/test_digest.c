@@ -0,0 +1,63 @@
+#include "ezp_test.h"
+
+#define DIGEST_SECTOR_SIZE 4096
+#define DIGEST_SECTORS (TEST_FLASH_SIZE / DIGEST_SECTOR_SIZE)
+
+static int same_digest(const ezp_digest *first, const ezp_digest *second) {
+    return first->crc32 == second->crc32 && first->xxh64 == second->xxh64;
+}
+
+//digests computed while reading equal the ones of the image, with and without a destination buffer
+static int test_read_digest() {
+    uint8_t *image = test_image(TEST_FLASH_SIZE, 40);
+    uint8_t *read = malloc(TEST_FLASH_SIZE);
+    CHECK(image && read);
+    ezp_digest expected, expected_sectors[DIGEST_SECTORS];
+    ezp_digest_image(image, TEST_FLASH_SIZE, &expected, DIGEST_SECTOR_SIZE, expected_sectors);
+
+    ezp_emulator_config config = test_config(TEST_FLASH_SIZE);
+    ezp_programmer *programmer = ezp_emulator_new(&config);
+    CHECK(programmer);
+    memcpy(ezp_emulator_flash(programmer), image, TEST_FLASH_SIZE);
+    ezp_chip_data chip_data = test_chip(TEST_FLASH_SIZE);
+    uint8_t *destinations[] = {read, NULL};
+    for (size_t i = 0; i < 2; ++i) {
+        ezp_digest digest, sectors[DIGEST_SECTORS];
+        memset(&digest, 0, sizeof(digest));
+        memset(sectors, 0, sizeof(sectors));
+        memset(read, 0, TEST_FLASH_SIZE);
+        int ret = ezp_read_flash_digest(programmer, destinations[i], &chip_data, SPEED_12MHZ, &digest,
+                                        DIGEST_SECTOR_SIZE, sectors, NULL, NULL);
+        CHECK(ret == EZP_OK);
+        CHECK(same_digest(&digest, &expected));
+        for (uint32_t j = 0; j < DIGEST_SECTORS; ++j) CHECK(same_digest(&sectors[j], &expected_sectors[j]));
+        if (destinations[i]) CHECK(memcmp(read, image, TEST_FLASH_SIZE) == 0);
+    }
+    ezp_free_programmer(programmer);
+    free(read);
+    free(image);
+    return 0;
+}
+
+static int test_bad_sector_size() {
+    //none, not a multiple of the transfer block, not dividing the chip
+    static const uint32_t sizes[] = {0, 100, 768};
+    ezp_emulator_config config = test_config(TEST_FLASH_SIZE);
+    ezp_programmer *programmer = ezp_emulator_new(&config);
+    CHECK(programmer);
+    ezp_chip_data chip_data = test_chip(TEST_FLASH_SIZE);
+    ezp_digest digest, sectors[TEST_FLASH_SIZE / 256];
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+        CHECK(ezp_read_flash_digest(programmer, NULL, &chip_data, SPEED_12MHZ, &digest, sizes[i], sectors,
+                                    NULL, NULL) == EZP_INVALID_RANGE);
+    }
+    ezp_free_programmer(programmer);
+    return 0;
+}
+
+int main() {
+    int failed = 0;
+    RUN(test_read_digest, failed);
+    RUN(test_bad_sector_size, failed);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,174 @@
+#include "ezp_test.h"
+
+static int test_detect() {
+    ezp_emulator_config config = test_config(TEST_FLASH_SIZE);
+    ezp_programmer *programmer = ezp_emulator_new(&config);
+    CHECK(programmer);
+    ezp_flash type;
+    uint32_t chip_id;
+    int ret = ezp_test_flash(programmer, &type, &chip_id);
+    ezp_free_programmer(programmer);
+    CHECK(ret == EZP_OK);
+    CHECK(type == SPI_FLASH);
+    CHECK(chip_id == TEST_CHIP_ID);
+    return 0;
+}
+
+static int test_round_trip() {
+    static const unsigned int depths[] = {1, 2, 8, 32};
+    ezp_chip_data chip_data = test_chip(TEST_FLASH_SIZE);
+    uint8_t *image = test_image(TEST_FLASH_SIZE, 1);
+    uint8_t *read = malloc(TEST_FLASH_SIZE);
+    CHECK(image && read);
+    for (size_t i = 0; i < sizeof(depths) / sizeof(depths[0]); ++i) {
+        ezp_emulator_config config = test_config(TEST_FLASH_SIZE);
+        ezp_programmer *programmer = ezp_emulator_new(&config);
+        CHECK(programmer);
+        ezp_set_queue_depth(programmer, depths[i]);
+        int write = ezp_write_flash(programmer, image, &chip_data, SPEED_12MHZ, NULL, NULL);
+        int equal = memcmp(ezp_emulator_flash(programmer), image, TEST_FLASH_SIZE) == 0;
+        memset(read, 0, TEST_FLASH_SIZE);
+        int ret = ezp_read_flash_into(programmer, read, &chip_data, SPEED_12MHZ, NULL, NULL);
+        ezp_free_programmer(programmer);
+        CHECK(write == EZP_OK);
+        CHECK(equal);
+        CHECK(ret == EZP_OK);
+        CHECK(memcmp(read, image, TEST_FLASH_SIZE) == 0);
+    }
+    free(read);
+    free(image);
+    return 0;
+}
+
+static int test_verify() {
+    ezp_emulator_config config = test_config(TEST_FLASH_SIZE);
+    ezp_programmer *programmer = ezp_emulator_new(&config);
+    ezp_chip_data chip_data = test_chip(TEST_FLASH_SIZE);
+    uint8_t *image = test_image(TEST_FLASH_SIZE, 2);
+    CHECK(programmer && image);
+    memcpy(ezp_emulator_flash(programmer), image, TEST_FLASH_SIZE);
+    int same = ezp_verify_flash(programmer, image, &chip_data, SPEED_12MHZ, NULL, NULL, 0, NULL, NULL);
+
+    ezp_emulator_flash(programmer)[12345] ^= 0x10;
+    ezp_range *mismatches = NULL;
+    size_t count = 0;
+    int changed = ezp_verify_flash(programmer, image, &chip_data, SPEED_12MHZ, &mismatches, &count, 0, NULL, NULL);
+    ezp_free_programmer(programmer);
+    free(image);
+    CHECK(same == EZP_OK);
+    CHECK(changed == EZP_VERIFY_FAILED);
+    CHECK(count == 1);
+    CHECK(mismatches[0].offset == 12345 && mismatches[0].length == 1);
+    free(mismatches);
+    return 0;
+}
+
+static int test_erase() {
+    ezp_emulator_config config = test_config(TEST_FLASH_SIZE);
+    ezp_programmer *programmer = ezp_emulator_new(&config);
+    ezp_chip_data chip_data = test_chip(TEST_FLASH_SIZE);
+    uint8_t *image = test_image(TEST_FLASH_SIZE, 3);
+    CHECK(programmer && image);
+    memcpy(ezp_emulator_flash(programmer), image, TEST_FLASH_SIZE);
+    int ret = ezp_erase_flash(programmer, &chip_data, SPEED_12MHZ, EZP_ERASE_CHIP, 0, 0, 0, NULL, NULL);
+    uint32_t first_non_blank = 0;
+    int blank = ezp_blank_check_flash(programmer, &chip_data, SPEED_12MHZ, &first_non_blank, NULL, NULL);
+    ezp_free_programmer(programmer);
+    free(image);
+    CHECK(ret == EZP_OK);
+    CHECK(blank == EZP_OK);
+    return 0;
+}
+
+static int test_erase_sector_unsupported() {
+    ezp_emulator_config config = test_config(TEST_FLASH_SIZE);
+    ezp_programmer *programmer = ezp_emulator_new(&config);
+    ezp_chip_data chip_data = test_chip(TEST_FLASH_SIZE);
+    CHECK(programmer);
+    memset(ezp_emulator_flash(programmer), 0x5a, TEST_FLASH_SIZE);
+    int sector = ezp_erase_flash(programmer, &chip_data, SPEED_12MHZ, EZP_ERASE_SECTOR, 0, EZP_SECTOR_SIZE, 0,
+                                 NULL, NULL);
+    int block = ezp_erase_flash(programmer, &chip_data, SPEED_12MHZ, EZP_ERASE_BLOCK, 0, EZP_BLOCK_SIZE, 0,
+                                NULL, NULL);
+    int untouched = ezp_emulator_flash(programmer)[0] == 0x5a;
+    ezp_free_programmer(programmer);
+    CHECK(sector == EZP_UNSUPPORTED);
+    CHECK(block == EZP_UNSUPPORTED);
+    CHECK(untouched);
+    return 0;
+}
+
+static int test_injected_failure() {
+    ezp_emulator_config config = test_config(TEST_FLASH_SIZE);
+    config.fail_transfer = 3;
+    ezp_programmer *programmer = ezp_emulator_new(&config);
+    ezp_chip_data chip_data = test_chip(TEST_FLASH_SIZE);
+    uint8_t *image = test_image(TEST_FLASH_SIZE, 4);
+    CHECK(programmer && image);
+    ezp_set_queue_depth(programmer, 1);
+    int failed = ezp_write_flash(programmer, image, &chip_data, SPEED_12MHZ, NULL, NULL);
+    int ret = ezp_write_flash(programmer, image, &chip_data, SPEED_12MHZ, NULL, NULL);
+    int equal = memcmp(ezp_emulator_flash(programmer), image, TEST_FLASH_SIZE) == 0;
+    ezp_free_programmer(programmer);
+    free(image);
+    CHECK(failed == EZP_LIBUSB_ERROR);
+    CHECK(ret == EZP_OK);
+    CHECK(equal);
+    return 0;
+}
+
+//the speed byte of an eeprom_24 is its voltage, so SPEED_AUTO must not probe it
+static int test_auto_speed_eeprom() {
+    ezp_emulator_config config = test_config(TEST_FLASH_SIZE);
+    config.type = EEPROM_24;
+    ezp_programmer *programmer = ezp_emulator_new(&config);
+    ezp_chip_data chip_data = test_chip(TEST_FLASH_SIZE);
+    chip_data.clazz = EEPROM_24;
+    uint8_t *read = malloc(TEST_FLASH_SIZE);
+    CHECK(programmer && read);
+    ezp_speed speed = SPEED_AUTO;
+    int find = ezp_find_speed(programmer, &chip_data, &speed);
+    int ret = ezp_read_flash_into(programmer, read, &chip_data, SPEED_AUTO, NULL, NULL);
+    ezp_stats stats;
+    ezp_get_stats(programmer, &stats);
+    unsigned int cached = programmer->speed_cache_count;
+    ezp_free_programmer(programmer);
+    free(read);
+    CHECK(find == EZP_UNSUPPORTED);
+    CHECK(speed == SPEED_AUTO);
+    CHECK(ret == EZP_OK);
+    CHECK(stats.bytes_in < 2 * TEST_FLASH_SIZE); //one read, no samples
+    CHECK(cached == 0);
+    return 0;
+}
+
+//chips smaller than a transfer block have no blank tail to leave out
+static int test_blank_aware_small_chip() {
+    ezp_emulator_config config = test_config(32);
+    ezp_programmer *programmer = ezp_emulator_new(&config);
+    ezp_chip_data chip_data = test_chip(32);
+    chip_data.flash_page = 32;
+    uint8_t *image = malloc(32);
+    CHECK(programmer && image);
+    memset(image, 0xff, 32);
+    uint32_t skipped = 1;
+    int ret = ezp_write_flash_blank_aware(programmer, image, &chip_data, SPEED_12MHZ, &skipped, NULL, NULL);
+    ezp_free_programmer(programmer);
+    free(image);
+    CHECK(ret == EZP_OK);
+    CHECK(skipped == 0);
+    return 0;
+}
+
+int main() {
+    int failed = 0;
+    RUN(test_detect, failed);
+    RUN(test_round_trip, failed);
+    RUN(test_verify, failed);
+    RUN(test_erase, failed);
+    RUN(test_erase_sector_unsupported, failed);
+    RUN(test_injected_failure, failed);
+    RUN(test_blank_aware_small_chip, failed);
+    RUN(test_auto_speed_eeprom, failed);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
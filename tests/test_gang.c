@@ -0,0 +1,77 @@
+#include "ezp_test.h"
+#include "ezp_gang.h"
+
+#define GANG_SIZE 4
+
+static int gang(ezp_programmer **programmers, const ezp_emulator_config *configs, int verify,
+                const uint8_t *image, ezp_gang_result *results, int *ret) {
+    for (int i = 0; i < GANG_SIZE; ++i) {
+        programmers[i] = ezp_emulator_new(&configs[i]);
+        CHECK(programmers[i]);
+    }
+    ezp_chip_data chip_data = test_chip(TEST_FLASH_SIZE);
+    *ret = ezp_gang_write(programmers, GANG_SIZE, image, &chip_data, SPEED_12MHZ, verify, results);
+    return 0;
+}
+
+static int test_gang_write() {
+    ezp_emulator_config configs[GANG_SIZE];
+    for (int i = 0; i < GANG_SIZE; ++i) {
+        configs[i] = test_config(TEST_FLASH_SIZE);
+        configs[i].latency = 0.0005;
+        configs[i].bandwidth = 64e6;
+    }
+    uint8_t *image = test_image(TEST_FLASH_SIZE, 20);
+    CHECK(image);
+    ezp_programmer *programmers[GANG_SIZE];
+    ezp_gang_result results[GANG_SIZE];
+    int ret;
+    CHECK(gang(programmers, configs, 1, image, results, &ret) == 0);
+    int equal = 1;
+    for (int i = 0; i < GANG_SIZE; ++i) {
+        equal &= memcmp(ezp_emulator_flash(programmers[i]), image, TEST_FLASH_SIZE) == 0;
+        ezp_free_programmer(programmers[i]);
+    }
+    free(image);
+    CHECK(ret == EZP_OK);
+    CHECK(equal);
+    for (int i = 0; i < GANG_SIZE; ++i) {
+        CHECK(results[i].status == EZP_OK);
+        CHECK(results[i].write_throughput > 0);
+        CHECK(results[i].verify_throughput > 0);
+        CHECK(results[i].seconds > 0);
+    }
+    return 0;
+}
+
+//a failing programmer does not hold back the others
+static int test_gang_failure() {
+    ezp_emulator_config configs[GANG_SIZE];
+    for (int i = 0; i < GANG_SIZE; ++i) configs[i] = test_config(TEST_FLASH_SIZE);
+    configs[2].fail_transfer = 100;
+    uint8_t *image = test_image(TEST_FLASH_SIZE, 21);
+    CHECK(image);
+    ezp_programmer *programmers[GANG_SIZE];
+    ezp_gang_result results[GANG_SIZE];
+    int ret;
+    CHECK(gang(programmers, configs, 1, image, results, &ret) == 0);
+    int equal[GANG_SIZE];
+    for (int i = 0; i < GANG_SIZE; ++i) {
+        equal[i] = memcmp(ezp_emulator_flash(programmers[i]), image, TEST_FLASH_SIZE) == 0;
+        ezp_free_programmer(programmers[i]);
+    }
+    free(image);
+    CHECK(ret == EZP_LIBUSB_ERROR);
+    for (int i = 0; i < GANG_SIZE; ++i) {
+        CHECK(results[i].status == (i == 2 ? EZP_LIBUSB_ERROR : EZP_OK));
+        CHECK(equal[i] == (i != 2));
+    }
+    return 0;
+}
+
+int main() {
+    int failed = 0;
+    RUN(test_gang_write, failed);
+    RUN(test_gang_failure, failed);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,245 @@
+#include "ezp_test.h"
+#include "ezp_image.h"
+#include <unistd.h>
+
+#define SEGMENTS_FLASH_SIZE (16 * 1024)
+
+static char image_file[] = "/tmp/ezp_test_XXXXXX";
+
+static int write_file(const void *data, size_t size) {
+    FILE *f = fopen(image_file, "wb");
+    CHECK(f);
+    CHECK(fwrite(data, 1, size, f) == size);
+    CHECK(fclose(f) == 0);
+    return 0;
+}
+
+//Intel HEX record with its checksum
+static void ihex_record(FILE *f, uint8_t type, uint16_t address, const uint8_t *data, uint8_t length) {
+    uint8_t sum = length + (address >> 8) + (address & 0xff) + type;
+    fprintf(f, ":%02X%04X%02X", length, address, type);
+    for (uint8_t i = 0; i < length; ++i) {
+        fprintf(f, "%02X", data[i]);
+        sum += data[i];
+    }
+    fprintf(f, "%02X\n", (uint8_t) -sum);
+}
+
+//S-record of type 1, 2 or 3 with 2, 3 or 4 address bytes, or a header, count or termination record
+static void srec_record(FILE *f, unsigned int type, uint32_t address, const uint8_t *data, uint8_t length) {
+    static const uint8_t address_sizes[10] = {2, 2, 3, 4, 0, 2, 3, 4, 3, 2};
+    uint8_t address_size = address_sizes[type];
+    uint8_t count = address_size + length + 1;
+    uint8_t sum = count;
+    fprintf(f, "S%u%02X", type, count);
+    for (int i = address_size - 1; i >= 0; --i) {
+        uint8_t byte = (uint8_t) (address >> (8 * i));
+        fprintf(f, "%02X", byte);
+        sum += byte;
+    }
+    for (uint8_t i = 0; i < length; ++i) {
+        fprintf(f, "%02X", data[i]);
+        sum += data[i];
+    }
+    fprintf(f, "%02X\r\n", (uint8_t) ~sum);
+}
+
+static int is_blank(const uint8_t *data, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        if (data[i] != 0xff) return 0;
+    }
+    return 1;
+}
+
+static int open_image(ezp_image_format format, ezp_image **image) {
+    return ezp_image_open(image, image_file, format);
+}
+
+static int check_segment(const ezp_segment *segment, uint32_t offset, uint32_t length, const uint8_t *data) {
+    CHECK(segment->offset == offset);
+    CHECK(segment->length == length);
+    CHECK(memcmp(segment->data, data, length) == 0);
+    return 0;
+}
+
+//extended segment and linear address bases, records continuing each other merged into one segment
+static int test_ihex() {
+    uint8_t *data = test_image(64, 60);
+    CHECK(data);
+    static const uint8_t linear_base[] = {0x00, 0x01}, segment_base[] = {0x30, 0x00};
+    FILE *f = fopen(image_file, "w");
+    CHECK(f);
+    ihex_record(f, 0x00, 0x0000, data, 16);
+    ihex_record(f, 0x00, 0x0010, data + 16, 16);
+    ihex_record(f, 0x04, 0x0000, linear_base, 2);
+    ihex_record(f, 0x00, 0x0100, data + 32, 8);
+    ihex_record(f, 0x05, 0x0000, (const uint8_t[]) {0, 0, 0, 0}, 4);
+    ihex_record(f, 0x02, 0x0000, segment_base, 2);
+    ihex_record(f, 0x00, 0x0200, data + 40, 4);
+    ihex_record(f, 0x01, 0x0000, NULL, 0);
+    CHECK(fclose(f) == 0);
+
+    ezp_image *image;
+    CHECK(open_image(EZP_IMAGE_AUTO, &image) == EZP_OK);
+    size_t count;
+    const ezp_segment *segments = ezp_image_segments(image, &count);
+    CHECK(count == 3);
+    CHECK(check_segment(&segments[0], 0x00000, 32, data) == 0);
+    CHECK(check_segment(&segments[1], 0x10100, 8, data + 32) == 0);
+    CHECK(check_segment(&segments[2], 0x30200, 4, data + 40) == 0);
+    CHECK(ezp_image_end(image) == 0x30204);
+    ezp_image_close(image);
+    free(data);
+    return 0;
+}
+
+//records of every address size, out of order, sorted by offset once open
+static int test_srec() {
+    uint8_t *data = test_image(64, 61);
+    CHECK(data);
+    FILE *f = fopen(image_file, "w");
+    CHECK(f);
+    srec_record(f, 0, 0, (const uint8_t *) "test", 4);
+    srec_record(f, 3, 0x00020000, data, 8);
+    srec_record(f, 1, 0x0100, data + 8, 4);
+    srec_record(f, 2, 0x012345, data + 12, 6);
+    srec_record(f, 2, 0x01234b, data + 18, 6);
+    srec_record(f, 5, 4, NULL, 0);
+    srec_record(f, 9, 0, NULL, 0);
+    CHECK(fclose(f) == 0);
+
+    ezp_image *image;
+    CHECK(open_image(EZP_IMAGE_AUTO, &image) == EZP_OK);
+    size_t count;
+    const ezp_segment *segments = ezp_image_segments(image, &count);
+    CHECK(count == 3);
+    CHECK(check_segment(&segments[0], 0x0100, 4, data + 8) == 0);
+    CHECK(check_segment(&segments[1], 0x012345, 12, data + 12) == 0);
+    CHECK(check_segment(&segments[2], 0x00020000, 8, data) == 0);
+    CHECK(ezp_image_end(image) == 0x00020008);
+    ezp_image_close(image);
+    free(data);
+    return 0;
+}
+
+static int test_invalid() {
+    static const char *const files[] = {
+            ":0400000001020304F1\n:00000001FF\n", //checksum off by one
+            ":0400000001020304F2\n:0400020005060708E0\n:00000001FF\n", //second record overlaps the first
+            ":0400000001020304F2\n:0400000601020304EC\n", //unknown record type
+            ":04000000010203\n", //cut short
+            "S107010001020304EC\nS9030000FC\n", //checksum off by one
+            "S107010001020304ED\nS107010205060708DB\nS9030000FC\n", //second record overlaps the first
+            "S407010001020304ED\n" //S4 does not exist
+    };
+    for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); ++i) {
+        CHECK(write_file(files[i], strlen(files[i])) == 0);
+        ezp_image *image = NULL;
+        int ret = open_image(EZP_IMAGE_AUTO, &image);
+        if (ret != EZP_ERROR_INVALID_FILE) fprintf(stderr, "accepted file %zu\n", i);
+        CHECK(ret == EZP_ERROR_INVALID_FILE);
+        CHECK(image == NULL);
+    }
+    return 0;
+}
+
+//a binary shorter than the chip is one segment, the rest of the chip is written blank
+static int test_short_binary() {
+    uint8_t *data = test_image(1000, 62);
+    CHECK(data);
+    data[0] = 0x7f; //not a HEX or S-record start
+    CHECK(write_file(data, 1000) == 0);
+    ezp_image *image;
+    CHECK(open_image(EZP_IMAGE_AUTO, &image) == EZP_OK);
+    size_t count;
+    const ezp_segment *segments = ezp_image_segments(image, &count);
+    CHECK(count == 1);
+    CHECK(check_segment(&segments[0], 0, 1000, data) == 0);
+    CHECK(ezp_image_end(image) == 1000);
+
+    ezp_emulator_config config = test_config(SEGMENTS_FLASH_SIZE);
+    ezp_programmer *programmer = ezp_emulator_new(&config);
+    CHECK(programmer);
+    memset(ezp_emulator_flash(programmer), 0, SEGMENTS_FLASH_SIZE);
+    ezp_chip_data chip_data = test_chip(SEGMENTS_FLASH_SIZE);
+    int ret = ezp_write_flash_segments(programmer, segments, count, &chip_data, SPEED_12MHZ, NULL, NULL);
+    const uint8_t *flash = ezp_emulator_flash(programmer);
+    int equal = memcmp(flash, data, 1000) == 0;
+    int blank = is_blank(flash + 1000, SEGMENTS_FLASH_SIZE - 1000);
+    ezp_free_programmer(programmer);
+    ezp_image_close(image);
+    free(data);
+    CHECK(ret == EZP_OK);
+    CHECK(equal);
+    CHECK(blank);
+    return 0;
+}
+
+//segments straddling block edges, a segment inside one block, gaps and a segment ending the chip
+static int write_segments(unsigned int depth) {
+    uint8_t *data = test_image(SEGMENTS_FLASH_SIZE, 63);
+    uint8_t *expected = malloc(SEGMENTS_FLASH_SIZE);
+    CHECK(data && expected);
+    const ezp_segment segments[] = {
+            {100, 300, data + 100},
+            {1000, 24, data + 1000},
+            {1024, 2000, data + 1024},
+            {5000, 3192, data + 5000},
+            {SEGMENTS_FLASH_SIZE - 10, 10, data + SEGMENTS_FLASH_SIZE - 10}
+    };
+    size_t count = sizeof(segments) / sizeof(segments[0]);
+    memset(expected, 0xff, SEGMENTS_FLASH_SIZE);
+    for (size_t i = 0; i < count; ++i) memcpy(expected + segments[i].offset, segments[i].data, segments[i].length);
+
+    ezp_emulator_config config = test_config(SEGMENTS_FLASH_SIZE);
+    ezp_programmer *programmer = ezp_emulator_new(&config);
+    CHECK(programmer);
+    ezp_set_queue_depth(programmer, depth);
+    memset(ezp_emulator_flash(programmer), 0, SEGMENTS_FLASH_SIZE);
+    ezp_chip_data chip_data = test_chip(SEGMENTS_FLASH_SIZE);
+    int ret = ezp_write_flash_segments(programmer, segments, count, &chip_data, SPEED_12MHZ, NULL, NULL);
+    int equal = memcmp(ezp_emulator_flash(programmer), expected, SEGMENTS_FLASH_SIZE) == 0;
+
+    //unsorted, overlapping and past the end of the chip
+    const ezp_segment unsorted[] = {segments[1], segments[0]};
+    const ezp_segment overlapping[] = {{100, 300, data}, {399, 10, data}};
+    const ezp_segment outside[] = {{SEGMENTS_FLASH_SIZE - 10, 11, data}};
+    int rejected = ezp_write_flash_segments(programmer, unsorted, 2, &chip_data, SPEED_12MHZ, NULL, NULL) ==
+                   EZP_INVALID_RANGE &&
+                   ezp_write_flash_segments(programmer, overlapping, 2, &chip_data, SPEED_12MHZ, NULL, NULL) ==
+                   EZP_INVALID_RANGE &&
+                   ezp_write_flash_segments(programmer, outside, 1, &chip_data, SPEED_12MHZ, NULL, NULL) ==
+                   EZP_INVALID_RANGE;
+    int untouched = memcmp(ezp_emulator_flash(programmer), expected, SEGMENTS_FLASH_SIZE) == 0;
+    ezp_free_programmer(programmer);
+    free(expected);
+    free(data);
+    CHECK(ret == EZP_OK);
+    CHECK(equal);
+    CHECK(rejected);
+    CHECK(untouched);
+    return 0;
+}
+
+static int test_write_segments_depth_1() {
+    return write_segments(1);
+}
+
+static int test_write_segments_depth_8() {
+    return write_segments(8);
+}
+
+int main() {
+    int fd = mkstemp(image_file);
+    if (fd < 0) return EXIT_FAILURE;
+    close(fd);
+    int failed = 0;
+    RUN(test_ihex, failed);
+    RUN(test_srec, failed);
+    RUN(test_invalid, failed);
+    RUN(test_short_binary, failed);
+    RUN(test_write_segments_depth_1, failed);
+    RUN(test_write_segments_depth_8, failed);
+    unlink(image_file);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
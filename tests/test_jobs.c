@@ -0,0 +1,92 @@
+#include "ezp_test.h"
+#include "ezp_jobs.h"
+#include <unistd.h>
+
+#define JOBS_FLASH_SIZE 4096
+#define UNIQUE_CHIP_ID 0xc22016
+
+static char db_file[] = "/tmp/ezp_test_XXXXXX";
+static ezp_chips_db *db;
+
+static ezp_chip_data db_entry(const char *name, uint32_t chip_id) {
+    ezp_chip_data chip_data = test_chip(JOBS_FLASH_SIZE);
+    snprintf(chip_data.name, sizeof(chip_data.name), "%s", name);
+    chip_data.chip_id = chip_id;
+    return chip_data;
+}
+
+//two parts share TEST_CHIP_ID, UNIQUE_CHIP_ID has one
+static int write_db() {
+    ezp_chip_data entries[] = {
+            db_entry("SPI_FLASH,WINBOND,W25Q32BV", TEST_CHIP_ID),
+            db_entry("SPI_FLASH,WINBOND,W25Q32FV", TEST_CHIP_ID),
+            db_entry("SPI_FLASH,MACRONIX,MX25L1606E", UNIQUE_CHIP_ID)
+    };
+    int fd = mkstemp(db_file);
+    CHECK(fd >= 0);
+    close(fd);
+    CHECK(ezp_chips_data_write_indexed(entries, sizeof(entries) / sizeof(entries[0]), db_file) == EZP_OK);
+    return 0;
+}
+
+//detected read of the emulated chip. Returns the job status, the job is left in job
+static int detect_read(uint32_t chip_id, ezp_job *job) {
+    ezp_emulator_config config = test_config(JOBS_FLASH_SIZE);
+    config.chip_id = chip_id;
+    ezp_programmer *programmer = ezp_emulator_new(&config);
+    if (!programmer) return EZP_OUT_OF_MEMORY;
+    job->type = EZP_JOB_READ;
+    job->speed = SPEED_12MHZ;
+    job->detect = 1;
+    ezp_run_jobs(programmer, job, 1, db, NULL, NULL, NULL);
+    ezp_free_programmer(programmer);
+    free(job->image);
+    job->image = NULL;
+    return job->status;
+}
+
+static int test_detect_ambiguous() {
+    ezp_job job = {.chip_data = db_entry("SPI_FLASH,UNKNOWN,PART", TEST_CHIP_ID)};
+    CHECK(detect_read(TEST_CHIP_ID, &job) == EZP_CHIP_AMBIGUOUS);
+    CHECK(strcmp(job.chip_data.name, "SPI_FLASH,UNKNOWN,PART") == 0);
+    return 0;
+}
+
+//the caller picked one of the parts sharing the id, so it is kept
+static int test_detect_keeps_chip_data() {
+    ezp_job job = {.chip_data = db_entry("SPI_FLASH,WINBOND,W25Q32FV", TEST_CHIP_ID)};
+    job.chip_data.delay = 7;
+    CHECK(detect_read(TEST_CHIP_ID, &job) == EZP_OK);
+    CHECK(strcmp(job.chip_data.name, "SPI_FLASH,WINBOND,W25Q32FV") == 0);
+    CHECK(job.chip_data.delay == 7);
+    return 0;
+}
+
+static int test_detect_unique() {
+    ezp_job job = {0};
+    CHECK(detect_read(UNIQUE_CHIP_ID, &job) == EZP_OK);
+    CHECK(strcmp(job.chip_data.name, "SPI_FLASH,MACRONIX,MX25L1606E") == 0);
+    CHECK(job.chip_data.flash == JOBS_FLASH_SIZE);
+    return 0;
+}
+
+static int test_detect_unknown() {
+    ezp_job job = {.chip_data = db_entry("SPI_FLASH,WINBOND,W25Q32FV", TEST_CHIP_ID)};
+    CHECK(detect_read(0x123456, &job) == EZP_FLASH_NOT_DETECTED);
+    return 0;
+}
+
+int main() {
+    if (write_db()) return EXIT_FAILURE;
+    int ret = ezp_chips_db_open(&db, db_file);
+    unlink(db_file);
+    if (ret != EZP_OK) return EXIT_FAILURE;
+
+    int failed = 0;
+    RUN(test_detect_ambiguous, failed);
+    RUN(test_detect_keeps_chip_data, failed);
+    RUN(test_detect_unique, failed);
+    RUN(test_detect_unknown, failed);
+    ezp_chips_db_close(db);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
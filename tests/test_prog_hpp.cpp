@@ -0,0 +1,110 @@
+#include "ezp_prog.hpp"
+
+extern "C" {
+#include "ezp_test.h"
+}
+
+#include <coroutine>
+#include <exception>
+#include <vector>
+
+#define HPP_FLASH_SIZE (64 * 1024)
+
+//coroutine that starts at once and is left running; its frame is freed when it returns
+struct task {
+    struct promise_type {
+        task get_return_object() noexcept { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { std::terminate(); }
+    };
+};
+
+/**
+ * write - write_async result
+ * read - read_async result
+ * read_back - what read_async read
+ * verify - verify_async result of the written image
+ * corrupted - verify_async result of an image differing in one byte
+ */
+struct session {
+    std::error_code write;
+    std::error_code read;
+    std::error_code verify;
+    std::error_code corrupted;
+    std::vector<uint8_t> read_back;
+    bool finished = false;
+};
+
+static task transfer(ezp::programmer &programmer, std::vector<uint8_t> image, ezp_chip_data chip_data,
+                     session &result) {
+    result.write = co_await programmer.write_async(image, chip_data, SPEED_12MHZ);
+    result.read_back.resize(image.size());
+    result.read = co_await programmer.read_async(result.read_back, chip_data, SPEED_12MHZ);
+    result.verify = co_await programmer.verify_async(image, chip_data, SPEED_12MHZ);
+    image[1234] ^= 1;
+    result.corrupted = co_await programmer.verify_async(image, chip_data, SPEED_12MHZ);
+    result.finished = true;
+}
+
+static std::vector<uint8_t> image(uint32_t seed) {
+    uint8_t *data = test_image(HPP_FLASH_SIZE, seed);
+    std::vector<uint8_t> result(data, data + HPP_FLASH_SIZE);
+    free(data);
+    return result;
+}
+
+//one thread awaits operations of two programmers, handling events of both
+static int test_two_emulators() {
+    ezp_emulator_config config = test_config(HPP_FLASH_SIZE);
+    config.latency = 0.0002;
+    ezp::programmer first(ezp_emulator_new(&config));
+    ezp::programmer second(ezp_emulator_new(&config));
+    CHECK(first && second);
+    ezp_chip_data chip_data = test_chip(HPP_FLASH_SIZE);
+    std::vector<uint8_t> first_image = image(1), second_image = image(2);
+
+    session sessions[2];
+    transfer(first, first_image, chip_data, sessions[0]);
+    transfer(second, second_image, chip_data, sessions[1]);
+    while (!sessions[0].finished || !sessions[1].finished) {
+        CHECK(!first.handle_events());
+        CHECK(!second.handle_events());
+    }
+
+    CHECK(std::memcmp(ezp_emulator_flash(first.get()), first_image.data(), HPP_FLASH_SIZE) == 0);
+    CHECK(std::memcmp(ezp_emulator_flash(second.get()), second_image.data(), HPP_FLASH_SIZE) == 0);
+    for (const session &result : sessions) {
+        CHECK(!result.write);
+        CHECK(!result.read);
+        CHECK(!result.verify);
+        CHECK(result.corrupted == ezp::errc::verify_failed);
+    }
+    CHECK(sessions[0].read_back == first_image);
+    CHECK(sessions[1].read_back == second_image);
+    return 0;
+}
+
+//progress callables are called in place, const ones included
+static int test_const_progress() {
+    ezp_emulator_config config = test_config(HPP_FLASH_SIZE);
+    ezp::programmer programmer(ezp_emulator_new(&config));
+    CHECK(programmer);
+    ezp_chip_data chip_data = test_chip(HPP_FLASH_SIZE);
+    std::vector<uint8_t> data(HPP_FLASH_SIZE);
+    unsigned int calls = 0;
+    const auto progress = [&calls](uint32_t, uint32_t) { calls++; };
+    CHECK(!programmer.read(data, chip_data, SPEED_12MHZ, progress));
+    CHECK(calls > 0);
+    std::vector<uint8_t> small(10);
+    CHECK(programmer.read(small, chip_data, SPEED_12MHZ, progress) == ezp::errc::invalid_range);
+    return 0;
+}
+
+int main() {
+    int failed = 0;
+    RUN(test_two_emulators, failed);
+    RUN(test_const_progress, failed);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,147 @@
+#include "ezp_test.h"
+
+#define WINDOW_OFFSET (16 * 1024)
+#define WINDOW_LENGTH (8 * 1024)
+
+static ezp_programmer *programmer_with(const uint8_t *image) {
+    ezp_emulator_config config = test_config(TEST_FLASH_SIZE);
+    ezp_programmer *programmer = ezp_emulator_new(&config);
+    if (programmer) memcpy(ezp_emulator_flash(programmer), image, TEST_FLASH_SIZE);
+    return programmer;
+}
+
+//a window in the middle, one at the end of the chip, and an eeprom cut on the host
+static int test_read_range() {
+    uint8_t *image = test_image(TEST_FLASH_SIZE, 30);
+    uint8_t *read = malloc(WINDOW_LENGTH + 1);
+    CHECK(image && read);
+    ezp_programmer *programmer = programmer_with(image);
+    CHECK(programmer);
+    ezp_chip_data chip_data = test_chip(TEST_FLASH_SIZE);
+    const uint32_t offsets[] = {WINDOW_OFFSET, TEST_FLASH_SIZE - WINDOW_LENGTH, WINDOW_OFFSET};
+    for (size_t i = 0; i < sizeof(offsets) / sizeof(offsets[0]); ++i) {
+        if (i == 2) chip_data.clazz = EEPROM_25;
+        memset(read, 0x5a, WINDOW_LENGTH + 1);
+        int ret = ezp_read_flash_range(programmer, read, offsets[i], WINDOW_LENGTH, &chip_data, SPEED_12MHZ,
+                                       NULL, NULL);
+        CHECK(ret == EZP_OK);
+        CHECK(memcmp(read, image + offsets[i], WINDOW_LENGTH) == 0);
+        CHECK(read[WINDOW_LENGTH] == 0x5a);
+    }
+    ezp_free_programmer(programmer);
+    free(read);
+    free(image);
+    return 0;
+}
+
+static int test_write_range() {
+    uint8_t *image = test_image(TEST_FLASH_SIZE, 31);
+    uint8_t *patch = test_image(WINDOW_LENGTH, 32);
+    CHECK(image && patch);
+    ezp_programmer *programmer = programmer_with(image);
+    CHECK(programmer);
+    ezp_chip_data chip_data = test_chip(TEST_FLASH_SIZE);
+    int ret = ezp_write_flash_range(programmer, patch, WINDOW_OFFSET, WINDOW_LENGTH, &chip_data, SPEED_12MHZ,
+                                    NULL, NULL);
+    memcpy(image + WINDOW_OFFSET, patch, WINDOW_LENGTH);
+    int equal = memcmp(ezp_emulator_flash(programmer), image, TEST_FLASH_SIZE) == 0;
+
+    //the range holds the data now, so only the read happens
+    ezp_stats before, after;
+    ezp_get_stats(programmer, &before);
+    int same = ezp_write_flash_range(programmer, patch, WINDOW_OFFSET, WINDOW_LENGTH, &chip_data, SPEED_12MHZ,
+                                     NULL, NULL);
+    ezp_get_stats(programmer, &after);
+    ezp_free_programmer(programmer);
+    free(patch);
+    free(image);
+    CHECK(ret == EZP_OK);
+    CHECK(equal);
+    CHECK(same == EZP_OK);
+    CHECK(after.bytes_out - before.bytes_out < WINDOW_LENGTH);
+    return 0;
+}
+
+static int test_invalid_range() {
+    //offset and length, transfer blocks are 256 bytes
+    static const uint32_t ranges[][2] = {
+            {100, 256}, //misaligned offset
+            {256, 300}, //misaligned length
+            {256, 0}, //empty
+            {TEST_FLASH_SIZE - 256, 512}, //past the end
+            {TEST_FLASH_SIZE + 256, 256}, //starts past the end
+            {256, UINT32_MAX - 255} //offset + length wraps around
+    };
+    ezp_emulator_config config = test_config(TEST_FLASH_SIZE);
+    ezp_programmer *programmer = ezp_emulator_new(&config);
+    ezp_chip_data chip_data = test_chip(TEST_FLASH_SIZE);
+    uint8_t *data = calloc(TEST_FLASH_SIZE, 1);
+    CHECK(programmer && data);
+    memset(ezp_emulator_flash(programmer), 0x5a, TEST_FLASH_SIZE);
+    for (size_t i = 0; i < sizeof(ranges) / sizeof(ranges[0]); ++i) {
+        CHECK(ezp_read_flash_range(programmer, data, ranges[i][0], ranges[i][1], &chip_data, SPEED_12MHZ,
+                                   NULL, NULL) == EZP_INVALID_RANGE);
+        CHECK(ezp_write_flash_range(programmer, data, ranges[i][0], ranges[i][1], &chip_data, SPEED_12MHZ,
+                                    NULL, NULL) == EZP_INVALID_RANGE);
+    }
+    int untouched = ezp_emulator_flash(programmer)[0] == 0x5a;
+    ezp_free_programmer(programmer);
+    free(data);
+    CHECK(untouched);
+    return 0;
+}
+
+//the chip already holds the image, so it is only read
+static int test_diff_unchanged() {
+    uint8_t *image = test_image(TEST_FLASH_SIZE, 33);
+    CHECK(image);
+    ezp_programmer *programmer = programmer_with(image);
+    CHECK(programmer);
+    ezp_chip_data chip_data = test_chip(TEST_FLASH_SIZE);
+    ezp_diff_report report;
+    int ret = ezp_write_flash_diff(programmer, image, &chip_data, SPEED_12MHZ, 0, &report, NULL, NULL);
+    ezp_stats stats;
+    ezp_get_stats(programmer, &stats);
+    ezp_free_programmer(programmer);
+    free(image);
+    CHECK(ret == EZP_OK);
+    CHECK(report.sectors_count == TEST_FLASH_SIZE / EZP_SECTOR_SIZE);
+    CHECK(report.sectors_changed == 0);
+    CHECK(report.sectors_written == 0);
+    CHECK(report.sectors_skipped == report.sectors_count);
+    CHECK(report.bytes_saved == TEST_FLASH_SIZE);
+    CHECK(stats.bytes_out < TEST_FLASH_SIZE);
+    return 0;
+}
+
+//one changed byte still means a write of the whole chip
+static int test_diff_one_byte() {
+    uint8_t *image = test_image(TEST_FLASH_SIZE, 34);
+    CHECK(image);
+    ezp_programmer *programmer = programmer_with(image);
+    CHECK(programmer);
+    image[3 * EZP_SECTOR_SIZE + 17] ^= 0x40;
+    ezp_chip_data chip_data = test_chip(TEST_FLASH_SIZE);
+    ezp_diff_report report;
+    int ret = ezp_write_flash_diff(programmer, image, &chip_data, SPEED_12MHZ, 0, &report, NULL, NULL);
+    int equal = memcmp(ezp_emulator_flash(programmer), image, TEST_FLASH_SIZE) == 0;
+    ezp_free_programmer(programmer);
+    free(image);
+    CHECK(ret == EZP_OK);
+    CHECK(equal);
+    CHECK(report.sectors_changed == 1);
+    CHECK(report.sectors_written == report.sectors_count);
+    CHECK(report.sectors_skipped == 0);
+    CHECK(report.bytes_saved == 0);
+    return 0;
+}
+
+int main() {
+    int failed = 0;
+    RUN(test_read_range, failed);
+    RUN(test_write_range, failed);
+    RUN(test_invalid_range, failed);
+    RUN(test_diff_unchanged, failed);
+    RUN(test_diff_one_byte, failed);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,175 @@
+#include "ezp_test.h"
+#include "ezp_capture.h"
+#include "ezp_trace.h"
+
+#define RETRY_FLASH 4096
+#define RETRY_PAGE 256
+#define RETRY_BLOCKS (RETRY_FLASH / RETRY_PAGE)
+
+static const uint8_t packet[64];
+static uint8_t image[RETRY_FLASH];
+static ezp_capture *capture;
+
+//the replay answers by position in the trace, so records only need the right endpoint, status and data
+static void record(unsigned char endpoint, const uint8_t *data, int length, int actual_length, int status) {
+    ezp_capture_record(capture, endpoint, data, length, actual_length, status, 0, 0);
+}
+
+static void command() {
+    record(0x02, packet, sizeof(packet), sizeof(packet), LIBUSB_SUCCESS);
+    record(0x82, packet, sizeof(packet), sizeof(packet), LIBUSB_SUCCESS);
+}
+
+//chip data and start of a read transaction
+static void start() {
+    command();
+    command();
+}
+
+//reset of a read transaction
+static void finish() {
+    command();
+}
+
+static void block(uint32_t index) {
+    record(0x82, image + index * RETRY_PAGE, RETRY_PAGE, RETRY_PAGE, LIBUSB_SUCCESS);
+}
+
+static void failed(int status) {
+    record(0x82, NULL, RETRY_PAGE, 0, status);
+}
+
+//the reset sent after a failed transaction has no response
+static void abandon() {
+    record(0x02, packet, sizeof(packet), sizeof(packet), LIBUSB_SUCCESS);
+}
+
+/**
+ * Block 1 times out. At depth 1 the transfer is repeated. Pipelined, the blocks submitted behind it come back
+ * cancelled, that is all the rest of the ring and the block submitted once block 0 completed, then the ring
+ * restarts at block 1. Every trace is consumed in submission order
+ * timeouts - times block 1 times out in a row
+ */
+static void timeouts_trace(unsigned int depth, unsigned int timeouts) {
+    start();
+    block(0);
+    for (unsigned int i = 0; i < timeouts; ++i) {
+        failed(LIBUSB_ERROR_TIMEOUT);
+        for (unsigned int j = 1; j < depth; ++j) failed(LIBUSB_ERROR_INTERRUPTED);
+    }
+}
+
+static ezp_programmer *replay(void (*trace)(unsigned int), unsigned int depth) {
+    FILE *file = tmpfile();
+    if (!file) return NULL;
+    capture = ezp_capture_new(1 << 20, file);
+    if (!capture) {
+        fclose(file);
+        return NULL;
+    }
+    trace(depth);
+    ezp_capture_free(capture);
+    rewind(file);
+    ezp_programmer *programmer = NULL;
+    if (ezp_replay_new(file, 0, &programmer) != EZP_OK) programmer = NULL;
+    fclose(file);
+    if (programmer) ezp_set_queue_depth(programmer, depth);
+    return programmer;
+}
+
+static void recovered_trace(unsigned int depth) {
+    timeouts_trace(depth, 1);
+    for (uint32_t i = 1; i < RETRY_BLOCKS; ++i) block(i);
+    finish();
+}
+
+static void exhausted_trace(unsigned int depth) {
+    timeouts_trace(depth, EZP_DEFAULT_RETRIES + 1);
+    abandon();
+}
+
+//the second transaction streams from 0 again. Its block 0 differs, the one already confirmed must be kept
+static void restarted_trace(unsigned int depth) {
+    static const uint8_t stale[RETRY_PAGE];
+    exhausted_trace(depth);
+    start();
+    record(0x82, stale, RETRY_PAGE, RETRY_PAGE, LIBUSB_SUCCESS);
+    for (uint32_t i = 1; i < RETRY_BLOCKS; ++i) block(i);
+    finish();
+}
+
+static int read_replay(void (*trace)(unsigned int), unsigned int depth, unsigned int restarts, int *ret,
+                       uint8_t *data, ezp_stats *stats) {
+    ezp_programmer *programmer = replay(trace, depth);
+    CHECK(programmer);
+    ezp_set_read_restarts(programmer, restarts);
+    ezp_chip_data chip_data = test_chip(RETRY_FLASH);
+    chip_data.flash_page = RETRY_PAGE;
+    memset(data, 0, RETRY_FLASH);
+    *ret = ezp_read_flash_into(programmer, data, &chip_data, SPEED_12MHZ, NULL, NULL);
+    ezp_get_stats(programmer, stats);
+    ezp_free_programmer(programmer);
+    return 0;
+}
+
+static int recovered(unsigned int depth) {
+    uint8_t data[RETRY_FLASH];
+    ezp_stats stats;
+    int ret;
+    CHECK(read_replay(recovered_trace, depth, 0, &ret, data, &stats) == 0);
+    CHECK(ret == EZP_OK);
+    CHECK(memcmp(data, image, RETRY_FLASH) == 0);
+    CHECK(stats.timeouts == 1);
+    CHECK(stats.retries == 1);
+    return 0;
+}
+
+static int test_recovered_depth_1() {
+    return recovered(1);
+}
+
+static int test_recovered_depth_8() {
+    return recovered(8);
+}
+
+//once the retries are used up the read fails, without starting a new transaction
+static int exhausted(unsigned int depth) {
+    uint8_t data[RETRY_FLASH];
+    ezp_stats stats;
+    int ret;
+    CHECK(read_replay(exhausted_trace, depth, 0, &ret, data, &stats) == 0);
+    CHECK(ret == EZP_LIBUSB_ERROR);
+    CHECK(stats.timeouts == EZP_DEFAULT_RETRIES + 1);
+    CHECK(stats.retries == EZP_DEFAULT_RETRIES);
+    return 0;
+}
+
+static int test_exhausted_depth_1() {
+    return exhausted(1);
+}
+
+static int test_exhausted_depth_8() {
+    return exhausted(8);
+}
+
+static int test_restart_opt_in() {
+    uint8_t data[RETRY_FLASH];
+    ezp_stats stats;
+    int ret;
+    CHECK(read_replay(restarted_trace, 1, 1, &ret, data, &stats) == 0);
+    CHECK(ret == EZP_OK);
+    CHECK(memcmp(data, image, RETRY_FLASH) == 0);
+    CHECK(stats.retries == EZP_DEFAULT_RETRIES + 1);
+    return 0;
+}
+
+int main() {
+    for (uint32_t i = 0; i < RETRY_FLASH; ++i) image[i] = (uint8_t) (i / RETRY_PAGE + 0x10);
+    int failed = 0;
+    RUN(test_recovered_depth_1, failed);
+    RUN(test_recovered_depth_8, failed);
+    RUN(test_exhausted_depth_1, failed);
+    RUN(test_exhausted_depth_8, failed);
+    RUN(test_restart_opt_in, failed);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,141 @@
+#include "ezp_test.h"
+#include "ezp_sparse.h"
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define CHUNK EZP_STREAM_CHUNK_SIZE
+
+static char data_file[] = "/tmp/ezp_test_XXXXXX";
+static char runs_file[] = "/tmp/ezp_test_XXXXXX";
+
+//data, erased chunks, zeroed chunks, data again and an erased rest
+static uint8_t *sparse_image() {
+    uint8_t *image = test_image(TEST_FLASH_SIZE, 50);
+    if (!image) return NULL;
+    memset(image + 2 * CHUNK, 0xff, 8 * CHUNK);
+    memset(image + 10 * CHUNK, 0x00, 4 * CHUNK);
+    memset(image + 15 * CHUNK, 0xff, TEST_FLASH_SIZE - 15 * CHUNK);
+    return image;
+}
+
+static int read_runs(ezp_runs_header *header, ezp_run *runs, size_t max_runs) {
+    FILE *f = fopen(runs_file, "rb");
+    CHECK(f);
+    CHECK(fread(header, sizeof(*header), 1, f) == 1);
+    CHECK(header->count <= max_runs);
+    CHECK(fread(runs, sizeof(ezp_run), header->count, f) == header->count);
+    fclose(f);
+    return 0;
+}
+
+static int write_runs(const ezp_runs_header *header, const ezp_run *runs, uint32_t count) {
+    FILE *f = fopen(runs_file, "wb");
+    CHECK(f);
+    CHECK(fwrite(header, sizeof(*header), 1, f) == 1);
+    CHECK(fwrite(runs, sizeof(ezp_run), count, f) == count);
+    CHECK(fclose(f) == 0);
+    return 0;
+}
+
+static int test_round_trip() {
+    uint8_t *image = sparse_image();
+    CHECK(image);
+    ezp_emulator_config config = test_config(TEST_FLASH_SIZE);
+    ezp_programmer *programmer = ezp_emulator_new(&config);
+    CHECK(programmer);
+    memcpy(ezp_emulator_flash(programmer), image, TEST_FLASH_SIZE);
+    ezp_chip_data chip_data = test_chip(TEST_FLASH_SIZE);
+    int ret = ezp_read_flash_to_sparse_file(programmer, data_file, runs_file, &chip_data, SPEED_12MHZ, NULL, NULL);
+    ezp_free_programmer(programmer);
+    CHECK(ret == EZP_OK);
+
+    //neighbouring chunks of one value are one run, runs of different values stay apart
+    ezp_runs_header header;
+    ezp_run runs[8];
+    CHECK(read_runs(&header, runs, 8) == 0);
+    CHECK(header.magic == EZP_RUNS_MAGIC && header.size == TEST_FLASH_SIZE);
+    CHECK(header.count == 3);
+    CHECK(runs[0].offset == 2 * CHUNK && runs[0].length == 8 * CHUNK && runs[0].value == 0xff);
+    CHECK(runs[1].offset == 10 * CHUNK && runs[1].length == 4 * CHUNK && runs[1].value == 0x00);
+    CHECK(runs[2].offset == 15 * CHUNK && runs[2].length == TEST_FLASH_SIZE - 15 * CHUNK && runs[2].value == 0xff);
+
+    //only the three data chunks take space
+    struct stat st;
+    CHECK(stat(data_file, &st) == 0);
+    CHECK(st.st_size == TEST_FLASH_SIZE);
+    CHECK(st.st_blocks * 512 < TEST_FLASH_SIZE / 2);
+
+    uint8_t *loaded = NULL;
+    uint32_t size = 0;
+    CHECK(ezp_load_sparse_file(data_file, runs_file, &loaded, &size) == EZP_OK);
+    CHECK(size == TEST_FLASH_SIZE);
+    CHECK(memcmp(loaded, image, TEST_FLASH_SIZE) == 0);
+    free(loaded);
+    free(image);
+    return 0;
+}
+
+//every sidecar is a broken copy of the one written by test_round_trip
+static int test_corrupt_runs() {
+    ezp_runs_header header;
+    ezp_run runs[8];
+    CHECK(read_runs(&header, runs, 8) == 0);
+    CHECK(header.count == 3);
+    uint8_t *loaded = NULL;
+    uint32_t size;
+
+    ezp_runs_header bad = header;
+    bad.magic ^= 1;
+    CHECK(write_runs(&bad, runs, 3) == 0);
+    CHECK(ezp_load_sparse_file(data_file, runs_file, &loaded, &size) == EZP_ERROR_INVALID_FILE);
+
+    bad = header;
+    bad.version++;
+    CHECK(write_runs(&bad, runs, 3) == 0);
+    CHECK(ezp_load_sparse_file(data_file, runs_file, &loaded, &size) == EZP_ERROR_INVALID_FILE);
+
+    ezp_run unsorted[3] = {runs[1], runs[0], runs[2]};
+    CHECK(write_runs(&header, unsorted, 3) == 0);
+    CHECK(ezp_load_sparse_file(data_file, runs_file, &loaded, &size) == EZP_ERROR_INVALID_FILE);
+
+    ezp_run overlapping[3] = {runs[0], runs[1], runs[2]};
+    overlapping[1].offset -= CHUNK;
+    CHECK(write_runs(&header, overlapping, 3) == 0);
+    CHECK(ezp_load_sparse_file(data_file, runs_file, &loaded, &size) == EZP_ERROR_INVALID_FILE);
+
+    ezp_run outside[3] = {runs[0], runs[1], runs[2]};
+    outside[2].length += CHUNK;
+    CHECK(write_runs(&header, outside, 3) == 0);
+    CHECK(ezp_load_sparse_file(data_file, runs_file, &loaded, &size) == EZP_ERROR_INVALID_FILE);
+
+    outside[2] = runs[2];
+    outside[2].offset = UINT32_MAX - CHUNK;
+    CHECK(write_runs(&header, outside, 3) == 0);
+    CHECK(ezp_load_sparse_file(data_file, runs_file, &loaded, &size) == EZP_ERROR_INVALID_FILE);
+
+    //the sidecar announces more runs than it holds
+    CHECK(write_runs(&header, runs, 2) == 0);
+    CHECK(ezp_load_sparse_file(data_file, runs_file, &loaded, &size) == EZP_ERROR_INVALID_FILE);
+
+    //the data file is not the size of the image
+    bad = header;
+    bad.size = TEST_FLASH_SIZE * 2;
+    CHECK(write_runs(&bad, runs, 3) == 0);
+    CHECK(ezp_load_sparse_file(data_file, runs_file, &loaded, &size) == EZP_ERROR_INVALID_FILE);
+    CHECK(loaded == NULL);
+    return 0;
+}
+
+int main() {
+    int data_fd = mkstemp(data_file);
+    int runs_fd = mkstemp(runs_file);
+    if (data_fd < 0 || runs_fd < 0) return EXIT_FAILURE;
+    close(data_fd);
+    close(runs_fd);
+    int failed = 0;
+    RUN(test_round_trip, failed);
+    RUN(test_corrupt_runs, failed);
+    unlink(data_file);
+    unlink(runs_file);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}